@@ -50,6 +50,7 @@
 #include "esp_system.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
+#include "soc/gpio_struct.h"
 
 /******************************************************************************
 function:	Initialization pin
@@ -59,10 +60,6 @@ Info:
 
 spi_device_handle_t spi = 0;
 
-//To speed up transfers, every SPI transfer sends a bunch of lines. This define specifies how many. More means more memory use,
-//but less overhead for setting up / finishing transfers. Make sure 240 is dividable by this.
-#define PARALLEL_LINES 16
-
 static void DEV_GPIOConfig(void)
 {
     // --- output pins ---
@@ -74,7 +71,7 @@ static void DEV_GPIOConfig(void)
     //set as output mode
     io_conf.mode = GPIO_MODE_OUTPUT;
     //bit mask of the pins that you want to set,e.g.GPIO18/19
-    io_conf.pin_bit_mask = ((1ULL<<EPD_RST_PIN) | (1ULL<<EPD_DC_PIN) | (1ULL<<EPD_CS_PIN));
+    io_conf.pin_bit_mask = ((1ULL<<EPD_RST_PIN) | (1ULL<<EPD_DC_PIN));
     //disable pull-down mode
     io_conf.pull_down_en = 0;
     //disable pull-up mode
@@ -98,54 +95,63 @@ static void DEV_GPIOConfig(void)
 }
 
 
-void DEV_SPI_WriteByte(UBYTE value)
-{
-  spi_transaction_t t;
-  
-  memset(&t, 0, sizeof(t));
-  
-  t.length = 8;  //length in bits
-  t.tx_buffer = (const uint8_t *)&value;
-  // gpio_set_level(EPD_DC_PIN, 0);
-  esp_err_t err = spi_device_transmit(spi, &t);
-  // gpio_set_level(EPD_DC_PIN, 1);
-  assert(err==ESP_OK);
-/*
-    char data[1];
-    spi_transaction_t trans_desc;
-    // trans_desc.address = 0;
-    //trans_desc.command = 0;
-    trans_desc.flags = 0;
-    trans_desc.length = 1 * 8;
-    trans_desc.rxlength = 0;
-    trans_desc.tx_buffer = data;
-    trans_desc.rx_buffer = data;
+// Transactions in flight, completed in the order queued
+#define SPI_QUEUE_SIZE 7
+static spi_transaction_t spiQueue[SPI_QUEUE_SIZE];
+static int spiQueued = 0;
+static int spiNext = 0;
 
-    data[0] = value;
+static void DEV_SPI_WaitOne(void)
+{
+    spi_transaction_t *done;
+    esp_err_t err = spi_device_get_trans_result(spi, &done, portMAX_DELAY);
+    assert(err==ESP_OK);
+    spiQueued--;
+}
 
-    gpio_set_level(EPD_DC_PIN, 0);
-ESP_ERROR_CHECK(spi_device_transmit(spi, &trans_desc));
-gpio_set_level(EPD_DC_PIN, 1);
-*/
-    /*
-    esp_err_t ret;
-    spi_transaction_t t;
-    memset(&t, 0, sizeof(t));       //Zero out the transaction
-    t.length=8;                     //Command is 8 bits
-    t.tx_buffer=&value;               //The data is the cmd itself
-    t.user=(void*)0;                //D/C needs to be set to 0
-    ret=spi_device_polling_transmit(spi, &t);  //Transmit!
-    assert(ret==ESP_OK); //Should have had no issues.
-    */
+void DEV_SPI_Queue(const UBYTE *data, UDOUBLE len, UBYTE dc)
+{
+    while (len > 0) {
+        UDOUBLE chunk = len < DEV_SPI_MAX_TRANSFER ? len : DEV_SPI_MAX_TRANSFER;
+        if (spiQueued == SPI_QUEUE_SIZE) {
+            // The oldest slot is the next one
+            DEV_SPI_WaitOne();
+        }
+        spi_transaction_t *t = &spiQueue[spiNext];
+        memset(t, 0, sizeof(*t));
+        t->length = chunk * 8;  //length in bits
+        t->user = (void*)(intptr_t)dc;
+        if (chunk <= 4) {
+            t->flags = SPI_TRANS_USE_TXDATA;
+            memcpy(t->tx_data, data, chunk);
+        } else {
+            t->tx_buffer = data;
+        }
+        esp_err_t err = spi_device_queue_trans(spi, t, portMAX_DELAY);
+        assert(err==ESP_OK);
+        spiNext = (spiNext + 1) % SPI_QUEUE_SIZE;
+        spiQueued++;
+        data += chunk;
+        len -= chunk;
+    }
+}
 
+void DEV_SPI_Flush(void)
+{
+    while (spiQueued > 0) {
+        DEV_SPI_WaitOne();
+    }
 }
 
 //This function is called (in irq context!) just before a transmission starts. It will
 //set the D/C line to the value indicated in the user field.
-void lcd_spi_pre_transfer_callback(spi_transaction_t *t)
+static void IRAM_ATTR lcd_spi_pre_transfer_callback(spi_transaction_t *t)
 {
-    int dc=(int)t->user;
-    gpio_set_level(EPD_DC_PIN, dc);
+    if ((int)t->user) {
+        GPIO.out_w1ts = 1 << EPD_DC_PIN;
+    } else {
+        GPIO.out_w1tc = 1 << EPD_DC_PIN;
+    }
 }
 
 /******************************************************************************
@@ -163,16 +169,16 @@ UBYTE DEV_ModuleInit(void)
         .sclk_io_num=EPD_SCK_PIN,
         .quadwp_io_num=-1,
         .quadhd_io_num=-1,
-        .max_transfer_sz=PARALLEL_LINES*320*2+8
+        .max_transfer_sz=DEV_SPI_MAX_TRANSFER
     };
     spi_device_interface_config_t devcfg={
 //      .clock_speed_hz=2000000,
         .clock_speed_hz=32000000,
         .flags=SPI_DEVICE_HALFDUPLEX, // HACK?
         .mode=0,                                //SPI mode 0
-        .spics_io_num=-1, // EPD_CS_PIN,               //CS pin
-        .queue_size=7,                          //We want to be able to queue 7 transactions at a time
-        //.pre_cb=lcd_spi_pre_transfer_callback,  //Specify pre-transfer callback to handle D/C line
+        .spics_io_num=EPD_CS_PIN,               //CS pin, driven by the SPI peripheral
+        .queue_size=SPI_QUEUE_SIZE,             //Queue a whole command script at a time
+        .pre_cb=lcd_spi_pre_transfer_callback,  //Specify pre-transfer callback to handle D/C line
     };
     //Initialize the SPI bus
     ret=spi_bus_initialize(HSPI_HOST, &buscfg, 1);
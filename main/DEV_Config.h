@@ -66,6 +66,17 @@
 #define UWORD   uint16_t
 #define UDOUBLE uint32_t
 
+/**
+ * Constant data sent from where it is, without a copy: DMA only reaches
+ * internal RAM
+**/
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#define DEV_SPI_DATA DRAM_ATTR
+#else
+#define DEV_SPI_DATA
+#endif
+
 /**
  * GPIO config
 **/
@@ -89,8 +100,24 @@
 **/
 #define DEV_Delay_ms(__xms) vTaskDelay(__xms / portTICK_PERIOD_MS);
 
+/**
+ * delay at least x ms: a tick delay ends at a tick boundary, which can come
+ * straight away, so one more tick is waited for timings the panel needs
+**/
+#define DEV_Delay_min_ms(__xms) vTaskDelay(pdMS_TO_TICKS(__xms) + 1);
+
+/**
+ * SPI: longest single transfer
+**/
+#define DEV_SPI_MAX_TRANSFER 4096
+
 /*------------------------------------------------------------------------------------------------------*/
-void DEV_SPI_WriteByte(UBYTE value);
+// Queue bytes for sending with DC at the given level (0 command, 1 data).
+// Up to four bytes are copied; longer data has to stay put until the next
+// DEV_SPI_Flush.
+void DEV_SPI_Queue(const UBYTE *data, UDOUBLE len, UBYTE dc);
+// Wait until everything queued has been sent
+void DEV_SPI_Flush(void);
 UBYTE DEV_ModuleInit(void);
 void DEV_ModuleExit(void);
 
@@ -47,5 +47,9 @@
 	#define Debug(__info,...)  
 #endif
 
+#ifdef __cplusplus
+  }
+#endif
+
 #endif
 
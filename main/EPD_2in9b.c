@@ -37,84 +37,205 @@
 ******************************************************************************/
 #include "EPD_2in9b.h"
 #include "Debug.h"
+#include "power_policy.h"
+#include "trace.h"
+
+// Current waveform, NULL for the panel's tri-color one
+static const EPD_LUT *activeLut = NULL;
+
+// The plane being sent, or 0 if rows are dropped
+static UBYTE planeCommand = 0;
+static UDOUBLE planeHash;
+static UDOUBLE planeBytes;
+
+// What the panel's red RAM holds.  Only known between a full upload and
+// the deep sleep that loses it, so a red plane sent again unchanged in the
+// same session is skipped.
+static int redRamKnown = 0;
+static UDOUBLE redRamHash;
+
+// A short drive straight to the target color.  The white tables match and
+// so do the black ones, so the old-data RAM is never needed.  Untested on a
+// panel, and each table drives one polarity only with no balancing phase,
+// so it is off unless BADGE_FAST_REFRESHES is set.
+DEV_SPI_DATA const EPD_LUT EPD_LUT_FAST_MONO = {
+    .vcom = { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x01 },
+    .ww   = { 0xA0, 0x0C, 0x0C, 0x00, 0x00, 0x01 },
+    .bw   = { 0xA0, 0x0C, 0x0C, 0x00, 0x00, 0x01 },
+    .wb   = { 0x50, 0x0C, 0x0C, 0x00, 0x00, 0x01 },
+    .bb   = { 0x50, 0x0C, 0x0C, 0x00, 0x00, 0x01 },
+};
+
+// Command scripts: each command, its parameter count and its parameters,
+// played back as one transfer for the command and one for the parameters.
+#define EPD_SCRIPT_CONFIGURE(panelSetting) \
+    BOOSTER_SOFT_START, 3, 0x17, 0x17, 0x17, \
+    PANEL_SETTING, 1, panelSetting, \
+    VCOM_AND_DATA_INTERVAL_SETTING, 1, 0x77, \
+    TCON_RESOLUTION, 4, EPD_WIDTH >> 8, EPD_WIDTH & 0xff, EPD_HEIGHT >> 8, EPD_HEIGHT & 0xff, \
+    VCM_DC_SETTING_REGISTER, 1, 0x0A
+
+// 0x8F: tri-color waveform from OTP; 0xBF: black and white from the LUT
+// registers
+DEV_SPI_DATA static const UBYTE configureOtpScript[] = { EPD_SCRIPT_CONFIGURE(0x8F) };
+DEV_SPI_DATA static const UBYTE configureLutScript[] = { EPD_SCRIPT_CONFIGURE(0xBF) };
+DEV_SPI_DATA static const UBYTE deepSleepScript[] = {
+    DEEP_SLEEP, 1, 0xA5,    // check code
+};
 
 /******************************************************************************
-function :	Software reset
+function :	send command
 parameter:
+     Reg : Command register
 ******************************************************************************/
-static void EPD_Reset(void)
+static void EPD_SendCommand(UBYTE Reg)
 {
-    DEV_Digital_Write(EPD_RST_PIN, 1);
-    DEV_Delay_ms(200);
-    DEV_Digital_Write(EPD_RST_PIN, 0);
-    DEV_Delay_ms(200);
-    DEV_Digital_Write(EPD_RST_PIN, 1);
-    DEV_Delay_ms(200);
+    DEV_SPI_Queue(&Reg, 1, 0);
 }
 
 /******************************************************************************
-function :	send command
+function :	queue a command script
 parameter:
-     Reg : Command register
+  script : command, parameter count, parameters, ...
+     Len : bytes in the script
 ******************************************************************************/
-static void EPD_SendCommand(UBYTE Reg)
+static void EPD_QueueScript(const UBYTE *script, UWORD Len)
 {
-    DEV_Digital_Write(EPD_DC_PIN, 0);
-    DEV_Digital_Write(EPD_CS_PIN, 0);
-    DEV_SPI_WriteByte(Reg);
-    DEV_Digital_Write(EPD_CS_PIN, 1);
+    for (UWORD i = 0; i + 1 < Len; i += 2 + script[i + 1]) {
+        EPD_SendCommand(script[i]);
+        if (script[i + 1]) {
+            DEV_SPI_Queue(script + i + 2, script[i + 1], 1);
+        }
+    }
 }
 
 /******************************************************************************
-function :	send data
+function :	queue one LUT register
 parameter:
-    Data : Write data
+     Reg : LUT_VCOM .. LUT_BB
+     lut : table
+     Len : bytes in the table
 ******************************************************************************/
-static void EPD_SendData(UBYTE Data)
+static void EPD_QueueLut(UBYTE Reg, const UBYTE *lut, UWORD Len)
 {
-    DEV_Digital_Write(EPD_DC_PIN, 1);
-    DEV_Digital_Write(EPD_CS_PIN, 0);
-    DEV_SPI_WriteByte(Data);
-    DEV_Digital_Write(EPD_CS_PIN, 1);
+    EPD_SendCommand(Reg);
+    DEV_SPI_Queue(lut, Len, 1);
 }
 
 /******************************************************************************
-function :	Wait until the busy_pin goes LOW
+function :	Poll until the busy line is released
+parameter:
+******************************************************************************/
+static void EPD_PollBusy(void)
+{
+    DEV_SPI_Flush();
+    while(DEV_Digital_Read(EPD_BUSY_PIN) == 0) {      //LOW: busy
+        DEV_Delay_ms(10);
+    }
+}
+
+/******************************************************************************
+function :	Check the busy line
+parameter:
+******************************************************************************/
+int EPD_Busy(void)
+{
+    return DEV_Digital_Read(EPD_BUSY_PIN) == 0;
+}
+
+/******************************************************************************
+function :	Wait until the busy_pin goes HIGH
 parameter:
 ******************************************************************************/
 void EPD_WaitUntilIdle(void)
 {
+    int64_t start = trace_now_us();
     Debug("e-Paper busy\r\n");
-    while(DEV_Digital_Read(EPD_BUSY_PIN) == 0) {      //LOW: idle, HIGH: busy
-        DEV_Delay_ms(100);
-    }
+    EPD_PollBusy();
     Debug("e-Paper busy release\r\n");
+    trace_add(TRACE_BUSY_WAIT, trace_now_us() - start);
 }
 
 /******************************************************************************
-function :	Initialize the e-Paper register
+function :	Hardware reset
 parameter:
 ******************************************************************************/
-UBYTE EPD_Init(const unsigned char* lut)
+void EPD_Reset(void)
 {
-    EPD_Reset();
+    int64_t start = trace_now_us();
+    DEV_SPI_Flush();
+    // A short low pulse restarts the controller, which holds the busy line
+    // until it is ready.  It only pulls busy low some time after reset is
+    // released, so polling straight away can read it as idle.
+    DEV_Digital_Write(EPD_RST_PIN, 0);
+    DEV_Delay_min_ms(10);
+    DEV_Digital_Write(EPD_RST_PIN, 1);
+    DEV_Delay_min_ms(10);
+    EPD_PollBusy();
+    activeLut = NULL;
+    planeCommand = 0;
+    trace_add(TRACE_PANEL_RESET, trace_now_us() - start);
+}
 
-    EPD_SendCommand(BOOSTER_SOFT_START);
-    EPD_SendData(0x17);
-    EPD_SendData(0x17);
-    EPD_SendData(0x17);
+/******************************************************************************
+function :	Set the registers for a waveform
+parameter:
+     lut : NULL for the tri-color OTP waveform
+******************************************************************************/
+void EPD_Configure(const EPD_LUT *lut)
+{
+    activeLut = lut;
+    planeCommand = 0;
+
+    if (lut) {
+        EPD_QueueScript(configureLutScript, sizeof(configureLutScript));
+        EPD_QueueLut(LUT_VCOM, lut->vcom, sizeof(lut->vcom));
+        EPD_QueueLut(LUT_WW, lut->ww, sizeof(lut->ww));
+        EPD_QueueLut(LUT_BW, lut->bw, sizeof(lut->bw));
+        EPD_QueueLut(LUT_WB, lut->wb, sizeof(lut->wb));
+        EPD_QueueLut(LUT_BB, lut->bb, sizeof(lut->bb));
+    } else {
+        EPD_QueueScript(configureOtpScript, sizeof(configureOtpScript));
+    }
+    DEV_SPI_Flush();
+}
+
+/******************************************************************************
+function :	Turn the panel drivers on and off.  Registers and RAM are kept.
+parameter:
+******************************************************************************/
+void EPD_PowerOn(void)
+{
     EPD_SendCommand(POWER_ON);
     EPD_WaitUntilIdle();
-    EPD_SendCommand(PANEL_SETTING);
-    EPD_SendData(0x8F);
-    EPD_SendCommand(VCOM_AND_DATA_INTERVAL_SETTING);
-    EPD_SendData(0x77);
-    EPD_SendCommand(TCON_RESOLUTION);
-    EPD_SendData(0x80);
-    EPD_SendData(0x01);
-    EPD_SendData(0x28);
-    EPD_SendCommand(VCM_DC_SETTING_REGISTER);
-    EPD_SendData(0X0A);
+}
+
+void EPD_PowerOff(void)
+{
+    EPD_SendCommand(POWER_OFF);
+    EPD_WaitUntilIdle();
+}
+
+/******************************************************************************
+function :	Deep sleep; registers and RAM are lost and only a reset wakes it
+parameter:
+******************************************************************************/
+void EPD_DeepSleep(void)
+{
+    EPD_QueueScript(deepSleepScript, sizeof(deepSleepScript));
+    DEV_SPI_Flush();
+    redRamKnown = 0;
+}
+
+/******************************************************************************
+function :	Initialize the e-Paper register
+parameter:
+******************************************************************************/
+UBYTE EPD_Init(const EPD_LUT *lut)
+{
+    EPD_Reset();
+    EPD_Configure(lut);
+    EPD_PowerOn();
     return 0;
 }
 
@@ -124,70 +245,179 @@ parameter:
 ******************************************************************************/
 void EPD_Clear(void)
 {
-    EPD_SendCommand(TCON_RESOLUTION);
-    EPD_SendData(EPD_WIDTH >> 8);
-    EPD_SendData(EPD_WIDTH & 0xff);
-    EPD_SendData(EPD_HEIGHT >> 8);
-    EPD_SendData(EPD_HEIGHT & 0xff);
-
+    // A band of white rows, sent over and over
     UWORD Width = (EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1);
-    UWORD Height = EPD_HEIGHT;
+    const UWORD Rows = 24;
+    UBYTE white[((EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1)) * 24];
+    memset(white, 0xFF, Width * Rows);
 
-    //send black data
-    EPD_SendCommand(DATA_START_TRANSMISSION_1);
-    for (UWORD j = 0; j < Height; j++) {
-        for (UWORD i = 0; i < Width; i++) {
-            EPD_SendData(0xFF);
+    //send black data, then red data
+    const UBYTE planes[2] = { DATA_START_TRANSMISSION_1, DATA_START_TRANSMISSION_2 };
+    for (int plane = 0; plane < 2; plane++) {
+        if (!EPD_StartPlane(planes[plane])) {
+            continue;
+        }
+        for (UWORD j = 0; j < EPD_HEIGHT; j += Rows) {
+            EPD_SendPlaneRows(white, EPD_HEIGHT - j < Rows ? EPD_HEIGHT - j : Rows);
         }
+        EPD_EndPlane();
     }
+}
 
-    //send red data
-    EPD_SendCommand(DATA_START_TRANSMISSION_1);
-    for (UWORD j = 0; j < Height; j++) {
-        for (UWORD i = 0; i < Width; i++) {
-            EPD_SendData(0xFF);
+/******************************************************************************
+function :	Check for a plane with every bit set
+parameter:
+    image : packed rows, EPD_WIDTH / 8 bytes each
+    Rows  : number of rows in image
+******************************************************************************/
+int EPD_PlaneBlank(const UBYTE *image, UWORD Rows)
+{
+    UWORD Width = (EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1);
+    UBYTE all = 0xFF;
+    for (UDOUBLE i = 0; i < (UDOUBLE)Width * Rows; i++) {
+        all &= image[i];
+    }
+    return all == 0xFF;
+}
+
+/******************************************************************************
+function :	Start sending one image plane
+parameter:
+    Command : DATA_START_TRANSMISSION_1 (black) or DATA_START_TRANSMISSION_2 (red)
+******************************************************************************/
+int EPD_StartPlane(UBYTE Command)
+{
+    planeCommand = 0;
+    if (activeLut) {
+        // Black and white takes the image as new data and ignores red
+        if (Command != DATA_START_TRANSMISSION_1) {
+            return 0;
         }
+        Command = DATA_START_TRANSMISSION_2;
+    }
+    if (Command == DATA_START_TRANSMISSION_2) {
+        // Sent again, the red RAM is only known once the whole plane is in
+        redRamKnown = 0;
     }
+    EPD_SendCommand(Command);
+    planeCommand = Command;
+    planeHash = 2166136261u;
+    planeBytes = 0;
+    return 1;
 }
 
 /******************************************************************************
-function :	Sends the image buffer in RAM to e-Paper and displays
+function :	Send the next rows of the plane started by EPD_StartPlane
 parameter:
+    image : packed rows, EPD_WIDTH / 8 bytes each
+    Rows  : number of rows in image
 ******************************************************************************/
-void EPD_Display(const UBYTE *blackimage, const UBYTE *redimage)
+void EPD_SendPlaneRows(const UBYTE *image, UWORD Rows)
 {
-    UWORD Width, Height;
-    Width = (EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1);
-    Height = EPD_HEIGHT;
+    if (planeCommand == 0) {
+        return;
+    }
+    UWORD Width = (EPD_WIDTH % 8 == 0)? (EPD_WIDTH / 8 ): (EPD_WIDTH / 8 + 1);
+    power_stage_begin(TRACE_SPI_UPLOAD);
+    int64_t start = trace_now_us();
 
-    EPD_SendCommand(DATA_START_TRANSMISSION_1);
-    for (UWORD j = 0; j < Height; j++) {
-        for (UWORD i = 0; i < Width; i++) {
-            EPD_SendData(blackimage[i + j * Width]);
+    // Sent while the hash is worked out, but the rows have to stay put
+    // until the transfer is done
+    DEV_SPI_Queue(image, (UDOUBLE)Width * Rows, 1);
+    if (planeCommand == DATA_START_TRANSMISSION_2 && !activeLut) {
+        // FNV-1a, to recognise the same red plane next time
+        for (UDOUBLE i = 0; i < (UDOUBLE)Width * Rows; i++) {
+            planeHash = (planeHash ^ image[i]) * 16777619u;
         }
     }
-    EPD_SendCommand(PARTIAL_OUT);
-    
-    EPD_SendCommand(DATA_START_TRANSMISSION_2);
-    for (UWORD j = 0; j < Height; j++) {
-        for (UWORD i = 0; i < Width; i++) {
-            EPD_SendData(redimage[i + j * Width]);
-        }
+    planeBytes += (UDOUBLE)Width * Rows;
+    DEV_SPI_Flush();
+    trace_add(TRACE_SPI_UPLOAD, trace_now_us() - start);
+    power_stage_end(TRACE_SPI_UPLOAD);
+}
+
+/******************************************************************************
+function :	Finish the plane started by EPD_StartPlane
+parameter:
+******************************************************************************/
+void EPD_EndPlane(void)
+{
+    if (planeCommand == 0) {
+        return;
     }
+    if (planeCommand == DATA_START_TRANSMISSION_2 && !activeLut
+        && planeBytes == EPD_PLANE_BYTES) {
+        redRamKnown = 1;
+        redRamHash = planeHash;
+    }
+    planeCommand = 0;
     EPD_SendCommand(PARTIAL_OUT);
+    DEV_SPI_Flush();
+}
 
-    EPD_SendCommand(DISPLAY_REFRESH);
+/******************************************************************************
+function :	Refresh the panel from the planes sent so far
+parameter:
+******************************************************************************/
+void EPD_Refresh(void)
+{
+    EPD_StartRefresh();
     EPD_WaitUntilIdle();
 }
 
+/******************************************************************************
+function :	Start the refresh without waiting; the panel is busy until done
+parameter:
+******************************************************************************/
+void EPD_StartRefresh(void)
+{
+    EPD_SendCommand(DISPLAY_REFRESH);
+    DEV_SPI_Flush();
+}
+
+/******************************************************************************
+function :	Sends the image buffer in RAM to e-Paper and displays
+parameter:
+******************************************************************************/
+void EPD_Display(const UBYTE *blackimage, const UBYTE *redimage)
+{
+    EPD_Upload(blackimage, redimage);
+    EPD_Refresh();
+}
+
+/******************************************************************************
+function :	Send both planes without refreshing
+parameter:
+******************************************************************************/
+void EPD_Upload(const UBYTE *blackimage, const UBYTE *redimage)
+{
+    if (EPD_StartPlane(DATA_START_TRANSMISSION_1)) {
+        EPD_SendPlaneRows(blackimage, EPD_HEIGHT);
+        EPD_EndPlane();
+    }
+
+    if (!activeLut && redRamKnown) {
+        UDOUBLE hash = 2166136261u;
+        for (UDOUBLE i = 0; i < EPD_PLANE_BYTES; i++) {
+            hash = (hash ^ redimage[i]) * 16777619u;
+        }
+        if (hash == redRamHash) {
+            Debug("red plane unchanged\r\n");
+            return;
+        }
+    }
+    if (EPD_StartPlane(DATA_START_TRANSMISSION_2)) {
+        EPD_SendPlaneRows(redimage, EPD_HEIGHT);
+        EPD_EndPlane();
+    }
+}
+
 /******************************************************************************
 function :	Enter sleep mode
 parameter:
 ******************************************************************************/
 void EPD_Sleep(void)
 {
-    EPD_SendCommand(POWER_OFF);
-    EPD_WaitUntilIdle();
-    EPD_SendCommand(DEEP_SLEEP);
-    EPD_SendData(0xA5);     // check code
+    EPD_PowerOff();
+    EPD_DeepSleep();
 }
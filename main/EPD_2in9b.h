@@ -76,10 +76,57 @@
 #define ACTIVE_PROGRAM                              0xA1
 #define READ_OTP_DATA                               0xA2
 #define POWER_SAVING                                0xE3
+#define LUT_VCOM                                    0x20
+#define LUT_WW                                      0x21
+#define LUT_BW                                      0x22
+#define LUT_WB                                      0x23
+#define LUT_BB                                      0x24
 
-UBYTE EPD_Init();
+// Bytes in one packed plane
+#define EPD_PLANE_BYTES     ((EPD_WIDTH / 8) * EPD_HEIGHT)
+
+// Waveform loaded into the LUT registers.  Each table is 7 groups of a
+// level select byte, four frame counts and a repeat count; the VCOM table
+// adds two bytes of end-of-frame settings.
+typedef struct {
+    UBYTE vcom[44];
+    UBYTE ww[42];
+    UBYTE bw[42];
+    UBYTE wb[42];
+    UBYTE bb[42];
+} EPD_LUT;
+
+// Black and white only, in a fraction of the tri-color refresh.  Red
+// pixels are not driven, so it is only for frames without red shown over
+// a screen without red, and ghosts build up over repeated use.
+extern const EPD_LUT EPD_LUT_FAST_MONO;
+
+// Reset, configure and power on.  NULL selects the panel's own tri-color
+// waveform; a LUT switches the panel to black and white, where only the
+// black plane is sent.
+UBYTE EPD_Init(const EPD_LUT *lut);
+// The steps of EPD_Init and EPD_Sleep, for panel_session.h
+void EPD_Reset(void);
+void EPD_Configure(const EPD_LUT *lut);
+void EPD_PowerOn(void);
+void EPD_PowerOff(void);
+void EPD_DeepSleep(void);
+int EPD_Busy(void);
+void EPD_WaitUntilIdle(void);
 void EPD_Clear(void);
+// Upload and refresh.  The red plane is skipped if the panel still holds
+// the same one.
 void EPD_Display(const UBYTE *blackimage, const UBYTE *redimage);
+void EPD_Upload(const UBYTE *blackimage, const UBYTE *redimage);
+// True if every bit of the rows is set: no red in a red plane
+int EPD_PlaneBlank(const UBYTE *image, UWORD Rows);
+// Returns 0 if the current waveform has no use for the plane.  Rows sent
+// to a skipped plane are dropped, so callers need only check to save work.
+int EPD_StartPlane(UBYTE Command);
+void EPD_SendPlaneRows(const UBYTE *image, UWORD Rows);
+void EPD_EndPlane(void);
+void EPD_Refresh(void);
+void EPD_StartRefresh(void);
 void EPD_Sleep(void);
 
 #ifdef __cplusplus
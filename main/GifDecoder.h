@@ -2,6 +2,8 @@
 #define _GIFDECODER_H_
 
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 typedef void (*callback)(void);
 typedef void (*pixel_callback)(int16_t x, int16_t y, uint8_t red, uint8_t green, uint8_t blue);
@@ -11,6 +13,9 @@ typedef bool (*file_seek_callback)(unsigned long position);
 typedef unsigned long (*file_position_callback)(void);
 typedef int (*file_read_callback)(void);
 typedef int (*file_read_block_callback)(void * buffer, int numberOfBytes);
+typedef bool (*cancel_callback)(void);
+typedef void (*rect_callback)(int16_t x, int16_t y, int16_t width, int16_t height);
+typedef void (*image_callback)(int image);
 
 typedef struct rgb_24 {
     uint8_t red;
@@ -18,6 +23,25 @@ typedef struct rgb_24 {
     uint8_t blue;
 } rgb_24;
 
+// Graphic control extension disposal methods
+#define DISPOSAL_NONE       0
+#define DISPOSAL_LEAVE      1
+#define DISPOSAL_BACKGROUND 2
+#define DISPOSAL_PREVIOUS   3
+
+// Where one image of an animated GIF lives and the state it is drawn with,
+// found by scanFrames() without decoding any image data
+typedef struct gif_frame_info {
+    uint32_t descriptorOffset;  // Just past the 0x2c image separator
+    uint32_t paletteOffset;     // Local color table, or the global one (0 if neither)
+    uint16_t x, y, width, height;
+    uint16_t delay;             // Hundredths of a second
+    uint16_t keyFrame;          // First image that has to be drawn to show this one
+    int16_t transparentIndex;   // -1 if none
+    uint8_t paletteBits;        // Palette holds 1 << paletteBits colors
+    uint8_t disposal;           // Applied to this image before the next is drawn
+} gif_frame_info;
+
 // LZW constants
 // NOTE: LZW_MAXBITS should be set to 10 or 11 for small displays, 12 for large displays
 //   all 32x32-pixel GIFs tested work with 11, most work with 10
@@ -27,8 +51,22 @@ typedef struct rgb_24 {
 template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
 class GifDecoder {
 public:
+    void reset(void);
     int startDecoding(void);
     int decodeFrame(void);
+
+    // Index the images of the file opened by startDecoding().  Fills in up
+    // to maxFrames entries and returns the number of images in the file,
+    // or a negative error.
+    int scanFrames(gif_frame_info *frames, int maxFrames);
+    // Draw image n of an indexed file as the animation shows it.  Only the
+    // images from its key frame on are read; earlier images that the file
+    // disposes of are cleared through the dispose rect callback rather
+    // than drawn, so no full-canvas backup is needed.  Each image costs a
+    // full LZW decode, so from, if not -1, starts at a later image: the
+    // caller has already put what image from - 1 shows on the output, and
+    // that image's disposal must leave it there.
+    int decodeFrameAt(const gif_frame_info *frames, int n, int from = -1);
     
     void setScreenClearCallback(callback f);
     void setUpdateScreenCallback(callback f);
@@ -39,6 +77,30 @@ public:
     void setFilePositionCallback(file_position_callback f);
     void setFileReadCallback(file_read_callback f);
     void setFileReadBlockCallback(file_read_block_callback f);
+    // Polled once per decoded line; returning true abandons the frame and
+    // makes decodeFrame() return ERROR_CANCELLED
+    void setCancelCallback(cancel_callback f);
+    // Clears a rectangle back to transparent, for disposal method 2
+    void setDisposeRectCallback(rect_callback f);
+    // Called by decodeFrameAt() when the output shows an earlier image as
+    // the animation does and the image leaves it there, so the caller can
+    // keep it to start from later
+    void setImageDoneCallback(image_callback f);
+
+    // Only draw the part of the logical screen inside this rectangle; a
+    // width or height of 0 keeps the whole screen.  Rows and spans outside
+    // it are run through LZW but never reach the pixel callback.
+    void setCrop(int16_t x, int16_t y, int16_t width, int16_t height);
+    // Shrink the cropped screen to fit width x height by decimation, so
+    // images wider than maxGifWidth can be drawn.  0 disables scaling; the
+    // image is never enlarged.  Both settings apply from startDecoding(),
+    // and pixel and rect callbacks get output coordinates.
+    void setFitSize(int16_t width, int16_t height);
+
+    // RAM held by the decoder's working buffers, for memory reports
+    static const int kLzwTableBytes = LZW_SIZTABLE * (2 * sizeof(uint8_t) + sizeof(uint16_t));
+    static const int kPaletteBytes = 256 * sizeof(rgb_24);
+    static const int kRowBufferBytes = maxGifWidth;
 
 private:
     void parseTableBasedImage(void);
@@ -52,6 +114,13 @@ private:
     void parseGlobalColorTable(void);
     void parseLogicalScreenDescriptor(void);
     bool parseGifHeader(void);
+    bool skipSubBlocks(void);
+    bool loadPalette(const gif_frame_info *frame);
+    void setupOutput(void);
+    int sampleOf(int output);
+    int outputAtOrAfter(int source);
+    void decodeLine(int line);
+    void disposeRect(const gif_frame_info *frame);
     int readIntoBuffer(void *buffer, int numberOfBytes);
     int readWord(void);
     void backUpStream(int n);
@@ -107,6 +176,23 @@ private:
     file_position_callback filePositionCallback;
     file_read_callback fileReadCallback;
     file_read_block_callback fileReadBlockCallback;
+    cancel_callback cancelCallback;
+    rect_callback disposeRectCallback;
+    image_callback imageDoneCallback;
+    bool cancelled;
+
+    // Requested crop and fit, and the crop rectangle and 16.16 source step
+    // per output pixel worked out from them for the current file
+    int16_t requestedCrop[4];
+    int16_t fitWidth;
+    int16_t fitHeight;
+    int cropX;
+    int cropY;
+    int cropWidth;
+    int cropHeight;
+    uint32_t scaleStep;
+
+    bool lineCancelled(void);
 
     // LZW variables
     int bbits;
@@ -41,6 +41,7 @@
 #define ERROR_FILENOTGIF           -2
 #define ERROR_BADGIFFORMAT         -3
 #define ERROR_UNKNOWNCONTROLEXT    -4
+#define ERROR_CANCELLED            -5
 
 #define GIFHDRTAGNORM   "GIF87a"  // tag in valid GIF file
 #define GIFHDRTAGNORM1  "GIF89a"  // tag in valid GIF file
@@ -53,6 +54,9 @@
 
 #define NO_TRANSPARENT_INDEX -1
 
+// The global color table always follows the header and screen descriptor
+#define GLOBAL_PALETTE_OFFSET 13
+
 
 template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
 void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setStartDrawingCallback(callback f) {
@@ -94,6 +98,85 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setFileReadBlockCallback
     fileReadBlockCallback = f;
 }
 
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setCancelCallback(cancel_callback f) {
+    cancelCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setDisposeRectCallback(rect_callback f) {
+    disposeRectCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setImageDoneCallback(image_callback f) {
+    imageDoneCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setCrop(int16_t x, int16_t y, int16_t width, int16_t height) {
+    requestedCrop[0] = x;
+    requestedCrop[1] = y;
+    requestedCrop[2] = width;
+    requestedCrop[3] = height;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setFitSize(int16_t width, int16_t height) {
+    fitWidth = width;
+    fitHeight = height;
+}
+
+// Work out the crop rectangle and scale once the screen size is known
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setupOutput(void) {
+    cropX = 0;
+    cropY = 0;
+    cropWidth = lsdWidth;
+    cropHeight = lsdHeight;
+    if (requestedCrop[2] > 0 && requestedCrop[3] > 0) {
+        cropX = requestedCrop[0];
+        cropY = requestedCrop[1];
+        cropWidth = requestedCrop[2];
+        cropHeight = requestedCrop[3];
+    }
+
+    scaleStep = 1 << 16;
+    if (fitWidth > 0 && fitHeight > 0) {
+        uint32_t stepX = (((uint32_t)cropWidth << 16) + fitWidth - 1) / fitWidth;
+        uint32_t stepY = (((uint32_t)cropHeight << 16) + fitHeight - 1) / fitHeight;
+        uint32_t step = stepX > stepY ? stepX : stepY;
+        if (step > scaleStep) {
+            scaleStep = step < (64u << 16) ? step : (64u << 16);
+        }
+    }
+}
+
+// Source offset (from the crop origin) sampled for an output pixel: the
+// middle of the span it covers
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::sampleOf(int output) {
+    return ((uint32_t)output * scaleStep + scaleStep / 2) >> 16;
+}
+
+// First output pixel whose sample is at or after a source offset
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::outputAtOrAfter(int source) {
+    int output = ((uint32_t)source << 16) / scaleStep;
+    while (sampleOf(output) < source) {
+        output++;
+    }
+    return output;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lineCancelled(void) {
+    if (!cancelled && cancelCallback && cancelCallback()) {
+        cancelled = true;
+    }
+    return cancelled;
+}
+
 // Backup the read stream by n bytes
 template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
 void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::backUpStream(int n) {
@@ -197,6 +280,7 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseGraphicControlExten
     }
 
     int packedBits = readByte();
+    disposalMethod = (packedBits >> 2) & 7;
     frameDelay = readWord();
     transparentColorIndex = readByte();
 
@@ -320,6 +404,13 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
     // this is the position where GIF decoding needs to pick up after decompressing frame
     unsigned long filePositionAfter = filePositionCallback();
 
+    // GIF allows code sizes of 2 to 8; anything else is a corrupt file and
+    // would overrun the LZW tables, so the image is skipped
+    if (lzwCodeSize < 2 || lzwCodeSize > 8) {
+        transparentColorIndex = NO_TRANSPARENT_INDEX;
+        return;
+    }
+
     fileSeekCallback(filePositionBefore);
 
     // Process the animation frame for display
@@ -393,12 +484,30 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseData() {
     return ERROR_NONE;
 }
 
+// Return the decoder to its initial state so the same instance (and its LZW
+// tables) can be reused for another file.  The file, pixel and cancel
+// callbacks are kept; the image done callback only lasts one decode, so
+// set it after startDecoding(), which calls this.
 template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::startDecoding(void) {
-    // Initialize variables
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::reset(void) {
     keyFrame = true;
     transparentColorIndex = NO_TRANSPARENT_INDEX;
+    prevBackgroundIndex = 0;
+    prevDisposalMethod = 0;
+    disposalMethod = 0;
+    frameDelay = 0;
+    colorCount = 0;
     nextFrameTime_ms = 0;
+    end_code = -1;
+    sp = stack;
+    cancelled = false;
+    imageDoneCallback = NULL;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::startDecoding(void) {
+    // Initialize variables
+    reset();
     fileSeekCallback(0);
 
     // Validate the header
@@ -410,6 +519,7 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::startDecoding(void) {
 
     // Parse the logical screen descriptor
     parseLogicalScreenDescriptor();
+    setupOutput();
 
     // Parse the global color table
     parseGlobalColorTable();
@@ -421,6 +531,9 @@ template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
 int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::decodeFrame(void) {
     // Parse gif data
     int result = parseData();
+    if (cancelled) {
+        return ERROR_CANCELLED;
+    }
     if (result < ERROR_NONE) {
         printf("Error: %i occurred during parsing of data\r\n", result);
         return result;
@@ -447,100 +560,218 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::decodeFrame(void) {
     return result;
 }
 
-// Decompress LZW data and display animation frame
+// Skip a run of data sub-blocks, up to and including the terminator
 template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::decompressAndDisplayFrame(unsigned long filePositionAfter) {
-    // Each pixel of image is 8 bits and is an index into the palette
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::skipSubBlocks(void) {
+    int len = readByte();
+    while (len > 0) {
+        fileSeekCallback(filePositionCallback() + len);
+        len = readByte();
+    }
+    return len == 0;
+}
 
-        // How the image is decoded depends upon whether it is interlaced or not
-    // Decode the interlaced LZW data into the image buffer
-    if (tbiInterlaced) {
-        // Decode every 8th line starting at line 0
-        for (int line = tbiImageY + 0; line < tbiHeight + tbiImageY; line += 8) {
-            lzw_decode(rowDecodeBuffer, tbiWidth, rowDecodeBuffer + maxGifWidth);
-            for (int x = 0; x < tbiWidth; x++) {
-                // Get the next pixel
-                int pixel = rowDecodeBuffer[x];
-
-                // Check pixel transparency
-                if (pixel == transparentColorIndex) {
-                    continue;
-                }
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::scanFrames(gif_frame_info *frames, int maxFrames) {
+    int count = 0;
+    int keyFrame = 0;
+    bool canvasCleared = false;   // The previous image disposes of the whole screen
+    transparentColorIndex = NO_TRANSPARENT_INDEX;
+    frameDelay = 0;
+    disposalMethod = DISPOSAL_NONE;
 
-                // Pixel not transparent so get color from palette and draw the pixel
-                if(drawPixelCallback)
-                    (*drawPixelCallback)(x + tbiImageX, line, palette[pixel].red, palette[pixel].green, palette[pixel].blue);
+    while (true) {
+        int b = readByte();
+        if (b == 0x21) {
+            if (readByte() == 0xf9) {
+                parseGraphicControlExtension();
+            } else if (!skipSubBlocks()) {
+                return ERROR_BADGIFFORMAT;
+            }
+        } else if (b == 0x2c) {
+            gif_frame_info frame;
+            frame.descriptorOffset = filePositionCallback();
+            frame.x = readWord();
+            frame.y = readWord();
+            frame.width = readWord();
+            frame.height = readWord();
+            int packedBits = readByte();
+            if (packedBits & COLORTBLFLAG) {
+                frame.paletteOffset = frame.descriptorOffset + 9;
+                frame.paletteBits = (packedBits & 7) + 1;
+                fileSeekCallback(filePositionCallback() + sizeof(rgb_24) * (1 << frame.paletteBits));
+            } else if (lsdPackedField & COLORTBLFLAG) {
+                frame.paletteOffset = GLOBAL_PALETTE_OFFSET;
+                frame.paletteBits = (lsdPackedField & 7) + 1;
+            } else {
+                frame.paletteOffset = 0;
+                frame.paletteBits = 0;
+            }
+            readByte();     // LZW code size
+            if (!skipSubBlocks()) {
+                return ERROR_BADGIFFORMAT;
             }
-        }
-        // Decode every 8th line starting at line 4
-        for (int line = tbiImageY + 4; line < tbiHeight + tbiImageY; line += 8) {
-            lzw_decode(rowDecodeBuffer, tbiWidth, rowDecodeBuffer + maxGifWidth);
-            for (int x = 0; x < tbiWidth; x++) {
-                // Get the next pixel
-                int pixel = rowDecodeBuffer[x];
-
-                // Check pixel transparency
-                if (pixel == transparentColorIndex) {
-                    continue;
-                }
 
-                // Pixel not transparent so get color from palette and draw the pixel
-                if(drawPixelCallback)
-                    (*drawPixelCallback)(x + tbiImageX, line, palette[pixel].red, palette[pixel].green, palette[pixel].blue);
+            // Drawing can start afresh at an image that hides everything
+            // before it
+            bool fullScreen = frame.x == 0 && frame.y == 0
+                && frame.width >= lsdWidth && frame.height >= lsdHeight;
+            if (count == 0 || canvasCleared
+                || (fullScreen && transparentColorIndex == NO_TRANSPARENT_INDEX)) {
+                keyFrame = count;
+            }
+            canvasCleared = fullScreen && disposalMethod == DISPOSAL_BACKGROUND;
+
+            frame.keyFrame = keyFrame;
+            frame.delay = frameDelay;
+            frame.transparentIndex = transparentColorIndex;
+            frame.disposal = disposalMethod;
+            if (count < maxFrames) {
+                frames[count] = frame;
             }
+            count++;
+
+            // Graphic control extension is for a single image
+            transparentColorIndex = NO_TRANSPARENT_INDEX;
+            frameDelay = 0;
+            disposalMethod = DISPOSAL_NONE;
+        } else {
+            // Trailer
+            return count;
         }
-        // Decode every 4th line starting at line 2
-        for (int line = tbiImageY + 2; line < tbiHeight + tbiImageY; line += 4) {
-            lzw_decode(rowDecodeBuffer, tbiWidth, rowDecodeBuffer + maxGifWidth);
-            for (int x = 0; x < tbiWidth; x++) {
-                // Get the next pixel
-                int pixel = rowDecodeBuffer[x];
-
-                // Check pixel transparency
-                if (pixel == transparentColorIndex) {
-                    continue;
-                }
+    }
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::loadPalette(const gif_frame_info *frame) {
+    // A local table is read along with the image descriptor
+    if (frame->paletteOffset != GLOBAL_PALETTE_OFFSET) {
+        return true;
+    }
+    colorCount = 1 << frame->paletteBits;
+    fileSeekCallback(frame->paletteOffset);
+    return readIntoBuffer(palette, sizeof(rgb_24) * colorCount) == 0;
+}
 
-                // Pixel not transparent so get color from palette and draw the pixel
-                if(drawPixelCallback)
-                    (*drawPixelCallback)(x + tbiImageX, line, palette[pixel].red, palette[pixel].green, palette[pixel].blue);
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::decodeFrameAt(const gif_frame_info *frames, int n, int from) {
+    for (int i = from >= 0 ? from : frames[n].keyFrame; i <= n; i++) {
+        const gif_frame_info *frame = &frames[i];
+        if (i < n && frame->disposal == DISPOSAL_PREVIOUS) {
+            // Undone before the next image, so it never shows
+            continue;
+        }
+        if (i < n && frame->disposal == DISPOSAL_BACKGROUND) {
+            // Everything it would draw is cleared again straight away
+            disposeRect(frame);
+            continue;
+        }
+        if (!loadPalette(frame)) {
+            return ERROR_BADGIFFORMAT;
+        }
+        fileSeekCallback(frame->descriptorOffset);
+        transparentColorIndex = frame->transparentIndex;
+        frameDelay = frame->delay;
+        disposalMethod = frame->disposal;
+        parseTableBasedImage();
+        if (cancelled) {
+            return ERROR_CANCELLED;
+        }
+        if (i < n && imageDoneCallback && frame->disposal <= DISPOSAL_LEAVE) {
+            (*imageDoneCallback)(i);
+        }
+    }
+    return ERROR_NONE;
+}
+
+// Clear the output pixels an image covers
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::disposeRect(const gif_frame_info *frame) {
+    int x0 = frame->x > cropX ? frame->x : cropX;
+    int y0 = frame->y > cropY ? frame->y : cropY;
+    int x1 = min(frame->x + frame->width, cropX + cropWidth);
+    int y1 = min(frame->y + frame->height, cropY + cropHeight);
+    if (!disposeRectCallback || x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    int outX = outputAtOrAfter(x0 - cropX);
+    int outY = outputAtOrAfter(y0 - cropY);
+    (*disposeRectCallback)(outX, outY,
+        outputAtOrAfter(x1 - cropX) - outX, outputAtOrAfter(y1 - cropY) - outY);
+}
+
+// Decode one line of the current image.  Every pixel has to go through
+// LZW, but only the span inside the crop is stored, a maxGifWidth chunk at
+// a time, and only the pixels sampled for output reach the callback.
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::decodeLine(int line) {
+    int imageEnd = tbiImageX + tbiWidth;
+    int spanStart = tbiImageX > cropX ? tbiImageX : cropX;
+    int spanEnd = min(imageEnd, cropX + cropWidth);
+    bool visible = drawPixelCallback && spanStart < spanEnd
+        && line >= cropY && line < cropY + cropHeight;
+    int outY = visible ? outputAtOrAfter(line - cropY) : 0;
+    if (!visible || sampleOf(outY) != line - cropY) {
+        // A zero length buffer keeps lzw_decode from storing anything
+        if (tbiWidth > 0) {
+            lzw_decode(rowDecodeBuffer, tbiWidth, rowDecodeBuffer);
+        }
+        return;
+    }
+
+    if (spanStart > tbiImageX) {
+        lzw_decode(rowDecodeBuffer, spanStart - tbiImageX, rowDecodeBuffer);
+    }
+    int outX = outputAtOrAfter(spanStart - cropX);
+    int x = sampleOf(outX) + cropX;
+    for (int start = spanStart; start < spanEnd; start += maxGifWidth) {
+        int count = min(maxGifWidth, spanEnd - start);
+        lzw_decode(rowDecodeBuffer, count, rowDecodeBuffer + count);
+        for (; x < start + count; x = sampleOf(++outX) + cropX) {
+            // Get the next pixel
+            int pixel = rowDecodeBuffer[x - start];
+
+            // Check pixel transparency
+            if (pixel == transparentColorIndex) {
+                continue;
             }
+
+            // Pixel not transparent so get color from palette and draw the pixel
+            (*drawPixelCallback)(outX, outY, palette[pixel].red, palette[pixel].green, palette[pixel].blue);
         }
-        // Decode every 2nd line starting at line 1
-        for (int line = tbiImageY + 1; line < tbiHeight + tbiImageY; line += 2) {
-            lzw_decode(rowDecodeBuffer, tbiWidth, rowDecodeBuffer + maxGifWidth);
-            for (int x = 0; x < tbiWidth; x++) {
-                // Get the next pixel
-                int pixel = rowDecodeBuffer[x];
-
-                // Check pixel transparency
-                if (pixel == transparentColorIndex) {
-                    continue;
-                }
+    }
+    if (imageEnd > spanEnd) {
+        lzw_decode(rowDecodeBuffer, imageEnd - spanEnd, rowDecodeBuffer);
+    }
+}
+
+// Decompress LZW data and display animation frame
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::decompressAndDisplayFrame(unsigned long filePositionAfter) {
+    // Each pixel of image is 8 bits and is an index into the palette
 
-                // Pixel not transparent so get color from palette and draw the pixel
-                if(drawPixelCallback)
-                    (*drawPixelCallback)(x + tbiImageX, line, palette[pixel].red, palette[pixel].green, palette[pixel].blue);
+    // How the image is decoded depends upon whether it is interlaced or not
+    if (tbiInterlaced) {
+        // Every 8th line from line 0, every 8th from line 4, every 4th
+        // from line 2 and then every 2nd from line 1
+        static const uint8_t passStart[4] = { 0, 4, 2, 1 };
+        static const uint8_t passStep[4] = { 8, 8, 4, 2 };
+        for (int pass = 0; pass < 4; pass++) {
+            for (int line = tbiImageY + passStart[pass]; line < tbiHeight + tbiImageY; line += passStep[pass]) {
+                if (lineCancelled()) {
+                    break;
+                }
+                decodeLine(line);
             }
         }
     }
     else    {
         // Decode the non interlaced LZW data into the image data buffer
         for (int line = tbiImageY; line < tbiHeight + tbiImageY; line++) {
-            lzw_decode(rowDecodeBuffer, tbiWidth, rowDecodeBuffer + maxGifWidth);
-            for (int x = 0; x < tbiWidth; x++) {
-                // Get the next pixel
-                int pixel = rowDecodeBuffer[x];
-
-                // Check pixel transparency
-                if (pixel == transparentColorIndex) {
-                    continue;
-                }
-
-                // Pixel not transparent so get color from palette and draw the pixel
-                if(drawPixelCallback)
-                    (*drawPixelCallback)(x + tbiImageX, line, palette[pixel].red, palette[pixel].green, palette[pixel].blue);
+            if (lineCancelled()) {
+                break;
             }
+            decodeLine(line);
         }
     }
 
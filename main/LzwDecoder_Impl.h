@@ -100,6 +100,7 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lzw_decode(uint8_t *buf,
                 *buf++ = *(--sp);
             } else {
                 // out of bounds, keep incrementing the pointers, but don't use the data
+                --sp;
             }
             if ((--l) == 0) {
                 return len;
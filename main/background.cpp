@@ -0,0 +1,139 @@
+#include <math.h>
+#include "background.h"
+#include "EPD_2in9b.h"
+
+static float seed[32];
+// Drives dither_random so that any row can be re-rendered identically,
+// which band mode relies on to draw each band once per plane
+static uint32_t ditherSeed;
+
+typedef int (*DitherFunc)(float c, int x, int y);
+typedef int (*RenderFunc)(int x, int y);
+
+static DitherFunc fnDither;
+static RenderFunc fnRender;
+
+static inline uint32_t mix32(uint32_t h) {
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return h;
+}
+
+static inline uint32_t dither_hash(int x, int y) {
+    return mix32(ditherSeed ^ ((uint32_t)x * 0x9E3779B1u) ^ ((uint32_t)y * 0x85EBCA77u));
+}
+
+static int dither_random(float c, int x, int y) {
+    int d = floor(c);
+    int r = (int)((c - (float)d) * 255.0f);
+    if (r > (int)(dither_hash(x, y) % 256)) {
+        d++;
+    }
+    d = d % 3;
+    return d;
+}
+
+int dither_nearest(float c, int x, int y) {
+    return (int)floor(c) % 3;
+}
+
+static int dither_slice(float c, int x, int y) {
+    int d = floor(c);
+    int slice_width = (int)(64.0f * seed[31]) + 2;
+    int r = (int)((c - (float)d) * slice_width);
+    if (r > (x + y) % slice_width) {
+        d++;
+    }
+    d = d % 3;
+    return d;
+}
+
+static int dither_circles(float c, int x, int y) {
+    int d = floor(c);
+    int slice_width = (int)(64.0f * seed[31]) + 2;
+    float r = ((c - (float)d) * slice_width);
+
+    float cx = seed[30] * (float)EPD_WIDTH;
+    float cy = seed[29] * (float)EPD_HEIGHT;
+    float dist = sqrtf(fabs(x - cx)*fabs(x - cx) + fabs(y - cy)*fabs(y - cy));
+
+    if (r > (int)dist % slice_width) {
+        d++;
+    }
+    d = d % 3;
+    return d;
+}
+
+static int render_plasma(int x, int y) {
+    float scale = (float)EPD_HEIGHT;
+    float tx = (float)x / scale;
+    float ty = (float)y / scale;
+    float ox = tx;
+    float oy = ty;
+    tx += sin((float)oy * (seed[10] - 0.5f) * 5.0f + seed[12]) * seed[19];
+    ty += sin((float)ox * (seed[11] - 0.5f) * 5.0f + seed[13]) * seed[20];
+    float height = sin(tx * 20.0f * (seed[0] - 0.5f) + ty  * 20.0f * (seed[1] - 0.5f) + seed[14] * 10.0f) * sin(tx * 20.0f * (seed[2] - 0.5f) + ty * 20.0f * (seed[3] - 0.5f) + seed[15] * 10.0f) * (seed[9] - 0.5f)
+    + sin(tx / scale * 20.0f * (seed[4] - 0.5f) + ty / scale * 20.0f * (seed[5] - 0.5f) + seed[16] * 10.0f) * sin(tx * 20.0f * (seed[6] - 0.5f) + ty * 20.0f * (seed[7] - 0.5f) + seed[17] * 10.0f) * (seed[8] - 0.5f);
+
+    int c = fnDither((height + 0.5f) * 10.0f * seed[18] + 1.0f, x, y);
+    return c;
+}
+
+typedef struct {
+    RenderFunc render;
+    DitherFunc dither;
+} effect_t;
+
+static const effect_t effects[BACKGROUND_EFFECT_COUNT] = {
+  { render_plasma, dither_random },
+  { render_plasma, dither_slice },
+  { render_plasma, dither_circles },
+};
+
+void background_apply(uint8_t effectIndex, uint32_t frameSeed)
+{
+    // Expand the frame seed
+    for (int i=0; i<32; i++) {
+        seed[i] = (float)(mix32(frameSeed * 0x9E3779B1u + i) % 65536) / 65536.0f;
+    }
+
+    ditherSeed = mix32(frameSeed ^ 0x85EBCA77u);
+
+    effect_t effect = effects[effectIndex];
+
+    fnRender = effect.render;
+    fnDither = effect.dither;
+}
+
+void background_render_rows(uint8_t *black, uint8_t *red, int row, int rows)
+{
+    __uint8_t *blackDest = black;
+    __uint8_t *redDest = red;
+
+    for (int y=row; y<row + rows; y++) {
+        for (int x=0; x<EPD_WIDTH; x++) {
+          if (x % 8 == 0) {
+            *blackDest = 0;
+            *redDest = 0;
+          }
+          int color=fnRender(x,y) + 1;
+
+          if (color & 0x01) {
+            *blackDest |= 1;
+          }
+          if (color & 0x02) {
+            *redDest |= 1;
+          }
+          if (x % 8 == 7) {
+            blackDest++;
+            redDest++;
+          } else {
+            *blackDest <<= 1;
+            *redDest <<= 1;
+          }
+        }
+    }
+}
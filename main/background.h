@@ -0,0 +1,22 @@
+#ifndef BADGE_BACKGROUND_H
+#define BADGE_BACKGROUND_H
+
+#include <stdint.h>
+
+// Procedural backgrounds.  A background is fully determined by an effect
+// index and a 32-bit seed, so any band of it can be drawn again later and
+// come out the same.
+
+#define BACKGROUND_EFFECT_COUNT 3
+
+// Bump whenever a kernel's output changes, so background packs made by
+// tools/bg_pack (and cached frames) stop matching.  Foreground and
+// compositing changes bump FRAME_CACHE_RENDER_VERSION instead.
+#define BACKGROUND_RENDER_VERSION 3
+
+// Select the effect and expand the seed for the following render calls
+void background_apply(uint8_t effectIndex, uint32_t frameSeed);
+// Draw panel rows [row, row + rows) into packed black and red planes
+void background_render_rows(uint8_t *black, uint8_t *red, int row, int rows);
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <string.h>
+#include "background.h"
+#include "background_pack.h"
+#include "frame_codec.h"
+#include "layer.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#endif
+
+typedef struct {
+    uint32_t offset;
+    uint32_t end;
+    int nextRow;
+    frame_decoder_t decoder;
+    uint8_t prev[LAYER_ROW_BYTES];
+    uint8_t buffer[128];
+    const uint8_t *bufferPos;
+    const uint8_t *bufferEnd;
+} plane_reader_t;
+
+static background_pack_header_t header;
+static bool packValid = false;
+static uint32_t planeStart[2];
+static uint32_t planeBytes[2];
+static plane_reader_t readers[2];
+
+// ---- Storage backend ----
+
+#ifdef ESP_PLATFORM
+
+static const esp_partition_t *packPartition = NULL;
+
+static size_t storage_open()
+{
+    packPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)BACKGROUND_PACK_PARTITION_SUBTYPE, BACKGROUND_PACK_PARTITION_LABEL);
+    return packPartition ? packPartition->size : 0;
+}
+
+static bool storage_read(uint32_t offset, void *dest, size_t len)
+{
+    return esp_partition_read(packPartition, offset, dest, len) == ESP_OK;
+}
+
+#else
+
+static FILE *packFile = NULL;
+
+static size_t storage_open()
+{
+    if (packFile != NULL) {
+        fclose(packFile);
+    }
+    packFile = fopen(BACKGROUND_PACK_HOST_PATH, "rb");
+    if (packFile == NULL || fseek(packFile, 0, SEEK_END) != 0) {
+        return 0;
+    }
+    return ftell(packFile);
+}
+
+static bool storage_read(uint32_t offset, void *dest, size_t len)
+{
+    return fseek(packFile, offset, SEEK_SET) == 0 && fread(dest, len, 1, packFile) == 1;
+}
+
+#endif
+
+// ---- Index ----
+
+bool background_pack_init(void)
+{
+    packValid = false;
+    size_t size = storage_open();
+    if (size < sizeof(header) || !storage_read(0, &header, sizeof(header))) {
+        return false;
+    }
+    size_t indexEnd = sizeof(header) + (size_t)header.entryCount * sizeof(background_pack_entry_t);
+    if (header.magic != BACKGROUND_PACK_MAGIC || header.packBytes > size || indexEnd > header.packBytes) {
+        return false;
+    }
+    if (header.renderVersion != BACKGROUND_RENDER_VERSION) {
+        printf("Background pack is for render version %u, not %u\r\n",
+            header.renderVersion, BACKGROUND_RENDER_VERSION);
+        return false;
+    }
+    packValid = true;
+    return true;
+}
+
+int background_pack_count(void)
+{
+    return packValid ? header.entryCount : 0;
+}
+
+static bool read_entry(int index, background_pack_entry_t *entry)
+{
+    return storage_read(sizeof(header) + index * sizeof(background_pack_entry_t), entry, sizeof(*entry));
+}
+
+bool background_pack_entry(int index, uint8_t *effect, uint32_t *seed)
+{
+    background_pack_entry_t entry;
+    if (index < 0 || index >= background_pack_count() || !read_entry(index, &entry)) {
+        return false;
+    }
+    *effect = entry.effect;
+    *seed = entry.seed;
+    return true;
+}
+
+static void open_plane(int plane)
+{
+    plane_reader_t *reader = &readers[plane];
+    reader->offset = planeStart[plane];
+    reader->end = planeStart[plane] + planeBytes[plane];
+    reader->nextRow = 0;
+    memset(reader->prev, 0, sizeof(reader->prev));
+    reader->bufferPos = reader->buffer;
+    reader->bufferEnd = reader->buffer;
+    frame_decoder_init(&reader->decoder);
+}
+
+bool background_pack_apply(uint8_t effect, uint32_t seed)
+{
+    // Binary search on (effect, seed)
+    int low = 0;
+    int high = background_pack_count() - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        background_pack_entry_t entry;
+        if (!read_entry(mid, &entry)) {
+            return false;
+        }
+        if (entry.effect == effect && entry.seed == seed) {
+            uint32_t sizes[2];
+            if (!storage_read(entry.frameOffset, sizes, sizeof(sizes))
+                || entry.frameOffset + sizeof(sizes) + sizes[0] + sizes[1] > header.packBytes) {
+                return false;
+            }
+            planeStart[0] = entry.frameOffset + sizeof(sizes);
+            planeStart[1] = planeStart[0] + sizes[0];
+            planeBytes[0] = sizes[0];
+            planeBytes[1] = sizes[1];
+            open_plane(0);
+            open_plane(1);
+            return true;
+        }
+        if (entry.effect < effect || (entry.effect == effect && entry.seed < seed)) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return false;
+}
+
+// ---- Reading ----
+
+static bool read_bytes(plane_reader_t *reader, uint8_t *dest, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        // A run can still be pending after the last input byte
+        size_t n = frame_decoder_read(&reader->decoder, &reader->bufferPos, reader->bufferEnd,
+            dest + done, len - done);
+        done += n;
+        if (n == 0 && reader->bufferPos == reader->bufferEnd) {
+            size_t chunk = reader->end - reader->offset;
+            if (chunk == 0) {
+                return false;
+            }
+            if (chunk > sizeof(reader->buffer)) {
+                chunk = sizeof(reader->buffer);
+            }
+            if (!storage_read(reader->offset, reader->buffer, chunk)) {
+                return false;
+            }
+            reader->offset += chunk;
+            reader->bufferPos = reader->buffer;
+            reader->bufferEnd = reader->buffer + chunk;
+        }
+    }
+    return true;
+}
+
+static bool read_rows(int plane, uint8_t *dest, int row, int rows)
+{
+    plane_reader_t *reader = &readers[plane];
+    if (row < reader->nextRow) {
+        open_plane(plane);
+    }
+    // Rows before the band still have to be decoded for the delta
+    uint8_t skip[LAYER_ROW_BYTES];
+    while (reader->nextRow < row) {
+        if (!read_bytes(reader, skip, LAYER_ROW_BYTES)) {
+            return false;
+        }
+        frame_delta_decode_row(skip, reader->prev, LAYER_ROW_BYTES);
+        reader->nextRow++;
+    }
+    for (int i = 0; i < rows; i++) {
+        uint8_t *line = dest + i * LAYER_ROW_BYTES;
+        if (!read_bytes(reader, line, LAYER_ROW_BYTES)) {
+            return false;
+        }
+        frame_delta_decode_row(line, reader->prev, LAYER_ROW_BYTES);
+        reader->nextRow++;
+    }
+    return true;
+}
+
+bool background_pack_render_rows(uint8_t *black, uint8_t *red, int row, int rows)
+{
+    return packValid && read_rows(0, black, row, rows) && read_rows(1, red, row, rows);
+}
@@ -0,0 +1,55 @@
+#ifndef BADGE_BACKGROUND_PACK_H
+#define BADGE_BACKGROUND_PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Backgrounds rendered ahead of time by tools/bg_pack and streamed from the
+// "bgpack" data partition (a file on the host), so a frame whose effect and
+// seed are in the pack costs a flash read instead of the plasma kernel.
+//
+// Layout: a header, entryCount entries sorted by effect then seed, then the
+// frames.  Each frame is its two plane sizes followed by the black and red
+// planes, each row XOR-delta coded against the one above and the plane
+// PackBits coded (see frame_codec.h).  Entries with identical frames share
+// one.  Flash a pack with
+//
+//   parttool.py write_partition --partition-name bgpack --input bgpack.bin
+
+#define BACKGROUND_PACK_MAGIC 0x4B504742      // "BGPK"
+#define BACKGROUND_PACK_PARTITION_LABEL "bgpack"
+#define BACKGROUND_PACK_PARTITION_SUBTYPE 0x41
+#define BACKGROUND_PACK_HOST_PATH "bgpack.bin"
+#define BACKGROUND_PACK_HOST_SIZE 0x100000
+
+typedef struct {
+    uint32_t magic;
+    uint16_t renderVersion;   // BACKGROUND_RENDER_VERSION it was made for
+    uint16_t reserved;
+    uint32_t entryCount;
+    uint32_t frameCount;
+    uint32_t packBytes;
+} background_pack_header_t;
+
+typedef struct {
+    uint32_t seed;
+    uint8_t effect;
+    uint8_t reserved[3];
+    uint32_t frameOffset;     // From the start of the pack
+} background_pack_entry_t;
+
+// Read the pack's header; false if there is no valid pack
+bool background_pack_init(void);
+// Entries in the pack, 0 without one
+int background_pack_count(void);
+// The effect and seed of an entry, for picking a frame from the pack
+bool background_pack_entry(int index, uint8_t *effect, uint32_t *seed);
+
+// Use the pack's frame for this effect and seed in the following render
+// calls; false if the pack does not have it
+bool background_pack_apply(uint8_t effect, uint32_t seed);
+// Like background_render_rows.  Rows are streamed in order; going back to
+// an earlier row starts that plane over.  False on a read error.
+bool background_pack_render_rows(uint8_t *black, uint8_t *red, int row, int rows);
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef BADGE_CONFIG_H
+#define BADGE_CONFIG_H
+
+// Build-time knobs for the render pipeline.  Each can be overridden from the
+// compiler command line.
+
+// Number of panel rows rendered, composited and sent per band.  0 renders
+// the whole frame into two full planes; anything else keeps only a few rows
+// in RAM (5 planes of BADGE_BAND_ROWS * EPD_WIDTH / 8 bytes each).
+#ifndef BADGE_BAND_ROWS
+#define BADGE_BAND_ROWS 0
+#endif
+
+// Number of distinct background seeds per effect.  A bounded pool lets
+// frames repeat, so the frame cache can serve them; 0 draws any 32-bit seed.
+#ifndef BADGE_SEED_POOL
+#define BADGE_SEED_POOL 32
+#endif
+
+// How long the next frames may be rendered into the frame cache after an
+// update: the keep-alive window (BADGE_KEEPALIVE_MS), which the badge is
+// awake for anyway.  A frame is only started if the last render time says
+// it will finish inside this budget, or while the panel is still
+// refreshing, which the badge has to wait out before sleeping.
+#ifndef BADGE_PRERENDER_BUDGET_MS
+#define BADGE_PRERENDER_BUDGET_MS 500
+#endif
+
+// RTC slow memory the linker gives RTC_DATA_ATTR state: rtc_slow_seg in
+// ESP-IDF 4.0's esp32.ld is the first 4 KB of the chip's 8 KB, less any ULP
+// reserve.  Everything kept across deep sleep is budgeted against it in
+// rtc_budget.h.
+#ifndef BADGE_RTC_SLOW_BYTES
+#define BADGE_RTC_SLOW_BYTES 0x1000
+#endif
+
+// RTC slow memory set aside for one compressed frame that survives deep
+// sleep.  Frames that do not code into this many bytes fall back to the
+// frame cache; -1 takes what the rest of the RTC state leaves.  That is
+// about 2.5 KB, and no finished frame in frame_bench codes below 2.9 KB,
+// so it is off (0) by default: the RTC frame is neither stored nor filled
+// from the frame cache unless it has room for at least RTC_FRAME_MIN_BYTES.
+#ifndef BADGE_RTC_FRAME_BYTES
+#define BADGE_RTC_FRAME_BYTES 0
+#endif
+
+// Timer wakes per keep-alive burst.  The IP5306 power bank chip cuts power
+// after about 32 s of light load, so it needs the keep-alive load at least
+// that often; the wake stub sends the wakes in between straight back to
+// sleep without booting.  1 boots on every wake.
+#ifndef BADGE_KEEPALIVE_WAKES
+#define BADGE_KEEPALIVE_WAKES 2
+#endif
+
+// The keep-alive load (see keep_alive.h): held at least BADGE_KEEPALIVE_MS
+// at a board current of at least BADGE_KEEPALIVE_MA, which picks the
+// cheapest trusted load that reaches it (the radio, until both loads'
+// currents are measured).  BADGE_KEEPALIVE_LOAD forces one instead
+// (0 compute, 1 radio); -1 chooses by current.
+#ifndef BADGE_KEEPALIVE_MS
+#define BADGE_KEEPALIVE_MS 500
+#endif
+#ifndef BADGE_KEEPALIVE_MA
+#define BADGE_KEEPALIVE_MA 60
+#endif
+#ifndef BADGE_KEEPALIVE_LOAD
+#define BADGE_KEEPALIVE_LOAD -1
+#endif
+
+// Minimum time between two advance button presses.  Edges closer together
+// than this are contact bounce.
+#ifndef BADGE_DEBOUNCE_MS
+#define BADGE_DEBOUNCE_MS 50
+#endif
+
+// Wake cycles kept in the RTC trace ring (about 70 bytes each)
+#ifndef BADGE_TRACE_RECORDS
+#define BADGE_TRACE_RECORDS 8
+#endif
+
+// Button presses that may use the fast black and white waveform in a row
+// when neither the old nor the new frame has red.  Each one leaves a
+// little ghosting, so the next update after this many is a full tri-color
+// refresh.  0 always uses the tri-color waveform, which is the default
+// until EPD_LUT_FAST_MONO has been checked on a real panel: its tables
+// drive one polarity only, with no DC balancing phase.
+#ifndef BADGE_FAST_REFRESHES
+#define BADGE_FAST_REFRESHES 0
+#endif
+
+// Status messages (see event_log.h): 0 compiles them out, 1 keeps them in
+// a ring of BADGE_LOG_EVENTS and prints them when the CPU is idle, 2
+// prints them as they happen.
+#ifndef BADGE_LOG_MODE
+#define BADGE_LOG_MODE 1
+#endif
+#ifndef BADGE_LOG_EVENTS
+#define BADGE_LOG_EVENTS 64
+#endif
+
+// Images between the snapshots of an animated GIF that the asset cache
+// keeps while decoding a frame, so another frame is at most this many
+// images' decoding away.  Each costs a packed asset in SPIFFS.
+#ifndef BADGE_ASSET_SNAPSHOT_FRAMES
+#define BADGE_ASSET_SNAPSHOT_FRAMES 8
+#endif
+
+// Holding the advance button this long at boot runs the self-benchmark
+// (see self_bench.h) instead of a normal wake.  0 disables it.
+#ifndef BADGE_BENCH_HOLD_MS
+#define BADGE_BENCH_HOLD_MS 2000
+#endif
+
+#endif
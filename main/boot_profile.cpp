@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_clk.h"
+#include "esp_image_format.h"
+#include "esp_sleep.h"
+#include "esp_spi_flash.h"
+#include "soc/rtc.h"
+#include "boot_profile.h"
+#include "event_log.h"
+#include "rtc_budget.h"
+#include "wake_stub.h"
+
+// Shortest deep sleep wake delay the fast-wake profile may use: the ~900 us
+// before the first flash read with no delay at all, plus margin.  Lower it
+// only after wakes at the lower value have run without "flash read err".
+#define BOOT_WAKE_DELAY_MIN_US 1000
+
+// The fast-wake profile is only worth its name if every setting it is made
+// of made it into the build
+#ifdef CONFIG_BADGE_FAST_WAKE
+#if CONFIG_BOOTLOADER_LOG_LEVEL > 1
+#error "Fast wake: the bootloader log level should be error or none"
+#endif
+#if CONFIG_LOG_DEFAULT_LEVEL > 2
+#error "Fast wake: the default log level should be warning or less"
+#endif
+#if !defined(CONFIG_ESPTOOLPY_FLASHMODE_DIO) || !defined(CONFIG_ESPTOOLPY_FLASHFREQ_40M)
+#error "Fast wake: flash should stay DIO at 40 MHz"
+#endif
+#if CONFIG_ESP32_DEEP_SLEEP_WAKEUP_DELAY < BOOT_WAKE_DELAY_MIN_US
+#error "Fast wake: the deep sleep wake delay is below BOOT_WAKE_DELAY_MIN_US"
+#endif
+#define BOOT_PROFILE_NAME "fast-wake"
+#else
+#define BOOT_PROFILE_NAME "default-wake"
+#endif
+
+// The second stage bootloader's image header, whose flash mode and speed
+// the ROM and the bootloader run the flash at
+#define BOOTLOADER_OFFSET 0x1000
+
+typedef struct {
+    uint32_t profile;   // Which build the sums are for
+    uint32_t sumUs[BOOT_STAGE_COUNT];
+    uint32_t samples[BOOT_STAGE_COUNT];
+} boot_stats_t;
+
+RTC_DATA_ATTR static boot_stats_t bootStats;
+RTC_BUDGET_CHECK(sizeof(bootStats), RTC_BUDGET_BOOT_PROFILE);
+
+static uint64_t appStartTicks;
+static uint64_t mainTicks;
+static bool rendered = false;
+
+static const char *const stageNames[BOOT_STAGE_COUNT] = { "rom", "loader", "startup", "render" };
+
+// Runs with the other constructors, just before the main task starts
+__attribute__((constructor)) static void boot_profile_app_start(void)
+{
+    appStartTicks = rtc_time_get();
+}
+
+static uint32_t profile_id(void)
+{
+    // Changes with the profile and with every build, so sums never mix
+    uint32_t hash = 2166136261u;
+    for (const char *p = BOOT_PROFILE_NAME __DATE__ __TIME__; *p != '\0'; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t add_sample(boot_stage_t stage, uint64_t fromTicks, uint64_t toTicks)
+{
+    uint32_t us = (uint32_t)rtc_time_slowclk_to_us(toTicks - fromTicks, esp_clk_slowclk_cal_get());
+    bootStats.sumUs[stage] += us;
+    bootStats.samples[stage]++;
+    return us;
+}
+
+// Warn if the flash was written with other settings than the build has
+static void check_flash_header(void)
+{
+    esp_image_header_t header;
+    if (spi_flash_read(BOOTLOADER_OFFSET, &header, sizeof(header)) != ESP_OK
+        || header.magic != ESP_IMAGE_HEADER_MAGIC) {
+        printf("Boot: no bootloader header at 0x%x\r\n", BOOTLOADER_OFFSET);
+        return;
+    }
+#ifdef CONFIG_BADGE_FAST_WAKE
+    if (header.spi_mode != ESP_IMAGE_SPI_MODE_DIO || header.spi_speed != ESP_IMAGE_SPI_SPEED_40M) {
+        printf("Boot: bootloader flashed with mode %u speed %u, not DIO at 40 MHz\r\n",
+            (unsigned)header.spi_mode, (unsigned)header.spi_speed);
+    }
+#endif
+}
+
+void boot_profile_app_main(void)
+{
+    mainTicks = rtc_time_get();
+    if (bootStats.profile != profile_id()) {
+        memset(&bootStats, 0, sizeof(bootStats));
+        bootStats.profile = profile_id();
+        check_flash_header();
+    }
+
+    uint32_t romUs = 0;
+    uint32_t loaderUs = 0;
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED) {
+        uint64_t wakeTicks;
+        uint64_t targetTicks;
+        wake_stub_boot_ticks(&wakeTicks, &targetTicks);
+        if (targetTicks != 0 && targetTicks <= wakeTicks) {
+            romUs = add_sample(BOOT_STAGE_ROM, targetTicks, wakeTicks);
+        }
+        loaderUs = add_sample(BOOT_STAGE_LOADER, wakeTicks, appStartTicks);
+    }
+    uint32_t startupUs = add_sample(BOOT_STAGE_STARTUP, appStartTicks, mainTicks);
+    BADGE_LOG("Boot: %s, rom %u us, loader %u us, startup %u us\r\n",
+        BOOT_PROFILE_NAME, romUs, loaderUs, startupUs);
+}
+
+void boot_profile_render(void)
+{
+    if (rendered) {
+        return;
+    }
+    rendered = true;
+    uint32_t us = add_sample(BOOT_STAGE_RENDER, mainTicks, rtc_time_get());
+    BADGE_LOG("Boot: first render %u us after app_main\r\n", us);
+}
+
+const char *boot_profile_name(void)
+{
+    return BOOT_PROFILE_NAME;
+}
+
+const char *boot_stage_name(boot_stage_t stage)
+{
+    return stage < BOOT_STAGE_COUNT ? stageNames[stage] : "?";
+}
+
+uint32_t boot_stage_average_us(boot_stage_t stage)
+{
+    return bootStats.samples[stage] ? bootStats.sumUs[stage] / bootStats.samples[stage] : 0;
+}
+
+uint32_t boot_stage_samples(boot_stage_t stage)
+{
+    return bootStats.samples[stage];
+}
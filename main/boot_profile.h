@@ -0,0 +1,39 @@
+#ifndef BADGE_BOOT_PROFILE_H
+#define BADGE_BOOT_PROFILE_H
+
+#include <stdint.h>
+
+// Where a wake's boot time goes, on the RTC slow clock from the timer
+// target that woke the badge to the first render:
+//
+//   rom      timer target to the wake stub, the first instruction of ours
+//   loader   wake stub to the app's constructors: the flash delay, the
+//            bootloader, image checks and load, CPU start
+//   startup  constructors to app_main
+//   render   app_main to the start of the first render
+//
+// Running averages live in RTC memory, so the self-benchmark can report
+// them for the boot profile the firmware was built with: the default, or
+// the fast-wake one from sdkconfig.fastwake (CONFIG_BADGE_FAST_WAKE), which
+// this file also checks is configured as it should be.
+
+typedef enum {
+    BOOT_STAGE_ROM,
+    BOOT_STAGE_LOADER,
+    BOOT_STAGE_STARTUP,
+    BOOT_STAGE_RENDER,
+    BOOT_STAGE_COUNT
+} boot_stage_t;
+
+// Call first thing in app_main
+void boot_profile_app_main(void);
+// Call as each render starts; only the first one of a wake counts
+void boot_profile_render(void);
+
+const char *boot_profile_name(void);
+const char *boot_stage_name(boot_stage_t stage);
+// Average over the wakes measured with this profile, and how many
+uint32_t boot_stage_average_us(boot_stage_t stage);
+uint32_t boot_stage_samples(boot_stage_t stage);
+
+#endif
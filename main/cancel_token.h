@@ -0,0 +1,36 @@
+#ifndef BADGE_CANCEL_TOKEN_H
+#define BADGE_CANCEL_TOKEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Cancellation for the long running stages of a frame.  The button ISR
+// cancels the token; rendering, decoding and panel upload poll it between
+// bands and give up on the frame.  A panel refresh that has already been
+// triggered is always left to complete.
+typedef struct {
+    volatile bool cancelled;
+    volatile int64_t cancelledUs;   // esp_timer time of the cancel
+} cancel_token_t;
+
+static inline void cancel_token_reset(cancel_token_t *token)
+{
+    token->cancelled = false;
+}
+
+// Safe to call from an ISR
+static inline void cancel_token_cancel(cancel_token_t *token, int64_t nowUs)
+{
+    if (!token->cancelled) {
+        token->cancelledUs = nowUs;
+        token->cancelled = true;
+    }
+}
+
+// A NULL token never cancels
+static inline bool cancel_token_cancelled(const cancel_token_t *token)
+{
+    return token != NULL && token->cancelled;
+}
+
+#endif
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "event_log.h"
+
+#if BADGE_LOG_ACTIVE_MODE == BADGE_LOG_DEFERRED
+
+#define FLUSH_TASK_STACK_SIZE 3072
+
+// Written by any task, read by whichever task is flushing.  A full ring
+// drops new events rather than block the caller.
+static event_log_record_t ring[BADGE_LOG_EVENTS];
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static uint32_t dropped = 0;
+static portMUX_TYPE ringMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t flushTask = NULL;
+// Held while printing, so lines come out in order
+static SemaphoreHandle_t flushLock = NULL;
+
+void event_log_record(const event_log_record_t *record)
+{
+    uint32_t timeMs = (uint32_t)(esp_timer_get_time() / 1000);
+    portENTER_CRITICAL(&ringMux);
+    if (head - tail < BADGE_LOG_EVENTS) {
+        event_log_record_t *slot = &ring[head % BADGE_LOG_EVENTS];
+        *slot = *record;
+        slot->timeMs = timeMs;
+        head++;
+    } else {
+        dropped++;
+    }
+    portEXIT_CRITICAL(&ringMux);
+    if (flushTask != NULL) {
+        xTaskNotifyGive(flushTask);
+    }
+}
+
+// Format one conversion, spec being "%" up to and including the conversion
+// character, taking its argument from the record's words
+static int format_one(char *out, size_t room, const char *spec, size_t specLen,
+    const uint32_t *args, int *used)
+{
+    char conversion[16];
+    if (specLen >= sizeof(conversion)) {
+        return 0;
+    }
+    memcpy(conversion, spec, specLen);
+    conversion[specLen] = '\0';
+
+    char type = spec[specLen - 1];
+    bool wide = specLen >= 3 && spec[specLen - 2] == 'l' && spec[specLen - 3] == 'l';
+    if (type == 'f' || type == 'e' || type == 'g' || type == 'E' || type == 'G') {
+        if (*used + 2 > EVENT_LOG_WORDS) {
+            return 0;
+        }
+        double value;
+        memcpy(&value, args + *used, 8);
+        *used += 2;
+        return snprintf(out, room, conversion, value);
+    }
+    if (wide) {
+        if (*used + 2 > EVENT_LOG_WORDS) {
+            return 0;
+        }
+        long long value;
+        memcpy(&value, args + *used, 8);
+        *used += 2;
+        return snprintf(out, room, conversion, value);
+    }
+    if (*used + 1 > EVENT_LOG_WORDS) {
+        return 0;
+    }
+    uint32_t value = args[(*used)++];
+    if (type == 's' && value == EVENT_LOG_TEXT_TAG) {
+        if (*used + EVENT_LOG_TEXT_WORDS > EVENT_LOG_WORDS) {
+            return 0;
+        }
+        char text[EVENT_LOG_TEXT_WORDS * 4 + 1];
+        memcpy(text, args + *used, EVENT_LOG_TEXT_WORDS * 4);
+        text[EVENT_LOG_TEXT_WORDS * 4] = '\0';
+        *used += EVENT_LOG_TEXT_WORDS;
+        return snprintf(out, room, conversion, text);
+    }
+    if (type == 's') {
+        return snprintf(out, room, conversion, (const char *)(uintptr_t)value);
+    }
+    if (type == 'p') {
+        return snprintf(out, room, conversion, (void *)(uintptr_t)value);
+    }
+    if (spec[specLen - 2] == 'l') {
+        return snprintf(out, room, conversion, (unsigned long)value);
+    }
+    return snprintf(out, room, conversion, (unsigned)value);
+}
+
+static void print_record(const event_log_record_t *record)
+{
+    char line[192];
+    size_t len = 0;
+    int used = 0;
+    for (const char *p = record->format; *p != '\0' && len + 1 < sizeof(line); p++) {
+        if (*p != '%') {
+            line[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            line[len++] = '%';
+            p++;
+            continue;
+        }
+        // Flags, width, precision and length, then the conversion
+        size_t specLen = 1;
+        while (p[specLen] != '\0' && strchr("-+ #0123456789.hlzjt", p[specLen]) != NULL) {
+            specLen++;
+        }
+        if (p[specLen] == '\0') {
+            break;
+        }
+        specLen++;
+        int n = format_one(line + len, sizeof(line) - len, p, specLen, record->args, &used);
+        if (n > 0) {
+            len += (size_t)n < sizeof(line) - len ? (size_t)n : sizeof(line) - len - 1;
+        }
+        p += specLen - 1;
+    }
+    line[len] = '\0';
+    printf("%6u %s", record->timeMs, line);
+}
+
+void event_log_flush(void)
+{
+    if (flushLock != NULL) {
+        xSemaphoreTake(flushLock, portMAX_DELAY);
+    }
+    for (;;) {
+        event_log_record_t record;
+        uint32_t lost = 0;
+        portENTER_CRITICAL(&ringMux);
+        bool empty = tail == head;
+        if (!empty) {
+            record = ring[tail % BADGE_LOG_EVENTS];
+            tail++;
+        } else {
+            lost = dropped;
+            dropped = 0;
+        }
+        portEXIT_CRITICAL(&ringMux);
+        if (empty) {
+            if (lost > 0) {
+                printf("Log: %u events dropped\r\n", lost);
+            }
+            fflush(stdout);
+            break;
+        }
+        print_record(&record);
+    }
+    if (flushLock != NULL) {
+        xSemaphoreGive(flushLock);
+    }
+}
+
+static void flush_task(void *params)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        event_log_flush();
+    }
+}
+
+void event_log_init(void)
+{
+    if (flushTask == NULL) {
+        flushLock = xSemaphoreCreateMutex();
+        xTaskCreatePinnedToCore(flush_task, "Log", FLUSH_TASK_STACK_SIZE, NULL, tskIDLE_PRIORITY, &flushTask, 0);
+    }
+}
+
+#else
+
+void event_log_record(const event_log_record_t *record) {}
+void event_log_init(void) {}
+
+void event_log_flush(void)
+{
+    fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef BADGE_EVENT_LOG_H
+#define BADGE_EVENT_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "badge_config.h"
+
+// Status messages off the wake path.  A printf at 115200 baud stalls for
+// about a millisecond per 11 characters, so BADGE_LOG() only records the
+// format and its arguments in a RAM ring; a task at idle priority formats
+// and prints them when core 0 has nothing better to do, and
+// event_log_flush() prints what is left before deep sleep.
+//
+// The format has to be a string literal, and %s arguments must outlive the
+// flush (literals and static tables) unless they are event_log_text_t, which
+// is copied into the event.  Arguments are evaluated even when
+// deferred, but not at all with BADGE_LOG_MODE 0, so they must have no side
+// effects.  Errors that matter stay plain printf.
+
+#define BADGE_LOG_OFF       0   // Release: compiled out
+#define BADGE_LOG_DEFERRED  1
+#define BADGE_LOG_IMMEDIATE 2   // Debug: printf at the call, as before
+
+// The host tools have no tasks to defer to
+#if !defined(ESP_PLATFORM) && BADGE_LOG_MODE == BADGE_LOG_DEFERRED
+#define BADGE_LOG_ACTIVE_MODE BADGE_LOG_IMMEDIATE
+#else
+#define BADGE_LOG_ACTIVE_MODE BADGE_LOG_MODE
+#endif
+
+// Words of arguments per event: a 64-bit value or double takes two, an
+// event_log_text_t a tag word and EVENT_LOG_TEXT_WORDS
+#define EVENT_LOG_WORDS 9
+#define EVENT_LOG_TEXT_WORDS 3
+#define EVENT_LOG_TEXT_TAG 0xFFFFFFFFu
+
+// Text short enough to copy into an event, for a %s argument that may be
+// gone by the flush (a task's name goes with its task).  Pass .chars; the
+// signed char pointer is what tells the packer to copy it.
+typedef struct {
+    signed char chars[EVENT_LOG_TEXT_WORDS * 4 + 1];
+} event_log_text_t;
+
+static inline void event_log_text(event_log_text_t *text, const char *value)
+{
+    strncpy((char *)text->chars, value, sizeof(text->chars) - 1);
+    text->chars[sizeof(text->chars) - 1] = '\0';
+}
+
+typedef struct {
+    uint32_t timeMs;
+    const char *format;
+    uint32_t args[EVENT_LOG_WORDS];
+} event_log_record_t;
+
+// Start the flush task; events logged before this wait in the ring
+void event_log_init(void);
+// Print everything logged so far
+void event_log_flush(void);
+void event_log_record(const event_log_record_t *record);
+
+#ifdef __cplusplus
+
+// Packs each argument into words the way the formatter unpacks them from
+// its conversion: two words for long long and double, one for the rest
+namespace event_log_args {
+
+template <typename T>
+inline void put(uint32_t *words, int &count, T value)
+{
+    if (sizeof(T) > 4 && count + 2 <= EVENT_LOG_WORDS) {
+        uint64_t wide = (uint64_t)value;
+        memcpy(words + count, &wide, 8);
+        count += 2;
+    } else if (sizeof(T) <= 4 && count < EVENT_LOG_WORDS) {
+        words[count++] = (uint32_t)value;
+    }
+}
+
+template <typename T>
+inline void put(uint32_t *words, int &count, T *value)
+{
+    if (count < EVENT_LOG_WORDS) {
+        words[count++] = (uint32_t)(uintptr_t)value;
+    }
+}
+
+inline void put(uint32_t *words, int &count, const signed char *value)
+{
+    if (count + 1 + EVENT_LOG_TEXT_WORDS <= EVENT_LOG_WORDS) {
+        words[count++] = EVENT_LOG_TEXT_TAG;
+        memcpy(words + count, value, EVENT_LOG_TEXT_WORDS * 4);
+        count += EVENT_LOG_TEXT_WORDS;
+    }
+}
+
+inline void put(uint32_t *words, int &count, signed char *value)
+{
+    put(words, count, (const signed char *)value);
+}
+
+inline void put(uint32_t *words, int &count, double value)
+{
+    if (count + 2 <= EVENT_LOG_WORDS) {
+        memcpy(words + count, &value, 8);
+        count += 2;
+    }
+}
+
+inline void put(uint32_t *words, int &count, float value)
+{
+    put(words, count, (double)value);
+}
+
+inline void pack(uint32_t *words, int &count) {}
+
+template <typename T, typename... Rest>
+inline void pack(uint32_t *words, int &count, T first, Rest... rest)
+{
+    put(words, count, first);
+    pack(words, count, rest...);
+}
+
+}
+
+template <typename... Args>
+inline void event_log(const char *format, Args... args)
+{
+    event_log_record_t record;
+    record.format = format;
+    int count = 0;
+    event_log_args::pack(record.args, count, args...);
+    event_log_record(&record);
+}
+
+#if BADGE_LOG_ACTIVE_MODE == BADGE_LOG_DEFERRED
+// The dead printf keeps the format checked against the arguments
+#define BADGE_LOG(...) do { if (0) printf(__VA_ARGS__); event_log(__VA_ARGS__); } while (0)
+#elif BADGE_LOG_ACTIVE_MODE == BADGE_LOG_IMMEDIATE
+#define BADGE_LOG(...) printf(__VA_ARGS__)
+#else
+#define BADGE_LOG(...) do { if (0) printf(__VA_ARGS__); } while (0)
+#endif
+
+#endif
+
+#endif
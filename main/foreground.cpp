@@ -0,0 +1,925 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "foreground.h"
+#include "event_log.h"
+#include "placement.h"
+#include "render_arena.h"
+#include "rtc_budget.h"
+#include "trace.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#include "esp_spiffs.h"
+#endif
+
+#ifndef RTC_DATA_ATTR
+#define RTC_DATA_ATTR
+#endif
+
+#define PACK_MAGIC 0x4B415042  // "BPAK"
+#define PACK_VERSION 3
+
+#define PACK_LAYOUT_COLUMNS 0
+#define PACK_LAYOUT_ROWS 1
+
+// Size, modification time and hash of the GIF a cached file was made from
+typedef struct {
+    uint32_t size;
+    uint32_t time;
+    uint32_t hash;
+} source_key_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rows;
+    uint16_t rowBytes;
+    uint16_t frame;       // Image of the GIF that was packed
+    source_key_t source;
+    uint8_t layout;
+    uint8_t reserved[3];
+} pack_header_t;
+
+typedef struct {
+    long size;
+    uint32_t time;
+} source_stat_t;
+
+typedef enum {
+    SOURCE_SAME,
+    SOURCE_TOUCHED,       // New time, same contents
+    SOURCE_CHANGED,
+} source_check_t;
+
+// Since power-on
+typedef struct {
+    uint32_t warmLoads;
+    uint32_t coldLoads;
+    uint32_t staleAssets;
+    uint64_t warmUs;
+    uint64_t coldUs;
+} asset_cache_stats_t;
+
+RTC_DATA_ATTR static asset_cache_stats_t cacheStats;
+RTC_BUDGET_CHECK(sizeof(cacheStats), RTC_BUDGET_ASSET_CACHE);
+
+#define INDEX_MAGIC 0x58494742  // "BGIX"
+#define INDEX_VERSION 2
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t frames;      // Entries that follow
+    source_key_t source;
+} index_header_t;
+
+// The GIF whose frame index is in the arena
+static char indexedPath[64];
+static source_stat_t indexedSource = { -1, 0 };
+static int indexedFrames = 0;
+
+static FILE* gifFile = 0;
+static unsigned long gifFilePos = 0;
+
+// Destination of the pixel callback currently in use
+static layer_t *decodeLayer = NULL;
+static const cancel_token_t *decodeCancel = NULL;
+
+// While foreground_load decodes into a layer: the GIF's key, for saving
+// the images passed on the way as snapshots, and the images already packed
+static const source_stat_t *snapshotSource = NULL;
+static const char *snapshotPath = NULL;
+static uint64_t snapshotFrames = 0;
+static_assert(FOREGROUND_MAX_FRAMES <= 64, "snapshotFrames has a bit per image");
+
+// Transcoding state: one byte column of each plane (in the render arena)
+// plus the column it holds
+static FILE *packFile = NULL;
+static uint8_t *packColumn = NULL;
+static int packColumnIndex = -1;
+static bool packColumnDirty = false;
+static bool packError = false;
+
+// The GIF is landscape, so its x axis runs up the panel rows and its y
+// axis across the packed bytes.  Returns false for off-panel pixels.
+static inline bool gif_pixel_position(int x, int y, int *row, int *col, uint8_t *bit)
+{
+  if (x < 0 || x >= EPD_HEIGHT || y < 0 || y >= EPD_WIDTH) {
+    return false;
+  }
+  *row = EPD_HEIGHT - x - 1;
+  *col = y / 8;
+  *bit = 1 << (7 - (y % 8));
+  return true;
+}
+
+// Map a decoded GIF pixel onto the panel.  Returns false for transparent
+// or off-panel pixels.
+BADGE_HOT_FUNC static bool gif_pixel_to_panel(int16_t x, int16_t y, uint8_t red, uint8_t green, uint8_t blue,
+    int *row, int *col, uint8_t *bit, bool *blackSet, bool *redSet)
+{
+  if (green != 0 && red == 0 && blue == 0) {
+    // Hack green to be transparent
+    return false;
+  }
+  if (!gif_pixel_position(x, y, row, col, bit)) {
+    return false;
+  }
+
+  int color = 1;
+  if (red != 0) {
+    color = 2;
+  }
+  if (blue != 0) {
+    color = 3;
+  }
+  *redSet = (color & 0x01) != 0;
+  *blackSet = (color & 0x02) != 0;
+  return true;
+}
+
+static inline void set_packed_bit(uint8_t *black, uint8_t *red, uint8_t *mask, size_t offset,
+    uint8_t bit, bool blackSet, bool redSet)
+{
+  if (redSet) {
+    red[offset] |= bit;
+  } else {
+    red[offset] &= ~bit;
+  }
+  if (blackSet) {
+    black[offset] |= bit;
+  } else {
+    black[offset] &= ~bit;
+  }
+  mask[offset] |= bit;
+}
+
+BADGE_HOT_FUNC static void layerDrawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green, uint8_t blue) {
+  int row, col;
+  uint8_t bit;
+  bool blackSet, redSet;
+  if (!gif_pixel_to_panel(x, y, red, green, blue, &row, &col, &bit, &blackSet, &redSet)) {
+    return;
+  }
+  size_t offset = row * LAYER_ROW_BYTES + col;
+  set_packed_bit(decodeLayer->black, decodeLayer->red, decodeLayer->mask, offset, bit, blackSet, redSet);
+}
+
+// Disposal back to the background: the rectangle turns transparent
+static void layerDisposeRectCallback(int16_t x, int16_t y, int16_t width, int16_t height) {
+  for (int gx = x; gx < x + width; gx++) {
+    for (int gy = y; gy < y + height; gy++) {
+      int row, col;
+      uint8_t bit;
+      if (gif_pixel_position(gx, gy, &row, &col, &bit)) {
+        decodeLayer->mask[row * LAYER_ROW_BYTES + col] &= ~bit;
+      }
+    }
+  }
+}
+
+static bool gifFileSeekCallback(unsigned long position)
+{
+  if (fseek(gifFile, position, SEEK_SET) == 0) {
+    gifFilePos = position;
+    return true;
+  }
+  return false;
+}
+
+static unsigned long gifFilePositionCallback(void)
+{
+    return gifFilePos;
+}
+
+static int gifFileReadCallback()
+{
+    gifFilePos++;
+  return fgetc(gifFile);
+}
+
+static int gifFileReadBlockCallback(void *buffer, int numberOfBytes)
+{
+  size_t read = fread(buffer, numberOfBytes, 1, gifFile);
+  gifFilePos += numberOfBytes;
+  if (read != 1) {
+    return -1;
+  }
+  return 0;
+}
+
+static bool gifCancelCallback(void)
+{
+    return cancel_token_cancelled(decodeCancel);
+}
+
+static void close_gif()
+{
+    fclose(gifFile);
+    gifFile = NULL;
+}
+
+static bool open_gif(const char *gifPath, pixel_callback drawPixel, rect_callback disposeRect)
+{
+    badge_gif_decoder_t &decoder = renderArena.decoder;
+    decoder.reset();
+    decoder.setDrawPixelCallback(drawPixel);
+    decoder.setDisposeRectCallback(disposeRect);
+    decoder.setCancelCallback(gifCancelCallback);
+    // Artwork larger than the panel is shrunk to fit as it is decoded
+    decoder.setCrop(0, 0, 0, 0);
+    decoder.setFitSize(EPD_HEIGHT, EPD_WIDTH);
+
+    decoder.setFileSeekCallback(gifFileSeekCallback);
+    decoder.setFilePositionCallback(gifFilePositionCallback);
+    decoder.setFileReadCallback(gifFileReadCallback);
+    decoder.setFileReadBlockCallback(gifFileReadBlockCallback);
+
+    gifFile = fopen(gifPath, "rb");
+    if (gifFile == NULL) {
+        printf("Failed to open %s\r\n", gifPath);
+        return false;
+    }
+    gifFilePos = 0;
+    if (decoder.startDecoding() != 0) {
+        close_gif();
+        return false;
+    }
+    return true;
+}
+
+static bool source_stat(const char *gifPath, source_stat_t *source)
+{
+    struct stat st;
+    if (stat(gifPath, &st) != 0) {
+        printf("Failed to stat %s\r\n", gifPath);
+        return false;
+    }
+    source->size = st.st_size;
+    source->time = (uint32_t)st.st_mtime;
+    return true;
+}
+
+static uint32_t source_hash(const char *gifPath)
+{
+    FILE *file = fopen(gifPath, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    uint8_t buffer[128];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (size_t i = 0; i < len; i++) {
+            hash = (hash ^ buffer[i]) * 16777619u;
+        }
+    }
+    fclose(file);
+    return hash;
+}
+
+static void source_key_init(source_key_t *key, const char *gifPath, const source_stat_t *source)
+{
+    key->size = source->size;
+    key->time = source->time;
+    key->hash = source_hash(gifPath);
+}
+
+// Compare a stored key with the GIF as it is now.  The hash is only read
+// when the time differs, e.g. after the SPIFFS image was reflashed; if it
+// matches, key takes the new time so the caller can store it.
+static source_check_t source_check(const char *gifPath, const source_stat_t *source, source_key_t *key)
+{
+    if ((long)key->size != source->size) {
+        return SOURCE_CHANGED;
+    }
+    if (key->time == source->time) {
+        return SOURCE_SAME;
+    }
+    if (source_hash(gifPath) != key->hash) {
+        return SOURCE_CHANGED;
+    }
+    key->time = source->time;
+    return SOURCE_TOUCHED;
+}
+
+// Write a cached file's header back over the old one
+static void rewrite_header(const char *path, const void *header, size_t len)
+{
+    FILE *file = fopen(path, "r+b");
+    if (file != NULL) {
+        fwrite(header, len, 1, file);
+        fclose(file);
+    }
+}
+
+static void asset_path(const char *gifPath, const char *extension, char *path, size_t len)
+{
+    snprintf(path, len, "%s", gifPath);
+    char *ext = strrchr(path, '.');
+    if (ext != NULL && (size_t)(ext - path) + strlen(extension) < len) {
+        strcpy(ext, extension);
+    }
+}
+
+static bool read_index(const char *gifPath, const char *indexPath, const source_stat_t *source)
+{
+    FILE *file = fopen(indexPath, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    index_header_t header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == INDEX_MAGIC
+        && header.version == INDEX_VERSION
+        && header.frames > 0 && header.frames <= FOREGROUND_MAX_FRAMES;
+    source_check_t check = ok ? source_check(gifPath, source, &header.source) : SOURCE_CHANGED;
+    ok = ok && check != SOURCE_CHANGED
+        && fread(renderArena.frames, sizeof(gif_frame_info), header.frames, file) == header.frames;
+    fclose(file);
+    if (ok && check == SOURCE_TOUCHED) {
+        rewrite_header(indexPath, &header, sizeof(header));
+    }
+    indexedFrames = ok ? header.frames : 0;
+    return ok;
+}
+
+static void write_index(const char *gifPath, const char *indexPath, const source_stat_t *source)
+{
+    FILE *file = fopen(indexPath, "wb");
+    if (file == NULL) {
+        printf("Failed to create %s\r\n", indexPath);
+        return;
+    }
+    index_header_t header = {};
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.frames = indexedFrames;
+    source_key_init(&header.source, gifPath, source);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(renderArena.frames, sizeof(gif_frame_info), indexedFrames, file) == (size_t)indexedFrames;
+    fclose(file);
+    if (!ok) {
+        remove(indexPath);
+    }
+}
+
+// Make the arena's frame index that of the open GIF: already there, read
+// from the .gix file next to it, or scanned and, for animations, saved for
+// next time
+static bool load_index(const char *gifPath)
+{
+    source_stat_t source;
+    if (!source_stat(gifPath, &source)) {
+        return false;
+    }
+    if (source.size == indexedSource.size && source.time == indexedSource.time
+        && strcmp(gifPath, indexedPath) == 0) {
+        return indexedFrames > 0;
+    }
+    snprintf(indexedPath, sizeof(indexedPath), "%s", gifPath);
+    indexedSource = source;
+
+    char indexPath[64];
+    asset_path(gifPath, ".gix", indexPath, sizeof(indexPath));
+    if (read_index(gifPath, indexPath, &source)) {
+        return true;
+    }
+    int frames = renderArena.decoder.scanFrames(renderArena.frames, FOREGROUND_MAX_FRAMES);
+    if (frames <= 0) {
+        printf("Failed to index %s\r\n", gifPath);
+        indexedFrames = 0;
+        return false;
+    }
+    indexedFrames = frames < FOREGROUND_MAX_FRAMES ? frames : FOREGROUND_MAX_FRAMES;
+    BADGE_LOG("Indexed %s: %i frames\r\n", gifPath, frames);
+    // Scanning a single image costs about what reading its index would, and
+    // frame 0 never goes through the index, so only animations get a file
+    if (indexedFrames > 1) {
+        write_index(gifPath, indexPath, &source);
+    }
+    return true;
+}
+
+static int resume_from_snapshot(const char *gifPath, int frame);
+static void snapshotImageDoneCallback(int image);
+
+// Frame 0 is decoded straight from the start of the file; later frames go
+// through the frame index, and when decoding into a layer for
+// foreground_load, start from the latest packed image before them
+static bool decode_gif(const char *gifPath, int frame, pixel_callback drawPixel, rect_callback disposeRect)
+{
+    if (!open_gif(gifPath, drawPixel, disposeRect)) {
+        return false;
+    }
+    badge_gif_decoder_t &decoder = renderArena.decoder;
+    bool ok;
+    if (frame == 0) {
+        ok = decoder.decodeFrame() >= 0;
+    } else {
+        ok = load_index(gifPath) && frame < indexedFrames;
+        int from = -1;
+        if (ok && snapshotSource != NULL) {
+            from = resume_from_snapshot(gifPath, frame);
+            decoder.setImageDoneCallback(snapshotImageDoneCallback);
+        }
+        ok = ok && decoder.decodeFrameAt(renderArena.frames, frame, from) >= 0;
+    }
+    close_gif();
+    return ok;
+}
+
+int foreground_frame_count(const char *gifPath)
+{
+    TRACE_SCOPE(TRACE_FOREGROUND);
+    if (!open_gif(gifPath, NULL, NULL)) {
+        return 0;
+    }
+    int frames = load_index(gifPath) ? indexedFrames : 0;
+    close_gif();
+    return frames;
+}
+
+static bool decode_to_layer(const char *gifPath, int frame, layer_t *layer, const cancel_token_t *cancel)
+{
+    layer_clear(layer);
+    decodeLayer = layer;
+    decodeCancel = cancel;
+    bool ok = decode_gif(gifPath, frame, layerDrawPixelCallback, layerDisposeRectCallback);
+    decodeLayer = NULL;
+    decodeCancel = NULL;
+    return ok;
+}
+
+bool foreground_decode(const char *gifPath, int frame, layer_t *layer, const cancel_token_t *cancel)
+{
+    TRACE_SCOPE(TRACE_FOREGROUND);
+    return decode_to_layer(gifPath, frame, layer, cancel);
+}
+
+// ---- Packed assets ----
+
+static long pack_plane_offset(int plane)
+{
+    return sizeof(pack_header_t) + (long)plane * LAYER_PLANE_BYTES;
+}
+
+static void pack_header_init(pack_header_t *header, const char *gifPath, int frame,
+    const source_stat_t *source, uint8_t layout)
+{
+    memset(header, 0, sizeof(pack_header_t));
+    header->magic = PACK_MAGIC;
+    header->version = PACK_VERSION;
+    header->rows = EPD_HEIGHT;
+    header->rowBytes = LAYER_ROW_BYTES;
+    header->frame = frame;
+    source_key_init(&header->source, gifPath, source);
+    header->layout = layout;
+}
+
+static void count_load(bool warm, int64_t startUs)
+{
+    uint64_t us = trace_now_us() - startUs;
+    if (warm) {
+        cacheStats.warmLoads++;
+        cacheStats.warmUs += us;
+    } else {
+        cacheStats.coldLoads++;
+        cacheStats.coldUs += us;
+    }
+}
+
+static void pack_flush_column()
+{
+    if (packColumnIndex < 0 || !packColumnDirty) {
+        return;
+    }
+    for (int plane = 0; plane < 3; plane++) {
+        long offset = pack_plane_offset(plane) + (long)packColumnIndex * EPD_HEIGHT;
+        if (fseek(packFile, offset, SEEK_SET) != 0
+            || fwrite(packColumn + plane * EPD_HEIGHT, EPD_HEIGHT, 1, packFile) != 1) {
+            packError = true;
+        }
+    }
+    packColumnDirty = false;
+}
+
+static void pack_load_column(int col)
+{
+    pack_flush_column();
+    for (int plane = 0; plane < 3; plane++) {
+        long offset = pack_plane_offset(plane) + (long)col * EPD_HEIGHT;
+        if (fseek(packFile, offset, SEEK_SET) != 0
+            || fread(packColumn + plane * EPD_HEIGHT, EPD_HEIGHT, 1, packFile) != 1) {
+            packError = true;
+        }
+    }
+    packColumnIndex = col;
+}
+
+BADGE_HOT_FUNC static void packDrawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green, uint8_t blue) {
+  int row, col;
+  uint8_t bit;
+  bool blackSet, redSet;
+  if (!gif_pixel_to_panel(x, y, red, green, blue, &row, &col, &bit, &blackSet, &redSet)) {
+    return;
+  }
+  // Rows of a non-interlaced GIF arrive in order, so each column is
+  // normally loaded and written exactly once.
+  if (col != packColumnIndex) {
+    pack_load_column(col);
+  }
+  set_packed_bit(packColumn, packColumn + EPD_HEIGHT, packColumn + 2 * EPD_HEIGHT, row, bit, blackSet, redSet);
+  packColumnDirty = true;
+}
+
+static void packDisposeRectCallback(int16_t x, int16_t y, int16_t width, int16_t height) {
+  for (int gy = y; gy < y + height; gy++) {
+    for (int gx = x; gx < x + width; gx++) {
+      int row, col;
+      uint8_t bit;
+      if (!gif_pixel_position(gx, gy, &row, &col, &bit)) {
+        continue;
+      }
+      if (col != packColumnIndex) {
+        pack_load_column(col);
+      }
+      packColumn[2 * EPD_HEIGHT + row] &= ~bit;
+      packColumnDirty = true;
+    }
+  }
+}
+
+void foreground_pack_path(const char *gifPath, int frame, char *packPath, size_t len)
+{
+    char extension[16];
+    snprintf(extension, sizeof(extension), ".%i.pak", frame);
+    asset_path(gifPath, extension, packPath, len);
+}
+
+// Whether SPIFFS can take another packed asset and still have room for one
+// more, so a frame index or band mode's transcode never finds it full
+static bool asset_cache_has_room(void)
+{
+#ifdef ESP_PLATFORM
+    size_t total = 0, used = 0;
+    if (esp_spiffs_info(NULL, &total, &used) != ESP_OK) {
+        return false;
+    }
+    return total - used >= 2 * (sizeof(pack_header_t) + 3 * LAYER_PLANE_BYTES);
+#else
+    return true;
+#endif
+}
+
+bool foreground_pack(const char *gifPath, int frame, const char *packPath)
+{
+    source_stat_t source;
+    if (!source_stat(gifPath, &source)) {
+        return false;
+    }
+
+    packFile = fopen(packPath, "w+b");
+    if (packFile == NULL) {
+        printf("Failed to create %s\r\n", packPath);
+        return false;
+    }
+    packColumn = renderArena.packColumn;
+    memset(packColumn, 0, sizeof(renderArena.packColumn));
+    packColumnIndex = -1;
+    packColumnDirty = false;
+    packError = false;
+
+    // Header, then all three planes transparent
+    pack_header_t header;
+    pack_header_init(&header, gifPath, frame, &source, PACK_LAYOUT_COLUMNS);
+    if (fwrite(&header, sizeof(header), 1, packFile) != 1) {
+        packError = true;
+    }
+    for (int i = 0; i < 3 * LAYER_ROW_BYTES && !packError; i++) {
+        if (fwrite(packColumn, EPD_HEIGHT, 1, packFile) != 1) {
+            packError = true;
+        }
+    }
+
+    bool ok = !packError && decode_gif(gifPath, frame, packDrawPixelCallback, packDisposeRectCallback);
+    pack_flush_column();
+    ok = ok && !packError;
+
+    packColumn = NULL;
+    fclose(packFile);
+    packFile = NULL;
+
+    if (!ok) {
+        printf("Failed to pack %s\r\n", gifPath);
+        remove(packPath);
+    }
+    return ok;
+}
+
+// Open the packed asset if it holds this image of the GIF as it is now.
+// *stale is set if it was made from another version of the GIF.
+static bool packed_asset_open_checked(packed_asset_t *asset, const char *gifPath, const char *packPath,
+    int frame, const source_stat_t *source, bool *stale)
+{
+    *stale = false;
+    asset->file = fopen(packPath, "rb");
+    if (asset->file == NULL) {
+        return false;
+    }
+    pack_header_t header;
+    if (fread(&header, sizeof(header), 1, asset->file) != 1
+        || header.magic != PACK_MAGIC
+        || header.version != PACK_VERSION
+        || header.rows != EPD_HEIGHT
+        || header.rowBytes != LAYER_ROW_BYTES
+        || header.frame != frame) {
+        packed_asset_close(asset);
+        return false;
+    }
+    source_check_t check = source_check(gifPath, source, &header.source);
+    if (check == SOURCE_CHANGED) {
+        *stale = true;
+    } else if (check == SOURCE_TOUCHED) {
+        // Note the new time so the hash is not read again
+        packed_asset_close(asset);
+        rewrite_header(packPath, &header, sizeof(header));
+        asset->file = fopen(packPath, "rb");
+    }
+    if (*stale || asset->file == NULL) {
+        packed_asset_close(asset);
+        return false;
+    }
+    asset->rowMajor = header.layout == PACK_LAYOUT_ROWS;
+    return true;
+}
+
+// Open the current packed asset, dropping a stale one
+static bool open_current(packed_asset_t *asset, const char *gifPath, const char *packPath,
+    int frame, const source_stat_t *source)
+{
+    bool stale;
+    if (packed_asset_open_checked(asset, gifPath, packPath, frame, source, &stale)) {
+        return true;
+    }
+    if (stale) {
+        BADGE_LOG("Asset cache: %s changed\r\n", gifPath);
+        cacheStats.staleAssets++;
+        foreground_cache_invalidate(gifPath);
+    }
+    return false;
+}
+
+bool foreground_open_packed(const char *gifPath, int frame, packed_asset_t *asset)
+{
+    TRACE_SCOPE(TRACE_FOREGROUND);
+    int64_t start = trace_now_us();
+    char packPath[64];
+    foreground_pack_path(gifPath, frame, packPath, sizeof(packPath));
+    source_stat_t source;
+    if (!source_stat(gifPath, &source)) {
+        return false;
+    }
+
+    if (open_current(asset, gifPath, packPath, frame, &source)) {
+        count_load(true, start);
+        return true;
+    }
+    BADGE_LOG("Packing %s frame %i..\r\n", gifPath, frame);
+    if (!foreground_pack(gifPath, frame, packPath)) {
+        return false;
+    }
+    bool stale;
+    if (!packed_asset_open_checked(asset, gifPath, packPath, frame, &source, &stale)) {
+        return false;
+    }
+    count_load(false, start);
+    return true;
+}
+
+void packed_asset_close(packed_asset_t *asset)
+{
+    if (asset->file) {
+        fclose(asset->file);
+        asset->file = NULL;
+    }
+}
+
+static bool read_rows(packed_asset_t *asset, layer_t *band, int row, int rows)
+{
+    uint8_t column[32];
+    uint8_t *planes[3] = { band->black, band->red, band->mask };
+
+    band->row = row;
+    band->rows = rows;
+    band->col = 0;
+    band->stride = LAYER_ROW_BYTES;
+
+    if (asset->rowMajor) {
+        for (int plane = 0; plane < 3; plane++) {
+            long offset = pack_plane_offset(plane) + (long)row * LAYER_ROW_BYTES;
+            if (fseek(asset->file, offset, SEEK_SET) != 0
+                || fread(planes[plane], rows * LAYER_ROW_BYTES, 1, asset->file) != 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Each byte column of the band is a contiguous run in the asset
+    for (int plane = 0; plane < 3; plane++) {
+        for (int col = 0; col < LAYER_ROW_BYTES; col++) {
+            long offset = pack_plane_offset(plane) + (long)col * EPD_HEIGHT + row;
+            if (fseek(asset->file, offset, SEEK_SET) != 0) {
+                return false;
+            }
+            for (int r = 0; r < rows; r += sizeof(column)) {
+                int count = rows - r < (int)sizeof(column) ? rows - r : (int)sizeof(column);
+                if (fread(column, count, 1, asset->file) != 1) {
+                    return false;
+                }
+                uint8_t *dest = planes[plane] + r * LAYER_ROW_BYTES + col;
+                for (int i = 0; i < count; i++) {
+                    dest[i * LAYER_ROW_BYTES] = column[i];
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool packed_asset_read_rows(packed_asset_t *asset, layer_t *band, int row, int rows)
+{
+    TRACE_SCOPE(TRACE_FOREGROUND);
+    return read_rows(asset, band, row, rows);
+}
+
+// ---- Asset cache ----
+
+// The images of a GIF with a packed asset, one bit each, found by listing
+// name.<frame>.pak next to it (one directory scan rather than a failed
+// open per image).  With remove set, the assets are deleted instead.
+static uint64_t list_packed_frames(const char *gifPath, bool remove)
+{
+    char path[64];
+    asset_path(gifPath, ".", path, sizeof(path));
+    const char *slash = strrchr(path, '/');
+    char dirPath[64] = ".";
+    if (slash != NULL) {
+        snprintf(dirPath, sizeof(dirPath), "%.*s", (int)(slash - path), path);
+    }
+    const char *prefix = slash != NULL ? slash + 1 : path;
+    size_t prefixLen = strlen(prefix);
+    DIR *dir = opendir(dirPath);
+    if (dir == NULL) {
+        return 0;
+    }
+    uint64_t frames = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, prefix, prefixLen) != 0) {
+            continue;
+        }
+        char *end;
+        long frame = strtol(entry->d_name + prefixLen, &end, 10);
+        if (end == entry->d_name + prefixLen || strcmp(end, ".pak") != 0) {
+            continue;
+        }
+        if (remove) {
+            char packPath[64 + 256];
+            snprintf(packPath, sizeof(packPath), "%s/%s", dirPath, entry->d_name);
+            ::remove(packPath);
+        } else if (frame >= 0 && frame < FOREGROUND_MAX_FRAMES) {
+            frames |= 1ull << frame;
+        }
+    }
+    closedir(dir);
+    return frames;
+}
+
+static void save_layer(const char *gifPath, int frame, const char *packPath,
+    const source_stat_t *source, const layer_t *layer)
+{
+    pack_header_t header;
+    pack_header_init(&header, gifPath, frame, source, PACK_LAYOUT_ROWS);
+    FILE *file = fopen(packPath, "wb");
+    if (file == NULL) {
+        printf("Failed to create %s\r\n", packPath);
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(layer->black, LAYER_PLANE_BYTES, 1, file) == 1
+        && fwrite(layer->red, LAYER_PLANE_BYTES, 1, file) == 1
+        && fwrite(layer->mask, LAYER_PLANE_BYTES, 1, file) == 1;
+    fclose(file);
+    if (!ok) {
+        printf("Failed to save %s\r\n", packPath);
+        remove(packPath);
+    }
+}
+
+// Put the latest packed image before `frame` that decoding can go on from
+// into the layer: one that leaves itself on the canvas, at or after the
+// key frame.  Returns the image to decode from, -1 for the key frame.
+static int resume_from_snapshot(const char *gifPath, int frame)
+{
+    const gif_frame_info *frames = renderArena.frames;
+    snapshotFrames = list_packed_frames(gifPath, false);
+    for (int image = frame - 1; image >= frames[frame].keyFrame; image--) {
+        if (!(snapshotFrames & (1ull << image)) || frames[image].disposal > DISPOSAL_LEAVE) {
+            continue;
+        }
+        char packPath[64];
+        foreground_pack_path(gifPath, image, packPath, sizeof(packPath));
+        packed_asset_t asset = {};
+        if (open_current(&asset, gifPath, packPath, image, snapshotSource)) {
+            bool ok = read_rows(&asset, decodeLayer, 0, EPD_HEIGHT);
+            packed_asset_close(&asset);
+            if (ok) {
+                return image + 1;
+            }
+            layer_clear(decodeLayer);
+        }
+    }
+    return -1;
+}
+
+// Every BADGE_ASSET_SNAPSHOT_FRAMES images, save the one just drawn, so
+// later frames of the animation don't go back to the key frame
+static void snapshotImageDoneCallback(int image)
+{
+    if (image % BADGE_ASSET_SNAPSHOT_FRAMES != 0 || (snapshotFrames & (1ull << image))
+        || !asset_cache_has_room()) {
+        return;
+    }
+    char packPath[64];
+    foreground_pack_path(snapshotPath, image, packPath, sizeof(packPath));
+    save_layer(snapshotPath, image, packPath, snapshotSource, decodeLayer);
+    snapshotFrames |= 1ull << image;
+}
+
+bool foreground_load(const char *gifPath, int frame, layer_t *layer, const cancel_token_t *cancel)
+{
+    TRACE_SCOPE(TRACE_FOREGROUND);
+    // Only a full-panel layer takes the planes as they are stored
+    if (layer->rows != EPD_HEIGHT || layer->stride != LAYER_ROW_BYTES || layer->mask == NULL) {
+        return decode_to_layer(gifPath, frame, layer, cancel);
+    }
+    int64_t start = trace_now_us();
+    char packPath[64];
+    foreground_pack_path(gifPath, frame, packPath, sizeof(packPath));
+    source_stat_t source;
+    bool haveSource = source_stat(gifPath, &source);
+
+    packed_asset_t asset = {};
+    if (haveSource && open_current(&asset, gifPath, packPath, frame, &source)) {
+        // Three reads for an asset saved here, a transpose for one packed
+        // in band mode
+        bool ok = read_rows(&asset, layer, 0, EPD_HEIGHT);
+        packed_asset_close(&asset);
+        if (ok) {
+            count_load(true, start);
+            return true;
+        }
+    }
+
+    if (haveSource) {
+        snapshotSource = &source;
+        snapshotPath = gifPath;
+    }
+    bool decoded = decode_to_layer(gifPath, frame, layer, cancel);
+    snapshotSource = NULL;
+    snapshotPath = NULL;
+    if (!decoded) {
+        return false;
+    }
+    if (haveSource && asset_cache_has_room()) {
+        save_layer(gifPath, frame, packPath, &source, layer);
+    }
+    count_load(false, start);
+    return true;
+}
+
+void foreground_cache_invalidate(const char *gifPath)
+{
+    list_packed_frames(gifPath, true);
+    char path[64];
+    asset_path(gifPath, ".gix", path, sizeof(path));
+    remove(path);
+    // The arena may hold the old frame index
+    if (strcmp(gifPath, indexedPath) == 0) {
+        indexedPath[0] = '\0';
+    }
+}
+
+void foreground_cache_report(void)
+{
+    BADGE_LOG("Asset cache: %u warm loads (%u us on average), %u cold (%u us on average), %u stale\r\n",
+        cacheStats.warmLoads, cacheStats.warmLoads ? (unsigned)(cacheStats.warmUs / cacheStats.warmLoads) : 0,
+        cacheStats.coldLoads, cacheStats.coldLoads ? (unsigned)(cacheStats.coldUs / cacheStats.coldLoads) : 0,
+        cacheStats.staleAssets);
+}
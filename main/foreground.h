@@ -0,0 +1,64 @@
+#ifndef BADGE_FOREGROUND_H
+#define BADGE_FOREGROUND_H
+
+#include <stdio.h>
+#include "layer.h"
+
+// Decode image `frame` of a GIF, as the animation shows it, straight into a
+// full-panel packed layer.  Gives up, returning false, once cancel (which
+// may be NULL) fires.
+bool foreground_decode(const char *gifPath, int frame, layer_t *layer, const cancel_token_t *cancel);
+
+// Like foreground_decode, through the packed asset cache: the first load of
+// an image decodes it and saves the planes as they sit in the layer, later
+// ones read them straight back in.  An image is not saved while SPIFFS is
+// short of room.  Decoding an animation frame also saves every
+// BADGE_ASSET_SNAPSHOT_FRAMES-th image on the way, and starts from the
+// latest one already saved, so a frame without its own asset costs at most
+// that many image decodes once the animation has been walked.
+bool foreground_load(const char *gifPath, int frame, layer_t *layer, const cancel_token_t *cancel);
+
+// Images in a GIF, at most FOREGROUND_MAX_FRAMES; 0 if it can't be read.
+// Frames past the first are found through an index of image offsets,
+// scanned once and cached next to the GIF, e.g. /spiffs/dino.gix.
+int foreground_frame_count(const char *gifPath);
+
+// Random access reader for packed assets, used to feed the foreground one
+// band at a time.  A packed asset stores the black, red and mask planes of a
+// decoded GIF.  Band mode transcodes them column by column (EPD_HEIGHT bytes
+// per byte column), so only one column is held in RAM; foreground_load saves
+// them row by row, as in a layer.
+//
+// Each asset is keyed by the size, modification time and hash of the GIF it
+// was made from, so a changed GIF is transcoded again.  The hash is only
+// read when the time differs, e.g. after the SPIFFS image was reflashed.
+typedef struct {
+    FILE *file;
+    bool rowMajor;
+} packed_asset_t;
+
+// Path of the packed asset that caches one image of gifPath, e.g.
+// /spiffs/dino.3.pak.  Each image has its own, so showing the frames of an
+// animation in any order decodes each at most once.
+void foreground_pack_path(const char *gifPath, int frame, char *packPath, size_t len);
+
+// Transcode one image of a GIF into a packed asset on disk
+bool foreground_pack(const char *gifPath, int frame, const char *packPath);
+
+// Open the packed asset for an image of gifPath, transcoding it first if it
+// is missing or was built from a different version of the GIF
+bool foreground_open_packed(const char *gifPath, int frame, packed_asset_t *asset);
+
+void packed_asset_close(packed_asset_t *asset);
+
+// Drop the packed assets and frame index made from a GIF
+void foreground_cache_invalidate(const char *gifPath);
+
+// Print warm and cold loads, and assets found stale, since power-on
+void foreground_cache_report(void);
+
+// Fill a band layer (stride LAYER_ROW_BYTES, room for `rows` rows) with panel
+// rows [row, row + rows) of the asset and position it there.
+bool packed_asset_read_rows(packed_asset_t *asset, layer_t *band, int row, int rows);
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <string.h>
+#include "frame_cache.h"
+#include "event_log.h"
+#include "layer.h"
+#include "rtc_budget.h"
+#include "trace.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#include "esp_partition.h"
+#include "power_policy.h"
+#endif
+
+#ifndef RTC_DATA_ATTR
+#define RTC_DATA_ATTR
+#endif
+
+#define FRAME_CACHE_MAGIC 0x43465242        // "BRFC"
+#define FRAME_CACHE_INDEX_MAGIC 0x58444942  // "BIDX"
+#define SECTOR_SIZE 4096
+
+// A worst-case coded frame plus its header, rounded up to whole sectors
+#define SLOT_HEADER_SIZE 64
+#define SLOT_SIZE (((SLOT_HEADER_SIZE + 2 * FRAME_CODEC_MAX_ENCODED(LAYER_PLANE_BYTES)) + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE)
+
+// Written last, so a slot whose store was interrupted still reads as empty
+typedef struct {
+    uint32_t magic;
+    uint32_t keyHash;
+    frame_key_t key;
+    uint32_t sequence;    // LRU clock at store time; reseeds the index after a cold boot
+    uint32_t eraseCount;
+    uint32_t planeBytes[2];
+} frame_slot_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t clock;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t stores;
+    uint32_t evictions;
+    uint32_t keyHash[FRAME_CACHE_MAX_SLOTS];
+    uint32_t lastUse[FRAME_CACHE_MAX_SLOTS];
+    uint16_t eraseCount[FRAME_CACHE_MAX_SLOTS];
+    uint8_t valid[FRAME_CACHE_MAX_SLOTS];
+} frame_cache_index_t;
+
+RTC_DATA_ATTR static frame_cache_index_t cacheIndex;
+RTC_BUDGET_CHECK(sizeof(cacheIndex), RTC_BUDGET_FRAME_CACHE);
+
+static int slotCount = 0;
+
+// ---- Storage backend ----
+
+#ifdef ESP_PLATFORM
+
+static const esp_partition_t *cachePartition = NULL;
+
+static size_t storage_open()
+{
+    if (cachePartition != NULL) {
+        return cachePartition->size;
+    }
+    cachePartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)FRAME_CACHE_PARTITION_SUBTYPE, FRAME_CACHE_PARTITION_LABEL);
+    return cachePartition ? cachePartition->size : 0;
+}
+
+static bool storage_read(uint32_t offset, void *dest, size_t len)
+{
+    TRACE_SCOPE(TRACE_CACHE);
+    POWER_SCOPE(TRACE_CACHE);
+    return esp_partition_read(cachePartition, offset, dest, len) == ESP_OK;
+}
+
+static bool storage_write(uint32_t offset, const void *src, size_t len)
+{
+    TRACE_SCOPE(TRACE_CACHE);
+    POWER_SCOPE(TRACE_CACHE);
+    return esp_partition_write(cachePartition, offset, src, len) == ESP_OK;
+}
+
+static bool storage_erase(uint32_t offset, size_t len)
+{
+    TRACE_SCOPE(TRACE_CACHE);
+    POWER_SCOPE(TRACE_CACHE);
+    return esp_partition_erase_range(cachePartition, offset, len) == ESP_OK;
+}
+
+#else
+
+// On the host the partition is a plain file with the same erase semantics,
+// opened by the first frame_cache_init() and kept open
+static FILE *cacheFile = NULL;
+
+static size_t storage_open()
+{
+    if (cacheFile != NULL) {
+        return FRAME_CACHE_HOST_SIZE;
+    }
+    cacheFile = fopen(FRAME_CACHE_HOST_PATH, "r+b");
+    if (cacheFile == NULL) {
+        cacheFile = fopen(FRAME_CACHE_HOST_PATH, "w+b");
+        if (cacheFile == NULL) {
+            return 0;
+        }
+        uint8_t erased[256];
+        memset(erased, 0xFF, sizeof(erased));
+        for (size_t i = 0; i < FRAME_CACHE_HOST_SIZE; i += sizeof(erased)) {
+            fwrite(erased, sizeof(erased), 1, cacheFile);
+        }
+    }
+    return FRAME_CACHE_HOST_SIZE;
+}
+
+static bool storage_read(uint32_t offset, void *dest, size_t len)
+{
+    return fseek(cacheFile, offset, SEEK_SET) == 0 && fread(dest, len, 1, cacheFile) == 1;
+}
+
+static bool storage_write(uint32_t offset, const void *src, size_t len)
+{
+    bool ok = fseek(cacheFile, offset, SEEK_SET) == 0 && fwrite(src, len, 1, cacheFile) == 1;
+    fflush(cacheFile);
+    return ok;
+}
+
+static bool storage_erase(uint32_t offset, size_t len)
+{
+    uint8_t erased[256];
+    memset(erased, 0xFF, sizeof(erased));
+    if (fseek(cacheFile, offset, SEEK_SET) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i += sizeof(erased)) {
+        if (fwrite(erased, sizeof(erased), 1, cacheFile) != 1) {
+            return false;
+        }
+    }
+    fflush(cacheFile);
+    return true;
+}
+
+#endif
+
+// ---- Index ----
+
+static uint32_t key_hash(const frame_key_t *key)
+{
+    // FNV-1a
+    const uint8_t *p = (const uint8_t *)key;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(frame_key_t); i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint32_t slot_offset(int slot)
+{
+    return (uint32_t)slot * SLOT_SIZE;
+}
+
+static bool read_header(int slot, frame_slot_header_t *header)
+{
+    return storage_read(slot_offset(slot), header, sizeof(frame_slot_header_t))
+        && header->magic == FRAME_CACHE_MAGIC;
+}
+
+static void rebuild_index()
+{
+    memset(&cacheIndex, 0, sizeof(cacheIndex));
+    for (int slot = 0; slot < slotCount; slot++) {
+        frame_slot_header_t header;
+        if (!read_header(slot, &header)) {
+            continue;
+        }
+        cacheIndex.valid[slot] = 1;
+        cacheIndex.keyHash[slot] = header.keyHash;
+        cacheIndex.lastUse[slot] = header.sequence;
+        cacheIndex.eraseCount[slot] = header.eraseCount;
+        if (header.sequence >= cacheIndex.clock) {
+            cacheIndex.clock = header.sequence + 1;
+        }
+    }
+    cacheIndex.magic = FRAME_CACHE_INDEX_MAGIC;
+}
+
+bool frame_cache_init(void)
+{
+    size_t size = storage_open();
+    slotCount = size / SLOT_SIZE;
+    if (slotCount > FRAME_CACHE_MAX_SLOTS) {
+        slotCount = FRAME_CACHE_MAX_SLOTS;
+    }
+    if (slotCount == 0) {
+        printf("Frame cache partition not found\r\n");
+        return false;
+    }
+    // RTC memory survives deep sleep but not a power cycle
+    if (cacheIndex.magic != FRAME_CACHE_INDEX_MAGIC) {
+        rebuild_index();
+    }
+    return true;
+}
+
+static int lookup(const frame_key_t *key)
+{
+    uint32_t hash = key_hash(key);
+    for (int slot = 0; slot < slotCount; slot++) {
+        if (!cacheIndex.valid[slot] || cacheIndex.keyHash[slot] != hash) {
+            continue;
+        }
+        frame_slot_header_t header;
+        if (read_header(slot, &header) && memcmp(&header.key, key, sizeof(frame_key_t)) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+int frame_cache_find(const frame_key_t *key)
+{
+    if (slotCount == 0) {
+        return -1;
+    }
+    int slot = lookup(key);
+    if (slot >= 0) {
+        cacheIndex.lastUse[slot] = cacheIndex.clock++;
+        cacheIndex.hits++;
+    } else {
+        cacheIndex.misses++;
+    }
+    return slot;
+}
+
+int frame_cache_peek(const frame_key_t *key)
+{
+    return slotCount > 0 ? lookup(key) : -1;
+}
+
+int frame_cache_slot_count(void)
+{
+    return slotCount;
+}
+
+// ---- Reading ----
+
+bool frame_cache_open_plane(frame_cache_reader_t *reader, int slot, int plane)
+{
+    frame_slot_header_t header;
+    if (!read_header(slot, &header)) {
+        return false;
+    }
+    reader->slot = slot;
+    reader->offset = slot_offset(slot) + SLOT_HEADER_SIZE;
+    if (plane == 1) {
+        reader->offset += header.planeBytes[0];
+    }
+    reader->end = reader->offset + header.planeBytes[plane];
+    reader->bufferPos = reader->buffer;
+    reader->bufferEnd = reader->buffer;
+    frame_decoder_init(&reader->decoder);
+    return true;
+}
+
+bool frame_cache_read(frame_cache_reader_t *reader, uint8_t *dest, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        if (reader->bufferPos == reader->bufferEnd) {
+            size_t chunk = reader->end - reader->offset;
+            if (chunk == 0) {
+                return false;
+            }
+            if (chunk > sizeof(reader->buffer)) {
+                chunk = sizeof(reader->buffer);
+            }
+            if (!storage_read(reader->offset, reader->buffer, chunk)) {
+                return false;
+            }
+            reader->offset += chunk;
+            reader->bufferPos = reader->buffer;
+            reader->bufferEnd = reader->buffer + chunk;
+        }
+        done += frame_decoder_read(&reader->decoder, &reader->bufferPos, reader->bufferEnd,
+            dest + done, len - done);
+    }
+    return true;
+}
+
+// ---- Writing ----
+
+static struct {
+    bool active;
+    int slot;
+    int plane;
+    frame_slot_header_t header;
+    frame_encoder_t encoder;
+    uint32_t offset;
+    uint32_t end;
+    uint8_t buffer[256];
+    size_t bufferLen;
+    bool failed;
+} store;
+
+static void store_flush()
+{
+    if (store.bufferLen == 0) {
+        return;
+    }
+    if (store.offset + store.bufferLen > store.end || !storage_write(store.offset, store.buffer, store.bufferLen)) {
+        store.failed = true;
+    }
+    store.offset += store.bufferLen;
+    store.bufferLen = 0;
+}
+
+static void store_sink(const uint8_t *data, size_t len, void *context)
+{
+    while (len > 0 && !store.failed) {
+        size_t n = sizeof(store.buffer) - store.bufferLen;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(store.buffer + store.bufferLen, data, n);
+        store.bufferLen += n;
+        data += n;
+        len -= n;
+        if (store.bufferLen == sizeof(store.buffer)) {
+            store_flush();
+        }
+    }
+}
+
+// Least recently used slot, preferring empty ones.  Ties go to the slot
+// erased the fewest times, so the partition wears evenly.
+static int choose_victim()
+{
+    int victim = -1;
+    for (int slot = 0; slot < slotCount; slot++) {
+        if (victim < 0) {
+            victim = slot;
+            continue;
+        }
+        if (cacheIndex.valid[slot] != cacheIndex.valid[victim]) {
+            if (!cacheIndex.valid[slot]) {
+                victim = slot;
+            }
+            continue;
+        }
+        uint32_t use = cacheIndex.valid[slot] ? cacheIndex.lastUse[slot] : 0;
+        uint32_t victimUse = cacheIndex.valid[victim] ? cacheIndex.lastUse[victim] : 0;
+        if (use < victimUse || (use == victimUse && cacheIndex.eraseCount[slot] < cacheIndex.eraseCount[victim])) {
+            victim = slot;
+        }
+    }
+    return victim;
+}
+
+bool frame_cache_store_begin(const frame_key_t *key)
+{
+    store.active = false;
+    if (slotCount == 0) {
+        return false;
+    }
+    int slot = choose_victim();
+    if (cacheIndex.valid[slot]) {
+        cacheIndex.evictions++;
+    }
+    cacheIndex.valid[slot] = 0;
+    if (!storage_erase(slot_offset(slot), SLOT_SIZE)) {
+        return false;
+    }
+    cacheIndex.eraseCount[slot]++;
+
+    memset(&store.header, 0, sizeof(store.header));
+    store.header.magic = FRAME_CACHE_MAGIC;
+    store.header.keyHash = key_hash(key);
+    store.header.key = *key;
+    store.header.eraseCount = cacheIndex.eraseCount[slot];
+
+    store.active = true;
+    store.failed = false;
+    store.slot = slot;
+    store.plane = 0;
+    store.offset = slot_offset(slot) + SLOT_HEADER_SIZE;
+    store.end = slot_offset(slot) + SLOT_SIZE;
+    store.bufferLen = 0;
+    frame_encoder_init(&store.encoder, store_sink, NULL);
+    return true;
+}
+
+void frame_cache_store_plane(const uint8_t *data, size_t len)
+{
+    if (store.active && !store.failed) {
+        frame_encoder_write(&store.encoder, data, len);
+    }
+}
+
+void frame_cache_store_next_plane(void)
+{
+    if (!store.active || store.plane != 0) {
+        return;
+    }
+    frame_encoder_finish(&store.encoder);
+    store.header.planeBytes[0] = store.encoder.encodedBytes;
+    frame_encoder_init(&store.encoder, store_sink, NULL);
+    store.plane = 1;
+}
+
+bool frame_cache_store_end(void)
+{
+    if (!store.active) {
+        return false;
+    }
+    store.active = false;
+    frame_encoder_finish(&store.encoder);
+    store.header.planeBytes[1] = store.encoder.encodedBytes;
+    store_flush();
+    if (store.failed || store.plane != 1) {
+        return false;
+    }
+
+    store.header.sequence = cacheIndex.clock++;
+    if (!storage_write(slot_offset(store.slot), &store.header, sizeof(store.header))) {
+        return false;
+    }
+    cacheIndex.valid[store.slot] = 1;
+    cacheIndex.keyHash[store.slot] = store.header.keyHash;
+    cacheIndex.lastUse[store.slot] = store.header.sequence;
+    cacheIndex.stores++;
+    return true;
+}
+
+void frame_cache_report(void)
+{
+    int used = 0;
+    for (int slot = 0; slot < slotCount; slot++) {
+        used += cacheIndex.valid[slot];
+    }
+    uint32_t lookups = cacheIndex.hits + cacheIndex.misses;
+    BADGE_LOG("Frame cache: %u hits, %u misses (%u%% hit rate), %u stores, %u evictions, %i of %i slots used\r\n",
+        cacheIndex.hits, cacheIndex.misses, lookups ? cacheIndex.hits * 100 / lookups : 0,
+        cacheIndex.stores, cacheIndex.evictions, used, slotCount);
+}
@@ -0,0 +1,72 @@
+#ifndef BADGE_FRAME_CACHE_H
+#define BADGE_FRAME_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "background.h"
+#include "frame_codec.h"
+
+// Persistent cache of finished frames, keyed by everything that goes into
+// rendering them.  Frames live PackBits-coded in the "framecache" data
+// partition (a file on the host), one fixed-size slot each.  The LRU index
+// lives in RTC memory so hits never touch flash except to read.
+
+// Bump whenever foreground decoding or compositing changes so stale frames
+// stop matching.  Frame keys also carry BACKGROUND_RENDER_VERSION.
+#define FRAME_CACHE_RENDER_VERSION 3
+// Both versions, each under 256, as frame keys hold them
+#define FRAME_CACHE_KEY_VERSION ((FRAME_CACHE_RENDER_VERSION << 8) | BACKGROUND_RENDER_VERSION)
+
+#define FRAME_CACHE_PARTITION_LABEL "framecache"
+#define FRAME_CACHE_PARTITION_SUBTYPE 0x40
+#define FRAME_CACHE_HOST_PATH "framecache.bin"
+#define FRAME_CACHE_HOST_SIZE 0x80000
+
+#define FRAME_CACHE_MAX_SLOTS 48
+
+typedef struct {
+    uint8_t effect;
+    uint8_t fileIndex;
+    uint16_t version;     // FRAME_CACHE_KEY_VERSION
+    uint32_t seed;
+    uint32_t assetSize;   // Size and mtime of the foreground GIF
+    uint32_t assetTime;
+    uint16_t frame;       // Image of an animated GIF
+    uint16_t reserved;
+} frame_key_t;
+
+typedef struct {
+    int slot;
+    uint32_t offset;
+    uint32_t end;
+    frame_decoder_t decoder;
+    uint8_t buffer[128];
+    const uint8_t *bufferPos;
+    const uint8_t *bufferEnd;
+} frame_cache_reader_t;
+
+bool frame_cache_init(void);
+
+// Returns the slot holding the frame, or -1.  Counts towards the hit rate.
+int frame_cache_find(const frame_key_t *key);
+
+// Like frame_cache_find, without touching the LRU or the hit rate
+int frame_cache_peek(const frame_key_t *key);
+
+// Slots in the partition, 0 before frame_cache_init() finds it
+int frame_cache_slot_count(void);
+
+// Stream one plane (0 black, 1 red) of a cached frame
+bool frame_cache_open_plane(frame_cache_reader_t *reader, int slot, int plane);
+bool frame_cache_read(frame_cache_reader_t *reader, uint8_t *dest, size_t len);
+
+// Store a frame as it is produced: black plane bytes, then
+// frame_cache_store_next_plane(), then red plane bytes.
+bool frame_cache_store_begin(const frame_key_t *key);
+void frame_cache_store_plane(const uint8_t *data, size_t len);
+void frame_cache_store_next_plane(void);
+bool frame_cache_store_end(void);
+
+void frame_cache_report(void);
+
+#endif
@@ -0,0 +1,177 @@
+#include <string.h>
+#include "frame_codec.h"
+
+// Runs shorter than this are cheaper to leave inside a literal
+#define MIN_RUN 3
+
+static void emit(frame_encoder_t *encoder, const uint8_t *data, size_t len)
+{
+    encoder->sink(data, len, encoder->context);
+    encoder->encodedBytes += len;
+}
+
+static void flush_literal(frame_encoder_t *encoder)
+{
+    if (encoder->literalLen == 0) {
+        return;
+    }
+    uint8_t control = encoder->literalLen - 1;
+    emit(encoder, &control, 1);
+    emit(encoder, encoder->literal, encoder->literalLen);
+    encoder->literalLen = 0;
+}
+
+static void flush_run(frame_encoder_t *encoder)
+{
+    if (encoder->runLen == 0) {
+        return;
+    }
+    if (encoder->runLen < MIN_RUN) {
+        // Too short to be worth a run, fold it into the literal
+        for (int i = 0; i < encoder->runLen; i++) {
+            encoder->literal[encoder->literalLen++] = encoder->runValue;
+            if (encoder->literalLen == 128) {
+                flush_literal(encoder);
+            }
+        }
+    } else {
+        flush_literal(encoder);
+        uint8_t out[2] = { (uint8_t)(257 - encoder->runLen), encoder->runValue };
+        emit(encoder, out, 2);
+    }
+    encoder->runLen = 0;
+}
+
+void frame_encoder_init(frame_encoder_t *encoder, frame_codec_sink sink, void *context)
+{
+    memset(encoder, 0, sizeof(frame_encoder_t));
+    encoder->sink = sink;
+    encoder->context = context;
+}
+
+void frame_encoder_write(frame_encoder_t *encoder, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = data[i];
+        if (encoder->runLen > 0 && b == encoder->runValue && encoder->runLen < 128) {
+            encoder->runLen++;
+            continue;
+        }
+        flush_run(encoder);
+        encoder->runValue = b;
+        encoder->runLen = 1;
+    }
+}
+
+void frame_encoder_finish(frame_encoder_t *encoder)
+{
+    flush_run(encoder);
+    flush_literal(encoder);
+}
+
+void frame_decoder_init(frame_decoder_t *decoder)
+{
+    memset(decoder, 0, sizeof(frame_decoder_t));
+}
+
+size_t frame_decoder_read(frame_decoder_t *decoder, const uint8_t **in, const uint8_t *inEnd,
+    uint8_t *out, size_t outLen)
+{
+    const uint8_t *p = *in;
+    size_t written = 0;
+
+    while (written < outLen) {
+        if (decoder->needValue) {
+            if (p == inEnd) {
+                break;
+            }
+            decoder->value = *p++;
+            decoder->needValue = false;
+        }
+        if (decoder->run > 0) {
+            size_t n = (size_t)decoder->run < outLen - written ? (size_t)decoder->run : outLen - written;
+            memset(out + written, decoder->value, n);
+            written += n;
+            decoder->run -= n;
+            continue;
+        }
+        if (decoder->literal > 0) {
+            size_t n = (size_t)decoder->literal < outLen - written ? (size_t)decoder->literal : outLen - written;
+            if (n > (size_t)(inEnd - p)) {
+                n = inEnd - p;
+            }
+            if (n == 0) {
+                break;
+            }
+            memcpy(out + written, p, n);
+            p += n;
+            written += n;
+            decoder->literal -= n;
+            continue;
+        }
+        if (p == inEnd) {
+            break;
+        }
+        uint8_t control = *p++;
+        if (control < 128) {
+            decoder->literal = control + 1;
+        } else if (control > 128) {
+            decoder->run = 257 - control;
+            decoder->needValue = true;
+        }
+    }
+
+    *in = p;
+    return written;
+}
+
+typedef struct {
+    uint8_t *out;
+    size_t cap;
+    size_t len;
+    bool overflow;
+} buffer_sink_t;
+
+static void buffer_sink(const uint8_t *data, size_t len, void *context)
+{
+    buffer_sink_t *buffer = (buffer_sink_t *)context;
+    if (buffer->len + len > buffer->cap) {
+        buffer->overflow = true;
+        return;
+    }
+    memcpy(buffer->out + buffer->len, data, len);
+    buffer->len += len;
+}
+
+void frame_delta_encode_row(const uint8_t *row, uint8_t *prev, uint8_t *out, size_t rowBytes)
+{
+    for (size_t i = 0; i < rowBytes; i++) {
+        out[i] = row[i] ^ prev[i];
+        prev[i] = row[i];
+    }
+}
+
+void frame_delta_decode_row(uint8_t *row, uint8_t *prev, size_t rowBytes)
+{
+    for (size_t i = 0; i < rowBytes; i++) {
+        row[i] ^= prev[i];
+        prev[i] = row[i];
+    }
+}
+
+size_t frame_encode(const uint8_t *data, size_t len, uint8_t *out, size_t cap)
+{
+    buffer_sink_t buffer = { out, cap, 0, false };
+    frame_encoder_t encoder;
+    frame_encoder_init(&encoder, buffer_sink, &buffer);
+    frame_encoder_write(&encoder, data, len);
+    frame_encoder_finish(&encoder);
+    return buffer.overflow ? 0 : buffer.len;
+}
+
+bool frame_decode(const uint8_t *in, size_t inLen, uint8_t *out, size_t outLen)
+{
+    frame_decoder_t decoder;
+    frame_decoder_init(&decoder);
+    return frame_decoder_read(&decoder, &in, in + inLen, out, outLen) == outLen;
+}
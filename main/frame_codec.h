@@ -0,0 +1,55 @@
+#ifndef BADGE_FRAME_CODEC_H
+#define BADGE_FRAME_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Streaming PackBits run-length coding for packed planes.  A control byte n
+// in 0..127 is followed by n + 1 literal bytes; n in 129..255 repeats the
+// next byte 257 - n times.  Both directions work on arbitrary chunks so
+// planes can be coded a band at a time.
+
+// Worst case coded size of len input bytes
+#define FRAME_CODEC_MAX_ENCODED(len) ((len) + ((len) + 127) / 128)
+
+typedef void (*frame_codec_sink)(const uint8_t *data, size_t len, void *context);
+
+typedef struct {
+    uint8_t literal[128];
+    int literalLen;
+    uint8_t runValue;
+    int runLen;
+    size_t encodedBytes;
+    frame_codec_sink sink;
+    void *context;
+} frame_encoder_t;
+
+typedef struct {
+    int literal;    // Literal bytes still to copy
+    int run;        // Repeats of value still to emit
+    uint8_t value;
+    bool needValue; // Saw a run control byte, value not read yet
+} frame_decoder_t;
+
+void frame_encoder_init(frame_encoder_t *encoder, frame_codec_sink sink, void *context);
+void frame_encoder_write(frame_encoder_t *encoder, const uint8_t *data, size_t len);
+// Flush pending output; the encoder can then start a new stream
+void frame_encoder_finish(frame_encoder_t *encoder);
+
+void frame_decoder_init(frame_decoder_t *decoder);
+// Decode from [*in, inEnd) into out until out is full or input runs out.
+// Advances *in and returns the number of bytes written.
+size_t frame_decoder_read(frame_decoder_t *decoder, const uint8_t **in, const uint8_t *inEnd,
+    uint8_t *out, size_t outLen);
+
+// XOR-delta between consecutive rows.  Smooth backgrounds and flat
+// foreground areas repeat from one row to the next, so the delta is mostly
+// zero runs.  prev holds the previous (unfiltered) row and starts zeroed.
+void frame_delta_encode_row(const uint8_t *row, uint8_t *prev, uint8_t *out, size_t rowBytes);
+void frame_delta_decode_row(uint8_t *row, uint8_t *prev, size_t rowBytes);
+
+// One-shot helpers; encode returns the coded size or 0 if it exceeds cap
+size_t frame_encode(const uint8_t *data, size_t len, uint8_t *out, size_t cap);
+bool frame_decode(const uint8_t *in, size_t inLen, uint8_t *out, size_t outLen);
+
+#endif
@@ -0,0 +1,5 @@
+#include "render_arena.h"
+
+// The one instance of the decoder template, kept in its own object so
+// linker.lf can place the LZW core without the rest of foreground.cpp
+template class GifDecoder<EPD_HEIGHT, EPD_HEIGHT, 12>;
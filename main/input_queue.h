@@ -0,0 +1,70 @@
+#ifndef BADGE_INPUT_QUEUE_H
+#define BADGE_INPUT_QUEUE_H
+
+#include <stdint.h>
+#include "badge_config.h"
+
+// Debounced press counter fed by the advance button ISR.  The ISR only
+// ever adds presses and the main loop only ever takes them, so both sides
+// can run without a lock.  Taking returns every press since the last take,
+// which lets a burst of presses fold into a single jump.
+//
+// Times are microseconds wrapped to 32 bits, which a 32-bit CPU reads in
+// one go, so the main loop never sees half of a time the ISR is writing.
+// They wrap every 71 minutes, far longer than a press stays pending.
+typedef struct {
+    volatile uint32_t presses;          // Accepted presses, written by the ISR
+    volatile uint32_t taken;            // Presses handed out, written by the main loop
+    volatile uint32_t lastEdgeUs;       // Time of the last edge in either direction
+    volatile uint32_t firstPendingUs;   // Time of the oldest press not yet taken
+    uint32_t edges;                     // Edges seen, including bounces
+} input_queue_t;
+
+static inline void input_queue_init(input_queue_t *queue)
+{
+    queue->presses = 0;
+    queue->taken = 0;
+    queue->lastEdgeUs = 0;
+    queue->firstPendingUs = 0;
+    queue->edges = 0;
+}
+
+// Called from the ISR on every edge with the pin level read back.  A press
+// is the button going down after at least BADGE_DEBOUNCE_MS without any
+// edges (or after none at all), so bounce on both press and release is
+// ignored.  Returns true for a new press.
+static inline bool input_queue_edge(input_queue_t *queue, int64_t nowUs, int level)
+{
+    uint32_t quietUs = (uint32_t)nowUs - queue->lastEdgeUs;
+    bool quiet = queue->edges == 0 || quietUs >= (uint32_t)BADGE_DEBOUNCE_MS * 1000;
+    queue->lastEdgeUs = (uint32_t)nowUs;
+    queue->edges++;
+    if (level != 0 || !quiet) {
+        return false;
+    }
+    if (queue->presses == queue->taken) {
+        queue->firstPendingUs = (uint32_t)nowUs;
+    }
+    queue->presses++;
+    return true;
+}
+
+static inline uint32_t input_queue_pending(const input_queue_t *queue)
+{
+    return queue->presses - queue->taken;
+}
+
+// Take every pending press.  firstPressUs (may be NULL) gets the time of the
+// oldest one, on the same clock as nowUs.
+static inline uint32_t input_queue_take(input_queue_t *queue, int64_t nowUs, int64_t *firstPressUs)
+{
+    uint32_t presses = queue->presses;
+    uint32_t pending = presses - queue->taken;
+    if (firstPressUs != NULL) {
+        *firstPressUs = nowUs - (uint32_t)((uint32_t)nowUs - queue->firstPendingUs);
+    }
+    queue->taken = presses;
+    return pending;
+}
+
+#endif
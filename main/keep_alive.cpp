@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+#include "badge_config.h"
+#include "event_log.h"
+#include "keep_alive.h"
+#include "power_policy.h"
+#include "trace.h"
+
+typedef struct {
+    const char *name;
+    uint16_t drawMa;        // Board current with the load on, see trace.cpp
+    bool trusted;           // May be chosen by current; see loads[] for why
+    trace_phase_t phase;    // Where its time and charge go
+    bool (*start)(void);
+    void (*stop)(void);
+} keepalive_load_info_t;
+
+// ---- Compute ----
+// A spinner on each core below everything else, so the main task and the
+// prerender still run and the spinners only fill the gaps
+
+#define SPIN_STACK_SIZE 2048
+
+static volatile bool spinning = false;
+static volatile uint32_t spinSink;
+static int spinners = 0;
+static portMUX_TYPE spinMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void spin_task(void *params)
+{
+    uint32_t x = 2463534242u;
+    while (spinning) {
+        for (int i = 0; i < 1000; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+        spinSink = x;
+    }
+    portENTER_CRITICAL(&spinMux);
+    spinners--;
+    portEXIT_CRITICAL(&spinMux);
+    vTaskDelete(NULL);
+}
+
+static bool compute_start(void)
+{
+    spinning = true;
+    for (int core = 0; core < 2; core++) {
+        portENTER_CRITICAL(&spinMux);
+        spinners++;
+        portEXIT_CRITICAL(&spinMux);
+        if (xTaskCreatePinnedToCore(spin_task, "Spin", SPIN_STACK_SIZE, NULL, tskIDLE_PRIORITY, NULL, core) != pdPASS) {
+            portENTER_CRITICAL(&spinMux);
+            spinners--;
+            portEXIT_CRITICAL(&spinMux);
+        }
+    }
+    return true;
+}
+
+static void compute_stop(void)
+{
+    spinning = false;
+    while (spinners > 0) {
+        vTaskDelay(1);
+    }
+}
+
+// ---- Radio ----
+// A station that never scans or connects: no AP beacons, but with power
+// saving off the receiver stays on.  NVS is only there for the PHY's RF
+// calibration data (CONFIG_ESP32_PHY_CALIBRATION_AND_DATA_STORAGE); without
+// it every start does a full calibration and logs a warning about it.
+
+static bool adapterReady = false;
+static bool nvsReady = false;
+
+static bool radio_start(void)
+{
+    if (!nvsReady) {
+        esp_err_t ret = nvs_flash_init();
+        if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+            nvs_flash_erase();
+            ret = nvs_flash_init();
+        }
+        if (ret != ESP_OK) {
+            return false;
+        }
+        nvsReady = true;
+    }
+    // The IDF v4 WiFi driver posts its events to the default loop and the
+    // TCP/IP adapter, so those two have to exist
+    if (!adapterReady) {
+        tcpip_adapter_init();
+        adapterReady = true;
+    }
+    esp_err_t ret = esp_event_loop_create_default();
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        return false;
+    }
+    wifi_init_config_t config = WIFI_INIT_CONFIG_DEFAULT();
+    config.nvs_enable = 0;
+    if (esp_wifi_init(&config) != ESP_OK) {
+        return false;
+    }
+    if (esp_wifi_set_storage(WIFI_STORAGE_RAM) != ESP_OK
+        || esp_wifi_set_mode(WIFI_MODE_STA) != ESP_OK
+        || esp_wifi_set_ps(WIFI_PS_NONE) != ESP_OK
+        || esp_wifi_start() != ESP_OK) {
+        esp_wifi_deinit();
+        return false;
+    }
+    return true;
+}
+
+static void radio_stop(void)
+{
+    esp_wifi_stop();
+    esp_wifi_deinit();
+}
+
+// Cheapest first.  Both currents come from the trace's charge model, not
+// a meter, and neither load has been measured.  The radio is closer to the
+// hidden AP the badge used to keep the power bank on with (receiver on,
+// power save off), but without the AP's beacons it draws less, so it is
+// only trusted as the default.  The compute load's figure is just 5 mA
+// above BADGE_KEEPALIVE_MA, so it is only used when forced with
+// BADGE_KEEPALIVE_LOAD.  Measure both on a badge before relying on either.
+static const keepalive_load_info_t loads[KEEPALIVE_LOAD_COUNT] = {
+    { "compute", 65,  false, TRACE_KEEPALIVE, compute_start, compute_stop },
+    { "radio",   140, true,  TRACE_RADIO,     radio_start,   radio_stop },
+};
+
+static int running = -1;
+static int64_t startUs;
+
+keepalive_load_t keep_alive_choose(const keepalive_profile_t *profile)
+{
+    if (BADGE_KEEPALIVE_LOAD >= 0 && BADGE_KEEPALIVE_LOAD < KEEPALIVE_LOAD_COUNT) {
+        return (keepalive_load_t)BADGE_KEEPALIVE_LOAD;
+    }
+    for (int load = 0; load < KEEPALIVE_LOAD_COUNT; load++) {
+        if (loads[load].trusted && loads[load].drawMa >= profile->minMa) {
+            return (keepalive_load_t)load;
+        }
+    }
+    return (keepalive_load_t)(KEEPALIVE_LOAD_COUNT - 1);
+}
+
+const char *keep_alive_name(keepalive_load_t load)
+{
+    return load < KEEPALIVE_LOAD_COUNT ? loads[load].name : "?";
+}
+
+keepalive_load_t keep_alive_begin(keepalive_load_t load)
+{
+    startUs = trace_now_us();
+    power_stage_begin(loads[load].phase);
+    if (!loads[load].start()) {
+        printf("Keep alive: %s load failed, spinning instead\r\n", loads[load].name);
+        power_stage_end(loads[load].phase);
+        load = KEEPALIVE_COMPUTE;
+        power_stage_begin(loads[load].phase);
+        loads[load].start();
+    }
+    running = load;
+    BADGE_LOG("Keep alive: %s load (%u mA) up in %u us\r\n", loads[load].name, loads[load].drawMa,
+        (unsigned)(trace_now_us() - startUs));
+    return load;
+}
+
+void keep_alive_end(void)
+{
+    if (running < 0) {
+        return;
+    }
+    const keepalive_load_info_t *load = &loads[running];
+    int64_t stopUs = trace_now_us();
+    load->stop();
+    int64_t endUs = trace_now_us();
+    trace_add(load->phase, endUs - startUs);
+    power_stage_end(load->phase);
+    running = -1;
+    BADGE_LOG("Keep alive: %s load ran %u ms, stopped in %u us\r\n", load->name,
+        (unsigned)((stopUs - startUs) / 1000), (unsigned)(endUs - stopUs));
+}
@@ -0,0 +1,35 @@
+#ifndef BADGE_KEEP_ALIVE_H
+#define BADGE_KEEP_ALIVE_H
+
+#include <stdint.h>
+
+// Load that keeps the IP5306 power bank chip from cutting the supply: it
+// switches off after about 32 s below its light-load current, so every
+// burst of keep-alive wakes draws at least the profile's current for the
+// profile's time.  Loads are tried cheapest first; the compute load spins
+// the cores (alongside the prerender, which does useful work on core 1),
+// the radio load keeps the WiFi receiver on without any network stack.
+
+typedef enum {
+    KEEPALIVE_COMPUTE,
+    KEEPALIVE_RADIO,
+    KEEPALIVE_LOAD_COUNT
+} keepalive_load_t;
+
+typedef struct {
+    uint16_t minMs;     // Hold the load at least this long
+    uint16_t minMa;     // Board current the load has to reach
+} keepalive_profile_t;
+
+// The configured load, or the cheapest trusted one that reaches the
+// profile's current
+keepalive_load_t keep_alive_choose(const keepalive_profile_t *profile);
+const char *keep_alive_name(keepalive_load_t load);
+
+// Start the load; returns the one running, which falls back to the compute
+// load if the radio does not start
+keepalive_load_t keep_alive_begin(keepalive_load_t load);
+// Stop it and report how long it ran
+void keep_alive_end(void);
+
+#endif
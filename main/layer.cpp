@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include "layer.h"
+
+bool layer_alloc(layer_t *layer, int rows, int stride)
+{
+    memset(layer, 0, sizeof(layer_t));
+    layer->rows = rows;
+    layer->stride = stride;
+
+    size_t bytes = rows * stride;
+    layer->black = (uint8_t *)malloc(bytes);
+    layer->red = (uint8_t *)malloc(bytes);
+    layer->mask = (uint8_t *)malloc(bytes);
+    if (layer->black == NULL || layer->red == NULL || layer->mask == NULL) {
+        layer_free(layer);
+        return false;
+    }
+    return true;
+}
+
+bool layer_alloc_full(layer_t *layer)
+{
+    return layer_alloc(layer, EPD_HEIGHT, LAYER_ROW_BYTES);
+}
+
+void layer_free(layer_t *layer)
+{
+    free(layer->black);
+    layer->black = NULL;
+    free(layer->red);
+    layer->red = NULL;
+    free(layer->mask);
+    layer->mask = NULL;
+}
+
+void layer_init_procedural(layer_t *layer, layer_render_func render)
+{
+    memset(layer, 0, sizeof(layer_t));
+    layer->rows = EPD_HEIGHT;
+    layer->stride = LAYER_ROW_BYTES;
+    layer->render = render;
+}
+
+void layer_clear(layer_t *layer)
+{
+    size_t bytes = layer->rows * layer->stride;
+    memset(layer->black, 0, bytes);
+    memset(layer->red, 0, bytes);
+    if (layer->mask) {
+        memset(layer->mask, 0, bytes);
+    }
+}
+
+// Masked merge of one contiguous span.  When source and destination share
+// the same word alignment the bulk of the span is merged 32 bits at a time.
+static void merge_span(uint8_t *dstBlack, uint8_t *dstRed,
+    const uint8_t *srcBlack, const uint8_t *srcRed, const uint8_t *srcMask, size_t len)
+{
+    if (srcMask == NULL) {
+        memcpy(dstBlack, srcBlack, len);
+        memcpy(dstRed, srcRed, len);
+        return;
+    }
+
+    size_t i = 0;
+    uintptr_t align = (uintptr_t)dstBlack & 3;
+    bool wordAligned = align == ((uintptr_t)dstRed & 3)
+        && align == ((uintptr_t)srcBlack & 3)
+        && align == ((uintptr_t)srcRed & 3)
+        && align == ((uintptr_t)srcMask & 3);
+
+    if (wordAligned) {
+        for (; i < len && ((uintptr_t)(dstBlack + i) & 3) != 0; i++) {
+            uint8_t m = srcMask[i];
+            dstBlack[i] = (dstBlack[i] & ~m) | (srcBlack[i] & m);
+            dstRed[i] = (dstRed[i] & ~m) | (srcRed[i] & m);
+        }
+        for (; i + 4 <= len; i += 4) {
+            uint32_t m = *(const uint32_t *)(srcMask + i);
+            if (m == 0) {
+                continue;
+            }
+            uint32_t *b = (uint32_t *)(dstBlack + i);
+            uint32_t *r = (uint32_t *)(dstRed + i);
+            *b = (*b & ~m) | (*(const uint32_t *)(srcBlack + i) & m);
+            *r = (*r & ~m) | (*(const uint32_t *)(srcRed + i) & m);
+        }
+    }
+    for (; i < len; i++) {
+        uint8_t m = srcMask[i];
+        dstBlack[i] = (dstBlack[i] & ~m) | (srcBlack[i] & m);
+        dstRed[i] = (dstRed[i] & ~m) | (srcRed[i] & m);
+    }
+}
+
+void layer_composite_rows(uint8_t *black, uint8_t *red, const layer_t *layer, int row, int rows)
+{
+    // Clip the layer against the panel and the destination rows
+    int firstRow = layer->row > row ? layer->row : row;
+    int lastRow = layer->row + layer->rows;
+    if (lastRow > row + rows) {
+        lastRow = row + rows;
+    }
+    int firstCol = layer->col > 0 ? layer->col : 0;
+    int lastCol = layer->col + layer->stride;
+    if (lastCol > LAYER_ROW_BYTES) {
+        lastCol = LAYER_ROW_BYTES;
+    }
+    if (firstRow >= lastRow || firstCol >= lastCol) {
+        return;
+    }
+
+    size_t src = (firstRow - layer->row) * layer->stride + (firstCol - layer->col);
+    size_t dst = (firstRow - row) * LAYER_ROW_BYTES + firstCol;
+    const uint8_t *mask = layer->mask;
+
+    if (firstCol == 0 && lastCol == LAYER_ROW_BYTES && layer->stride == LAYER_ROW_BYTES) {
+        // Full width: the clipped rows are one contiguous span
+        merge_span(black + dst, red + dst, layer->black + src, layer->red + src,
+            mask ? mask + src : NULL, (lastRow - firstRow) * LAYER_ROW_BYTES);
+        return;
+    }
+
+    size_t len = lastCol - firstCol;
+    for (int r = firstRow; r < lastRow; r++) {
+        merge_span(black + dst, red + dst, layer->black + src, layer->red + src,
+            mask ? mask + src : NULL, len);
+        src += layer->stride;
+        dst += LAYER_ROW_BYTES;
+    }
+}
+
+void layer_composite(uint8_t *black, uint8_t *red, const layer_t *layer)
+{
+    layer_composite_rows(black, red, layer, 0, EPD_HEIGHT);
+}
+
+void compositor_init(compositor_t *compositor)
+{
+    memset(compositor, 0, sizeof(compositor_t));
+}
+
+bool compositor_push(compositor_t *compositor, layer_t *layer)
+{
+    if (compositor->count >= COMPOSITOR_MAX_LAYERS) {
+        return false;
+    }
+    compositor->layers[compositor->count++] = layer;
+    return true;
+}
+
+void compositor_flatten_rows(compositor_t *compositor, uint8_t *black, uint8_t *red, int row, int rows)
+{
+    for (int i = 0; i < compositor->count; i++) {
+        layer_t *layer = compositor->layers[i];
+        if (layer->render) {
+            layer->render(black, red, row, rows);
+            continue;
+        }
+        if (layer->wait) {
+            layer->wait(layer);
+            layer->wait = NULL;
+        }
+        layer_composite_rows(black, red, layer, row, rows);
+    }
+}
+
+bool compositor_flatten(compositor_t *compositor, uint8_t *black, uint8_t *red)
+{
+    for (int i = 0; i < compositor->count; i++) {
+        layer_t *layer = compositor->layers[i];
+        if (!layer->render && layer->wait) {
+            layer->wait(layer);
+            layer->wait = NULL;
+        }
+        for (int row = 0; row < EPD_HEIGHT; row += COMPOSITOR_CANCEL_ROWS) {
+            if (cancel_token_cancelled(compositor->cancel)) {
+                return false;
+            }
+            int rows = EPD_HEIGHT - row < COMPOSITOR_CANCEL_ROWS ? EPD_HEIGHT - row : COMPOSITOR_CANCEL_ROWS;
+            size_t offset = row * LAYER_ROW_BYTES;
+            if (layer->render) {
+                layer->render(black + offset, red + offset, row, rows);
+            } else {
+                layer_composite_rows(black + offset, red + offset, layer, row, rows);
+            }
+        }
+    }
+    return true;
+}
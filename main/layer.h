@@ -0,0 +1,79 @@
+#ifndef BADGE_LAYER_H
+#define BADGE_LAYER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "EPD_2in9b.h"
+#include "cancel_token.h"
+
+// Bytes in one packed panel row, and in one full packed 1bpp plane
+#define LAYER_ROW_BYTES (EPD_WIDTH / 8)
+#define LAYER_PLANE_BYTES (EPD_WIDTH * EPD_HEIGHT / 8)
+
+#define COMPOSITOR_MAX_LAYERS 8
+// Rows drawn between cancellation checks when flattening a whole frame
+#define COMPOSITOR_CANCEL_ROWS 8
+
+struct layer_t;
+
+// Procedural layers draw themselves straight into the destination rows
+typedef void (*layer_render_func)(uint8_t *black, uint8_t *red, int row, int rows);
+// Called once before a packed layer is first merged, so a layer that is
+// produced asynchronously (e.g. on the other core) can be waited for
+typedef void (*layer_wait_func)(const struct layer_t *layer);
+
+// A packed layer.  The black and red planes use the same bit polarity as the
+// panel buffers; mask bits are 1 where the layer is opaque and 0 where
+// whatever is underneath should show through.  A NULL mask means opaque.
+//
+// Layers are positioned in panel coordinates at byte granularity: `row` and
+// `rows` are panel rows, `col` is the first byte column and `stride` is the
+// width of the layer in bytes.  Anything outside the panel is clipped.
+typedef struct layer_t {
+    uint8_t *black;
+    uint8_t *red;
+    uint8_t *mask;
+    int row;
+    int rows;
+    int col;
+    int stride;
+    layer_render_func render;
+    layer_wait_func wait;
+} layer_t;
+
+typedef struct {
+    layer_t *layers[COMPOSITOR_MAX_LAYERS];
+    int count;
+    const cancel_token_t *cancel;   // Optional
+} compositor_t;
+
+// Allocate planes for a rows x stride layer placed at the panel origin
+bool layer_alloc(layer_t *layer, int rows, int stride);
+// Allocate planes covering the whole panel
+bool layer_alloc_full(layer_t *layer);
+void layer_free(layer_t *layer);
+
+// A full-panel procedural layer
+void layer_init_procedural(layer_t *layer, layer_render_func render);
+
+// Make the whole layer transparent
+void layer_clear(layer_t *layer);
+
+// Merge a layer over destination planes: dst = (dst & ~mask) | (src & mask).
+// The destination holds `rows` panel rows starting at panel row `row`.
+void layer_composite_rows(uint8_t *black, uint8_t *red, const layer_t *layer, int row, int rows);
+void layer_composite(uint8_t *black, uint8_t *red, const layer_t *layer);
+
+void compositor_init(compositor_t *compositor);
+// Layers are stacked bottom to top in the order they are pushed
+bool compositor_push(compositor_t *compositor, layer_t *layer);
+
+// Draw every layer of the stack into destination planes holding `rows`
+// panel rows starting at panel row `row`.
+void compositor_flatten_rows(compositor_t *compositor, uint8_t *black, uint8_t *red, int row, int rows);
+// Draw the whole frame one layer at a time, so a layer produced elsewhere
+// is only waited for once everything under it is drawn.  Returns false,
+// leaving the planes half drawn, if the cancel token fires.
+bool compositor_flatten(compositor_t *compositor, uint8_t *black, uint8_t *red);
+
+#endif
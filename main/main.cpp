@@ -11,102 +11,71 @@
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
-#include "esp_pm.h"
 #include "esp_sleep.h"
 #include "driver/rtc_io.h"
 #include "driver/gpio.h"
 #include "esp_spi_flash.h"
 #include "esp_spiffs.h"
 #include "esp_log.h"
-#include "esp_wifi.h"
-#include "nvs_flash.h"
+#include "esp_timer.h"
 #include "DEV_Config.h"
-#include "GifDecoder.h"
+#include "background.h"
+#include "background_pack.h"
+#include "cancel_token.h"
+#include "badge_config.h"
+#include "boot_profile.h"
+#include "foreground.h"
+#include "frame_cache.h"
+#include "event_log.h"
+#include "input_queue.h"
+#include "keep_alive.h"
+#include "layer.h"
+#include "power_policy.h"
+#include "render_arena.h"
+#include "rtc_frame.h"
+#include "self_bench.h"
+#include "trace.h"
+#include "wake_stub.h"
 #include "main.h"
 #include <math.h>
+#include <sys/stat.h>
 
 #include "EPD_2in9b.h"
+#include "panel_session.h"
 
 static const char *TAG = "epaper_badge";
 
 RTC_DATA_ATTR uint8_t sleep_intervals;
 RTC_DATA_ATTR uint8_t fileIndex;
 
-float seed[32];
-
-typedef int (*DitherFunc)(float c, int x, int y);
-typedef int (*RenderFunc)(int x, int y);
-
-DitherFunc fnDither;
-RenderFunc fnRender;
-
-int dither_random(float c, int x, int y) {
-    int d = floor(c);
-    int r = (int)((c - (float)d) * 255.0f);
-    if (r > esp_random() % 256) {
-        d++;
-    }
-    d = d % 3;
-    return d;
-}
-
-int dither_nearest(float c, int x, int y) {
-    return (int)floor(c) % 3;
-}
-
-int dither_slice(float c, int x, int y) {
-    int d = floor(c);
-    int slice_width = (int)(64.0f * seed[31]) + 2;
-    int r = (int)((c - (float)d) * slice_width);
-    if (r > (x + y) % slice_width) {
-        d++;
-    }
-    d = d % 3;
-    return d;
-}
-
-int dither_circles(float c, int x, int y) {
-    int d = floor(c);
-    int slice_width = (int)(64.0f * seed[31]) + 2;
-    float r = ((c - (float)d) * slice_width);
-
-    float cx = seed[30] * (float)EPD_WIDTH;
-    float cy = seed[29] * (float)EPD_HEIGHT;
-    float dist = sqrtf(fabs(x - cx)*fabs(x - cx) + fabs(y - cy)*fabs(y - cy));
-
-    if (r > (int)dist % slice_width) {
-        d++;
-    }
-    d = d % 3;
-    return d;
-}
-
-int render_plasma(int x, int y) {
-    float scale = (float)EPD_HEIGHT;
-    float tx = (float)x / scale;
-    float ty = (float)y / scale;
-    float ox = tx;
-    float oy = ty;
-    tx += sin((float)oy * (seed[10] - 0.5f) * 5.0f + seed[12]) * seed[19];
-    ty += sin((float)ox * (seed[11] - 0.5f) * 5.0f + seed[13]) * seed[20];
-    float height = sin(tx * 20.0f * (seed[0] - 0.5f) + ty  * 20.0f * (seed[1] - 0.5f) + seed[14] * 10.0f) * sin(tx * 20.0f * (seed[2] - 0.5f) + ty * 20.0f * (seed[3] - 0.5f) + seed[15] * 10.0f) * (seed[9] - 0.5f)
-    + sin(tx / scale * 20.0f * (seed[4] - 0.5f) + ty / scale * 20.0f * (seed[5] - 0.5f) + seed[16] * 10.0f) * sin(tx * 20.0f * (seed[6] - 0.5f) + ty * 20.0f * (seed[7] - 0.5f) + seed[17] * 10.0f) * (seed[8] - 0.5f);
-
-    int c = fnDither((height + 0.5f) * 10.0f * seed[18] + 1.0f, x, y);
-    return c;
-}
-
+// A frame is a foreground image (and the image within it, for an animated
+// GIF), an effect and a single seed that expands into seed[] and
+// ditherSeed, so it can be reproduced (and cached) from these values alone
 typedef struct {
-    RenderFunc render;
-    DitherFunc dither;
-} effect_t;
-
-const int kEffectCount = 3;
-effect_t effects[] = {
-  { render_plasma, dither_random },
-  { render_plasma, dither_slice },
-  { render_plasma, dither_circles },
-};
+    uint8_t fileIndex;
+    uint8_t effect;
+    uint8_t frame;
+    uint32_t seed;
+} frame_plan_t;
+
+// The frame being drawn
+frame_plan_t currentFrame;
+
+// Frames chosen ahead of time so the keep-alive window can pre-render them
+RTC_DATA_ATTR frame_plan_t nextAdvanceFrame;  // shown when the button is pressed
+RTC_DATA_ATTR frame_plan_t nextAutoFrame;     // shown by the next timed update
+RTC_DATA_ATTR bool framePlansValid;
+RTC_DATA_ATTR bool framePlansRendered;
+// Duration of the last full render, used to decide what fits before the
+// keep-alive deadline
+RTC_DATA_ATTR uint32_t lastRenderMs;
+
+// Whether the panel shows any red (unknown at power-on, so assume so) and
+// the fast black and white refreshes since the last tri-color one
+RTC_DATA_ATTR bool panelHasRed = true;
+RTC_DATA_ATTR uint8_t fastRefreshes;
+// The waveform of the update in progress
+bool panelFast = false;
 
 const int kForegroundCount = 7;
 const char* foreground_files[] = {
@@ -118,140 +87,203 @@ const char* foreground_files[] = {
   "/spiffs/fxrlogo.gif",
   "/spiffs/github.gif"
 };
-
-FILE* gifFile = 0;
-unsigned long gifFilePos = 0;
+// Images in each foreground GIF, 0 until it has been looked at
+RTC_DATA_ATTR uint8_t foregroundFrames[kForegroundCount];
+RTC_BUDGET_CHECK(sizeof(sleep_intervals) + sizeof(fileIndex) + 2 * sizeof(frame_plan_t)
+    + sizeof(framePlansValid) + sizeof(framePlansRendered) + sizeof(lastRenderMs)
+    + sizeof(panelHasRed) + sizeof(fastRefreshes) + sizeof(foregroundFrames), RTC_BUDGET_APP);
 
 __uint8_t *blackImage = NULL;
 __uint8_t *redImage = NULL;
 
-extern "C" void gifDrawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green, uint8_t blue) {
-  if (green != 0 && red == 0 && blue == 0) {
-    // Hack green to be transparent
-    return; 
-  }
-  x = EPD_HEIGHT - x - 1;
-  size_t offset = (y + x * EPD_WIDTH) / 8;
-  if (offset >= EPD_WIDTH * EPD_HEIGHT / 8) {
-    return;
-  }
-  int bit = 7 - (y % 8);
-
-  int color = 1;
-  if (red != 0) {
-    color = 2;
-  }
-  if (blue != 0) {
-    color = 3;
-  }
-  if (color & 0x01) {
-    redImage[offset] |= (1 << bit);
-  } else {
-    redImage[offset] &= ~(1 << bit);
-  }
-  if (color & 0x02) {
-    blackImage[offset] |= (1 << bit);
-  } else {
-    blackImage[offset] &= ~(1 << bit);
-  }
-}
-
-extern "C" bool gifFileSeekCallback(unsigned long position)
-{
-  if (fseek(gifFile, position, SEEK_SET) == 0) {
-    gifFilePos = position;
-    return true;
-  }
-  return false;
-}
+// Foreground GIF, decoded into its own packed layer so it can be produced
+// while the background is still rendering
+layer_t foregroundLayer = {};
 
-extern "C" unsigned long gifFilePositionCallback(void)
+EventGroupHandle_t render_event_group = NULL;
+const int RENDER_EVENT_UPDATE_COMPLETE = BIT0;
+const int RENDER_EVENT_DECODE_COMPLETE = BIT1;
+const int RENDER_EVENT_PRERENDER_COMPLETE = BIT2;
+
+// Cancelled by the advance button so the frame in progress gives way to the
+// next one
+cancel_token_t renderCancel;
+// When the first of the presses being handled happened, for latency reports
+int64_t advancePressUs = 0;
+
+typedef struct {
+    int64_t background_us;
+    int64_t decode_us;
+    int64_t decode_wait_us;
+    int64_t composite_us;
+    int64_t total_us;
+} render_timings_t;
+
+render_timings_t renderTimings;
+
+// Bottom to top: procedural background, then the foreground GIF
+compositor_t badgeLayers;
+layer_t backgroundLayer;
+
+// Pick a random effect and seed for a frame, and a random image of an
+// animated foreground.  With a background pack the pair comes from the
+// pack, so the background is read rather than rendered.
+void choose_frame_style(frame_plan_t *plan)
 {
-    return gifFilePos;
+    uint8_t frames = foregroundFrames[plan->fileIndex];
+    plan->frame = frames > 1 ? esp_random() % frames : 0;
+    // A pack is a bounded set already, so BADGE_SEED_POOL does not apply
+    int packed = background_pack_count();
+    if (packed > 0) {
+        if (background_pack_entry(esp_random() % packed, &plan->effect, &plan->seed)) {
+            return;
+        }
+    }
+    plan->effect = esp_random() % BACKGROUND_EFFECT_COUNT;
+    plan->seed = esp_random();
+    if (BADGE_SEED_POOL > 0) {
+        plan->seed %= BADGE_SEED_POOL;
+    }
 }
 
-extern "C" int gifFileReadCallback()
+// Select a random gif, other than the one last displayed
+uint8_t choose_auto_file_index()
 {
-    gifFilePos++;
-  return fgetc(gifFile);
+    int newFileIndex = esp_random() % (kForegroundCount - 1);
+    if (newFileIndex >= fileIndex) {
+        newFileIndex++;
+    }
+    return newFileIndex;
 }
 
-extern "C" int gifFileReadBlockCallback(void *buffer, int numberOfBytes)
+// Decide what the button and the next timed update will show, so both can be
+// rendered before they are needed
+void plan_next_frames()
 {
-  size_t read = fread(buffer, numberOfBytes, 1, gifFile);
-  gifFilePos += numberOfBytes;
-  if (read != 1) {
-    return -1;
-  }
-  return 0;
+    // Needs SPIFFS, which is still mounted after a display update
+    for (int i = 0; i < kForegroundCount; i++) {
+        if (foregroundFrames[i] == 0) {
+            foregroundFrames[i] = foreground_frame_count(foreground_files[i]);
+        }
+    }
+    nextAdvanceFrame.fileIndex = (fileIndex + 1) % kForegroundCount;
+    choose_frame_style(&nextAdvanceFrame);
+    nextAutoFrame.fileIndex = choose_auto_file_index();
+    choose_frame_style(&nextAutoFrame);
+    framePlansValid = true;
+    framePlansRendered = false;
 }
 
-EventGroupHandle_t render_event_group = NULL;
-const int RENDER_EVENT_UPDATE_COMPLETE = BIT0;
+// Whether the current background streams from the background pack
+bool packBackground = false;
 
-extern "C" void update_display()
-{
-    printf("Rendering Background...\r\n");
-    // Generate random seeds
-    for (int i=0; i<32; i++) {
-        seed[i] = (float)(esp_random() % 65536) / 65536.0f;
-    }
-
-    // Select a random effect
-    effect_t effect = effects[esp_random() % kEffectCount];
-
-    fnRender = effect.render;
-    fnDither = effect.dither;
-
-    __uint8_t *blackDest = blackImage;
-    __uint8_t *redDest = redImage;
-
-    for (int y=0; y<EPD_HEIGHT; y++) {
-        for (int x=0; x<EPD_WIDTH; x++) {
-          if (x % 8 == 0) {
-            *blackDest = 0;
-            *redDest = 0;
-          }
-          int color=fnRender(x,y) + 1;
-
-          if (color & 0x01) {
-            *blackDest |= 1;
-          }
-          if (color & 0x02) {
-            *redDest |= 1;
-          }
-          if (x % 8 == 7) {
-            blackDest++;
-            redDest++;
-          } else {
-            *blackDest <<= 1;
-            *redDest <<= 1;
-          }
-        }
+void apply_background()
+{
+    packBackground = background_pack_apply(currentFrame.effect, currentFrame.seed);
+    if (!packBackground) {
+        background_apply(currentFrame.effect, currentFrame.seed);
     }
+}
 
-    // ---- Composite GIF ----
-    const char *szFile = foreground_files[fileIndex];
-    printf("Loading %s..\r\n", szFile);
-    
-    GifDecoder<EPD_HEIGHT, EPD_HEIGHT, 12> decoder;
-    decoder.setDrawPixelCallback(gifDrawPixelCallback);
+void render_background_rows(uint8_t *black, uint8_t *red, int row, int rows)
+{
+    int64_t start = esp_timer_get_time();
+    if (packBackground && !background_pack_render_rows(black, red, row, rows)) {
+        // The pack holds bg_pack's vector kernel output, checked to within a
+        // pixel of this kernel's, so the rest of the frame renders here
+        BADGE_LOG("Background pack read failed, rendering instead\r\n");
+        packBackground = false;
+        background_apply(currentFrame.effect, currentFrame.seed);
+    }
+    if (!packBackground) {
+        background_render_rows(black, red, row, rows);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    renderTimings.background_us += elapsed;
+    trace_add(TRACE_BACKGROUND, elapsed);
+}
+
+bool foregroundDecoded = false;
+
+void decode_foreground()
+{
+    const char *szFile = foreground_files[currentFrame.fileIndex];
+    BADGE_LOG("Loading %s..\r\n", szFile);
+
+    foregroundDecoded = foreground_load(szFile, currentFrame.frame, &foregroundLayer, &renderCancel);
+}
 
-    decoder.setFileSeekCallback(gifFileSeekCallback);
-    decoder.setFilePositionCallback(gifFilePositionCallback);
-    decoder.setFileReadCallback(gifFileReadCallback);
-    decoder.setFileReadBlockCallback(gifFileReadBlockCallback);
+// Runs on core 0 while render_task fills in the background on core 1
+extern "C" void decode_task(void *params)
+{
+    power_stage_begin(TRACE_FOREGROUND);
+    int64_t start = esp_timer_get_time();
+    decode_foreground();
+    renderTimings.decode_us = esp_timer_get_time() - start;
+    trace_memory("decode end");
+    power_stage_end(TRACE_FOREGROUND);
 
+    xEventGroupSetBits(render_event_group, RENDER_EVENT_DECODE_COMPLETE);
 
-    gifFile = fopen(szFile, "rb");
-    gifFilePos = 0;
-    decoder.startDecoding();
-    decoder.decodeFrame();
-    fclose(gifFile);
+    vTaskDelete(NULL);
+}
+
+void wait_for_decode(const layer_t *layer)
+{
+    int64_t start = esp_timer_get_time();
+    xEventGroupWaitBits(render_event_group, RENDER_EVENT_DECODE_COMPLETE, true, true, portMAX_DELAY);
+    renderTimings.decode_wait_us = esp_timer_get_time() - start;
+}
+
+// Returns false if the button cancelled the frame
+extern "C" bool update_display()
+{
+    POWER_SCOPE(TRACE_COMPOSITE);
+    memset(&renderTimings, 0, sizeof(renderTimings));
+    int64_t start = esp_timer_get_time();
+
+    compositor_init(&badgeLayers);
+    badgeLayers.cancel = &renderCancel;
+
+    apply_background();
+    layer_init_procedural(&backgroundLayer, render_background_rows);
+    compositor_push(&badgeLayers, &backgroundLayer);
+
+    if (foregroundLayer.mask != NULL) {
+        xEventGroupClearBits(render_event_group, RENDER_EVENT_DECODE_COMPLETE);
+        foregroundLayer.wait = wait_for_decode;
+        compositor_push(&badgeLayers, &foregroundLayer);
+        xTaskCreatePinnedToCore(decode_task, "Decode", DECODE_TASK_STACK_SIZE, NULL, 1, NULL, 0);
+    }
+
+    BADGE_LOG("Rendering Background...\r\n");
+    bool finished = compositor_flatten(&badgeLayers, blackImage, redImage);
+    if (foregroundLayer.wait != NULL) {
+        // Cancelled before reaching the foreground; the decode task still
+        // owns the decoder until it notices
+        wait_for_decode(&foregroundLayer);
+        foregroundLayer.wait = NULL;
+    }
+    if (!finished) {
+        BADGE_LOG("Render cancelled after %lld us\r\n", esp_timer_get_time() - start);
+        return false;
+    }
+
+    renderTimings.total_us = esp_timer_get_time() - start;
+    renderTimings.composite_us = renderTimings.total_us
+        - renderTimings.background_us - renderTimings.decode_wait_us;
+    trace_add(TRACE_COMPOSITE, renderTimings.composite_us);
+
+    BADGE_LOG("Render timings: background %lld us, decode %lld us (waited %lld us), composite %lld us over %i layers, total %lld us\r\n",
+        renderTimings.background_us, renderTimings.decode_us, renderTimings.decode_wait_us,
+        renderTimings.composite_us, badgeLayers.count, renderTimings.total_us);
+    return true;
 }
 
 bool init_spiffs()
 {
+    TRACE_SCOPE(TRACE_SPIFFS);
+    POWER_SCOPE(TRACE_SPIFFS);
     ESP_LOGI(TAG, "Initializing SPIFFS");
     
     esp_vfs_spiffs_conf_t conf = {
@@ -292,62 +324,492 @@ void destroy_spiffs()
     ESP_LOGI(TAG, "SPIFFS unmounted");
 }
 
-extern "C" void render_task(void *params)
+void log_upload_start()
+{
+    BADGE_LOG("Wake to panel upload: %lld ms\r\n", esp_timer_get_time() / 1000);
+    if (advancePressUs != 0) {
+        BADGE_LOG("Press to panel upload: %lld ms\r\n", (esp_timer_get_time() - advancePressUs) / 1000);
+    }
+}
+
+void log_refresh_started()
 {
-    blackImage = (__uint8_t *)malloc(EPD_WIDTH * EPD_HEIGHT / 8);
-    redImage = (__uint8_t *)malloc(EPD_WIDTH * EPD_HEIGHT / 8);
+    if (advancePressUs != 0) {
+        BADGE_LOG("Press to refresh start: %lld ms\r\n", (esp_timer_get_time() - advancePressUs) / 1000);
+        advancePressUs = 0;
+    }
+}
+
+// A button press onto a screen without red can take the fast waveform,
+// until its ghosting calls for a full refresh
+bool fast_refresh_allowed()
+{
+    return BADGE_FAST_REFRESHES > 0 && advancePressUs != 0 && !panelHasRed
+        && fastRefreshes < BADGE_FAST_REFRESHES;
+}
+
+// Start a panel update, with the fast waveform if the frame has no red and
+// the screen allows it
+void panel_begin(bool redFree)
+{
+    panelFast = redFree && fast_refresh_allowed();
+    panel_session_begin(panelFast ? &EPD_LUT_FAST_MONO : NULL);
+    if (panelFast) {
+        BADGE_LOG("Fast black and white refresh %u of %u\r\n", fastRefreshes + 1, BADGE_FAST_REFRESHES);
+    }
+}
 
-    update_display();
+// Start the refresh; the panel works on it while the badge moves on
+void panel_refresh(bool redFree)
+{
+    panel_session_refresh();
+    panelHasRed = !redFree;
+    fastRefreshes = panelFast ? fastRefreshes + 1 : 0;
+    log_refresh_started();
+}
 
-    printf("Refreshing epaper...\r\n");
-    if(EPD_Init() != 0) {
-        printf("e-Paper init failed\r\n");
+void render_full_frame(const frame_key_t *key, bool toPanel, bool toRtc)
+{
+    blackImage = renderArena.black;
+    redImage = renderArena.red;
+    render_arena_foreground_layer(&foregroundLayer);
+
+    if (!update_display()) {
+        blackImage = NULL;
+        redImage = NULL;
+        return;
     }
 
-    EPD_Clear();
-    EPD_Display(blackImage, redImage);
-    EPD_Sleep();
+    if (toPanel) {
+        BADGE_LOG("Refreshing epaper...\r\n");
+        log_upload_start();
+        bool redFree = EPD_PlaneBlank(redImage, EPD_HEIGHT);
+        panel_begin(redFree);
+        EPD_Upload(blackImage, redImage);
+        panel_refresh(redFree);
+    }
+
+    // The panel is refreshing, so caching the frame delays nothing visible
+    POWER_SCOPE(TRACE_CACHE);
+    if (foregroundDecoded && frame_cache_store_begin(key)) {
+        frame_cache_store_plane(blackImage, LAYER_PLANE_BYTES);
+        frame_cache_store_next_plane();
+        frame_cache_store_plane(redImage, LAYER_PLANE_BYTES);
+        frame_cache_store_end();
+    }
+    if (foregroundDecoded && toRtc) {
+        rtc_frame_store_begin(key);
+        rtc_frame_store_plane(blackImage, LAYER_PLANE_BYTES);
+        rtc_frame_store_next_plane();
+        rtc_frame_store_plane(redImage, LAYER_PLANE_BYTES);
+        bool kept = rtc_frame_store_end();
+        BADGE_LOG("RTC frame: %s\r\n", kept ? "kept" : "too big");
+    }
 
-    free(blackImage);
     blackImage = NULL;
-    free(redImage);
     redImage = NULL;
+}
+
+// Render, composite and send BADGE_BAND_ROWS rows at a time.  The panel takes
+// the whole black plane before the red one, so every band is drawn twice;
+// the background is deterministic for a given seed, so both passes agree.
+void render_banded(const frame_key_t *key, bool toPanel, bool toRtc)
+{
+    const int bandRows = RENDER_ARENA_ROWS;
+    const size_t bandBytes = RENDER_ARENA_PLANE_BYTES;
+
+    memset(&renderTimings, 0, sizeof(renderTimings));
+    int64_t start = esp_timer_get_time();
+
+    __uint8_t *bandBlack = renderArena.black;
+    __uint8_t *bandRed = renderArena.red;
+    layer_t foregroundBand;
+    render_arena_foreground_layer(&foregroundBand);
+
+    compositor_init(&badgeLayers);
+    apply_background();
+    layer_init_procedural(&backgroundLayer, render_background_rows);
+    compositor_push(&badgeLayers, &backgroundLayer);
+
+    const char *szFile = foreground_files[currentFrame.fileIndex];
+    BADGE_LOG("Loading %s..\r\n", szFile);
+    packed_asset_t asset = {};
+    power_stage_begin(TRACE_FOREGROUND);
+    bool haveForeground = foreground_open_packed(szFile, currentFrame.frame, &asset);
+    power_stage_end(TRACE_FOREGROUND);
+    if (haveForeground) {
+        compositor_push(&badgeLayers, &foregroundBand);
+    }
+    renderTimings.decode_us = esp_timer_get_time() - start;
+
+    if (toPanel) {
+        // Whether the frame has red is only known once it is drawn
+        BADGE_LOG("Refreshing epaper...\r\n");
+        log_upload_start();
+        panel_begin(false);
+    }
+
+    bool caching = haveForeground && frame_cache_store_begin(key);
+    bool keepingRtc = haveForeground && toRtc;
+    if (keepingRtc) {
+        rtc_frame_store_begin(key);
+    }
+
+    bool cancelled = false;
+    bool redFree = true;
+    const UBYTE planeCommands[2] = { DATA_START_TRANSMISSION_1, DATA_START_TRANSMISSION_2 };
+    for (int plane = 0; plane < 2 && !cancelled; plane++) {
+        if (caching && plane == 1) {
+            frame_cache_store_next_plane();
+        }
+        if (keepingRtc && plane == 1) {
+            rtc_frame_store_next_plane();
+        }
+        if (toPanel) {
+            EPD_StartPlane(planeCommands[plane]);
+        }
+        for (int row = 0; row < EPD_HEIGHT; row += bandRows) {
+            if (cancel_token_cancelled(&renderCancel)) {
+                cancelled = true;
+                break;
+            }
+            int rows = EPD_HEIGHT - row < bandRows ? EPD_HEIGHT - row : bandRows;
+            power_stage_begin(TRACE_COMPOSITE);
+            if (haveForeground && !packed_asset_read_rows(&asset, &foregroundBand, row, rows)) {
+                // Leave the background showing rather than a torn foreground
+                foregroundBand.rows = 0;
+            }
+            compositor_flatten_rows(&badgeLayers, bandBlack, bandRed, row, rows);
+            power_stage_end(TRACE_COMPOSITE);
+            const __uint8_t *band = plane == 0 ? bandBlack : bandRed;
+            if (plane == 1) {
+                redFree = redFree && EPD_PlaneBlank(band, rows);
+            }
+            if (toPanel) {
+                EPD_SendPlaneRows(band, rows);
+            }
+            if (caching) {
+                frame_cache_store_plane(band, rows * LAYER_ROW_BYTES);
+            }
+            if (keepingRtc) {
+                rtc_frame_store_plane(band, rows * LAYER_ROW_BYTES);
+            }
+        }
+        if (toPanel) {
+            EPD_EndPlane();
+        }
+    }
+    if (caching && !cancelled) {
+        frame_cache_store_end();
+    }
+    if (keepingRtc && !cancelled) {
+        bool kept = rtc_frame_store_end();
+        BADGE_LOG("RTC frame: %s\r\n", kept ? "kept" : "too big");
+    }
+    renderTimings.total_us = esp_timer_get_time() - start;
+
+    if (toPanel) {
+        // A cancelled upload is never refreshed, so the panel keeps showing
+        // the previous image
+        if (!cancelled) {
+            panel_refresh(redFree);
+        }
+    }
+
+    packed_asset_close(&asset);
+    if (cancelled) {
+        BADGE_LOG("Render cancelled after %lld us\r\n", renderTimings.total_us);
+        return;
+    }
+
+    BADGE_LOG("Band timings: background %lld us, foreground setup %lld us, render and send %lld us\r\n",
+        renderTimings.background_us, renderTimings.decode_us, renderTimings.total_us);
+    BADGE_LOG("Band memory: %i rows, frame buffers %u bytes (full frame %u bytes), min free heap %u bytes, render stack high water %u bytes\r\n",
+        bandRows, (unsigned)(5 * bandBytes), (unsigned)(5 * LAYER_PLANE_BYTES),
+        esp_get_minimum_free_heap_size(), (unsigned)uxTaskGetStackHighWaterMark(NULL));
+}
+
+void build_frame_key(const frame_plan_t *plan, frame_key_t *key)
+{
+    memset(key, 0, sizeof(frame_key_t));
+    key->effect = plan->effect;
+    key->fileIndex = plan->fileIndex;
+    key->version = FRAME_CACHE_KEY_VERSION;
+    key->seed = plan->seed;
+    key->frame = plan->frame;
+
+    struct stat st;
+    if (stat(foreground_files[plan->fileIndex], &st) == 0) {
+        key->assetSize = st.st_size;
+        key->assetTime = st.st_mtime;
+    }
+}
+
+// Stored frames are read back a plane at a time, a few rows per call
+typedef bool (*stored_plane_open_func)(int plane);
+typedef bool (*stored_plane_read_func)(uint8_t *dest, int rows);
+
+int cachedSlot;
+frame_cache_reader_t cachedReader;
+rtc_frame_reader_t rtcReader;
+
+bool cached_plane_open(int plane)
+{
+    return frame_cache_open_plane(&cachedReader, cachedSlot, plane);
+}
+
+bool cached_plane_read(uint8_t *dest, int rows)
+{
+    return frame_cache_read(&cachedReader, dest, rows * LAYER_ROW_BYTES);
+}
+
+bool rtc_plane_open(int plane)
+{
+    return rtc_frame_open_plane(&rtcReader, plane);
+}
+
+bool rtc_plane_read(uint8_t *dest, int rows)
+{
+    return rtc_frame_read(&rtcReader, dest, rows);
+}
+
+// Whether a stored frame's red plane is empty, read ahead of the upload
+bool stored_frame_red_free(stored_plane_open_func open, stored_plane_read_func read)
+{
+    POWER_SCOPE(TRACE_CACHE);
+    if (!open(1)) {
+        return false;
+    }
+    for (int row = 0; row < EPD_HEIGHT; row += RENDER_ARENA_ROWS) {
+        int rows = EPD_HEIGHT - row < RENDER_ARENA_ROWS ? EPD_HEIGHT - row : RENDER_ARENA_ROWS;
+        if (!read(renderArena.black, rows) || !EPD_PlaneBlank(renderArena.black, rows)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Stream a stored frame to the panel through the frame plane buffer
+bool show_stored_frame(stored_plane_open_func open, stored_plane_read_func read)
+{
+    log_upload_start();
+    // Only worth reading the red plane twice if it may save the refresh
+    bool redFree = fast_refresh_allowed() && stored_frame_red_free(open, read);
+    panel_begin(redFree);
+
+    const UBYTE planeCommands[2] = { DATA_START_TRANSMISSION_1, DATA_START_TRANSMISSION_2 };
+    for (int plane = 0; plane < 2; plane++) {
+        if (!EPD_StartPlane(planeCommands[plane])) {
+            continue;
+        }
+        if (!open(plane)) {
+            return false;
+        }
+        if (plane == 1) {
+            redFree = true;
+        }
+        for (int row = 0; row < EPD_HEIGHT; row += RENDER_ARENA_ROWS) {
+            if (cancel_token_cancelled(&renderCancel)) {
+                // Handled: the next image replaces this one before any refresh
+                return true;
+            }
+            int rows = EPD_HEIGHT - row < RENDER_ARENA_ROWS ? EPD_HEIGHT - row : RENDER_ARENA_ROWS;
+            power_stage_begin(TRACE_CACHE);
+            bool haveRows = read(renderArena.black, rows);
+            power_stage_end(TRACE_CACHE);
+            if (!haveRows) {
+                return false;
+            }
+            if (plane == 1) {
+                redFree = redFree && EPD_PlaneBlank(renderArena.black, rows);
+            }
+            EPD_SendPlaneRows(renderArena.black, rows);
+        }
+        EPD_EndPlane();
+    }
+
+    panel_refresh(redFree);
+    return true;
+}
+
+bool show_cached_frame(int slot)
+{
+    BADGE_LOG("Refreshing epaper from frame cache slot %i...\r\n", slot);
+    cachedSlot = slot;
+    return show_stored_frame(cached_plane_open, cached_plane_read);
+}
+
+bool show_rtc_frame()
+{
+    BADGE_LOG("Refreshing epaper from RTC memory...\r\n");
+    return show_stored_frame(rtc_plane_open, rtc_plane_read);
+}
+
+// Copy a frame from the flash cache into RTC memory
+void keep_cached_frame_in_rtc(int slot, const frame_key_t *key)
+{
+    rtc_frame_store_begin(key);
+    cachedSlot = slot;
+    for (int plane = 0; plane < 2; plane++) {
+        if (plane == 1) {
+            rtc_frame_store_next_plane();
+        }
+        if (!cached_plane_open(plane)) {
+            return;
+        }
+        for (int row = 0; row < EPD_HEIGHT; row += RENDER_ARENA_ROWS) {
+            int rows = EPD_HEIGHT - row < RENDER_ARENA_ROWS ? EPD_HEIGHT - row : RENDER_ARENA_ROWS;
+            if (!cached_plane_read(renderArena.black, rows)) {
+                return;
+            }
+            rtc_frame_store_plane(renderArena.black, rows * LAYER_ROW_BYTES);
+        }
+    }
+    bool kept = rtc_frame_store_end();
+    BADGE_LOG("RTC frame: %s\r\n", kept ? "kept" : "too big");
+}
+
+// Render currentFrame and store it in the frame cache, optionally sending
+// it to the panel as it goes and keeping it in RTC memory
+void render_frame(const frame_key_t *key, bool toPanel, bool toRtc)
+{
+    int64_t start = esp_timer_get_time();
+    if (BADGE_BAND_ROWS > 0) {
+        render_banded(key, toPanel, toRtc);
+    } else {
+        render_full_frame(key, toPanel, toRtc);
+    }
+    if (!toPanel && !cancel_token_cancelled(&renderCancel)) {
+        lastRenderMs = (esp_timer_get_time() - start) / 1000;
+    }
+}
+
+extern "C" void render_task(void *params)
+{
+    boot_profile_render();
+    trace_memory("render start");
+    frame_key_t key;
+    build_frame_key(&currentFrame, &key);
+
+    if (rtc_frame_matches(&key) && show_rtc_frame()) {
+        // Nothing to render, decode or read from flash
+    } else {
+        int slot = frame_cache_init() ? frame_cache_find(&key) : -1;
+        if (slot < 0 || !show_cached_frame(slot)) {
+            render_frame(&key, true, false);
+        }
+    }
+    frame_cache_report();
+    foreground_cache_report();
+    trace_memory("render end");
 
     xEventGroupSetBits(render_event_group, RENDER_EVENT_UPDATE_COMPLETE);
 
     vTaskDelete(NULL);
 }
 
+int64_t prerenderDeadline = 0;
+
+// Render the planned frames into the frame cache while the keep-alive load
+// runs.  A frame is only started if, going by the last render, it will be
+// finished before prerenderDeadline, or while the panel is still
+// refreshing: the badge can't sleep until that ends anyway, so work that
+// overlaps it costs no extra time awake.
+extern "C" void prerender_task(void *params)
+{
+    int64_t start = trace_now_us();
+    frame_plan_t *plans[2] = { &nextAdvanceFrame, &nextAutoFrame };
+
+    bool cancelled = false;
+    if (frame_cache_init()) {
+        for (int i = 0; i < 2 && !cancelled; i++) {
+            int64_t expectedEnd = esp_timer_get_time() + (int64_t)lastRenderMs * 1000;
+            if (expectedEnd > prerenderDeadline && !panel_session_busy()) {
+                BADGE_LOG("Prerender: no time for frame %i (needs %u ms)\r\n", i, lastRenderMs);
+                break;
+            }
+            frame_key_t key;
+            build_frame_key(plans[i], &key);
+            // The button frame is the one someone is waiting for, so it is
+            // also kept in RTC memory, if that has room for a frame
+            bool toRtc = RTC_FRAME_ENABLED && plans[i] == &nextAdvanceFrame;
+            int slot = frame_cache_peek(&key);
+            if (slot >= 0) {
+                if (toRtc && !rtc_frame_matches(&key)) {
+                    keep_cached_frame_in_rtc(slot, &key);
+                }
+                continue;
+            }
+            BADGE_LOG("Prerender: %s, image %u, effect %i, seed %u\r\n",
+                foreground_files[plans[i]->fileIndex], plans[i]->frame, plans[i]->effect, plans[i]->seed);
+            currentFrame = *plans[i];
+            render_frame(&key, false, toRtc);
+            cancelled = cancel_token_cancelled(&renderCancel);
+        }
+    }
+    // A button press wants the panel instead; try again on a later wake
+    framePlansRendered = !cancelled;
+    trace_add(TRACE_PRERENDER, trace_now_us() - start);
+    trace_memory("prerender end");
+
+    xEventGroupSetBits(render_event_group, RENDER_EVENT_PRERENDER_COMPLETE);
+
+    vTaskDelete(NULL);
+}
+
 #define BADGE_ADVANCE_BUTTON_PIN 37
 
-volatile bool badge_advance_pressed = false;
+input_queue_t advanceQueue;
 
 static void IRAM_ATTR gpio_isr_handler(void* arg)
 {
     uint32_t gpio_num = (uint32_t) arg;
     if ((gpio_num) == BADGE_ADVANCE_BUTTON_PIN) {
-        badge_advance_pressed = true;
+        int64_t now = esp_timer_get_time();
+        if (input_queue_edge(&advanceQueue, now, gpio_get_level((gpio_num_t)BADGE_ADVANCE_BUTTON_PIN))) {
+            cancel_token_cancel(&renderCancel, now);
+        }
     }
 }
 
-extern "C" int app_main()
+// True if the advance button is still down BADGE_BENCH_HOLD_MS into boot.
+// A press that woke the badge is normally released well before that.
+bool button_held_for_bench()
 {
-    printf("We're awake!\r\n");
+    for (int held = 0; held < BADGE_BENCH_HOLD_MS; held += 10) {
+        if (gpio_get_level((gpio_num_t)BADGE_ADVANCE_BUTTON_PIN) != 0) {
+            return false;
+        }
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    return BADGE_BENCH_HOLD_MS > 0;
+}
 
-    bool badge_advance = false;
+extern "C" int app_main()
+{
+    boot_profile_app_main();
+    trace_cycle_begin();
+    event_log_init();
+    BADGE_LOG("We're awake!\r\n");
+    wake_stub_report();
+    trace_poll_console();
+    render_arena_report();
+
+    uint32_t advancePresses = 0;
     if(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0) {
-        badge_advance = true;
+        advancePresses = 1;
     }
 
     rtc_gpio_deinit((gpio_num_t)BADGE_ADVANCE_BUTTON_PIN);
 
     render_event_group = xEventGroupCreate();
+    trace_memory("boot");
 
     // --- input pins ---
     gpio_config_t io_conf;
     memset(&io_conf, 0, sizeof(io_conf));
-    //disable interrupt
-    io_conf.intr_type = (gpio_int_type_t)GPIO_PIN_INTR_NEGEDGE;
+    //interrupt on both edges, for debouncing
+    io_conf.intr_type = (gpio_int_type_t)GPIO_PIN_INTR_ANYEDGE;
     //set as output mode
     io_conf.mode = GPIO_MODE_INPUT;
     //bit mask of the pins that you want to set,e.g.GPIO18/19
@@ -361,138 +823,140 @@ extern "C" int app_main()
 
     DEV_ModuleInit();
 
+    if (button_held_for_bench()) {
+        event_log_flush();
+        printf("Advance button held, running the self-benchmark...\r\n");
+        if (init_spiffs()) {
+            self_bench_run(foreground_files, kForegroundCount);
+            destroy_spiffs();
+        }
+        // The hold was not a request for the next image
+        advancePresses = 0;
+    }
+
+    input_queue_init(&advanceQueue);
+
     //install gpio isr service
     gpio_install_isr_service(0);
     //hook isr handler for specific gpio pin
     gpio_isr_handler_add((gpio_num_t)BADGE_ADVANCE_BUTTON_PIN, gpio_isr_handler, (void*)BADGE_ADVANCE_BUTTON_PIN);
 
-    esp_pm_lock_handle_t cpu_freq_lock_handle = NULL;
-    esp_err_t ret = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "Keepalive CPU Freqency Lock", &cpu_freq_lock_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to create keepalive CPU Freqency lock!\r\n");
-    }
+    // From here on each stage holds the clock it needs, see power_policy.cpp
+    power_policy_init();
+    esp_err_t ret;
 
-    ret = esp_pm_lock_acquire(cpu_freq_lock_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to acquire keepalive CPU Freqency lock!\r\n");
+    if (background_pack_init()) {
+        BADGE_LOG("Background pack: %i backgrounds\r\n", background_pack_count());
     }
 
     start:
 
     bool doDisplayUpdate = false;
-    if(badge_advance) {
-        printf("Advance button pressed!\r\n");
-        // Rotate through the images on demand
-        fileIndex = (fileIndex + 1) % kForegroundCount;
+    if(advancePresses > 0) {
+        BADGE_LOG("Advance button pressed %u times!\r\n", advancePresses);
+        // Rotate through the images on demand.  Presses that piled up while
+        // busy fold into one jump, and only the image it lands on is drawn.
+        fileIndex = (fileIndex + advancePresses) % kForegroundCount;
+        advancePresses = 0;
+        if (framePlansValid && nextAdvanceFrame.fileIndex == fileIndex) {
+            currentFrame = nextAdvanceFrame;
+        } else {
+            currentFrame.fileIndex = fileIndex;
+            choose_frame_style(&currentFrame);
+        }
         doDisplayUpdate = true;
     } else if (sleep_intervals == 0) {
-        printf("Automatic display update now choose random image...\r\n");
-        // Select a random gif, other than the one last displayed
-        int newFileIndex = esp_random() % (kForegroundCount - 1);
-        if (newFileIndex >= fileIndex) {
-            newFileIndex++;
+        BADGE_LOG("Automatic display update now choose random image...\r\n");
+        if (framePlansValid) {
+            currentFrame = nextAutoFrame;
+        } else {
+            currentFrame.fileIndex = choose_auto_file_index();
+            choose_frame_style(&currentFrame);
         }
-        fileIndex = newFileIndex;
+        fileIndex = currentFrame.fileIndex;
         doDisplayUpdate = true;
     } else {
-        printf("Sleep intervals remaining: %i\r\n", sleep_intervals);
+        BADGE_LOG("Sleep intervals remaining: %i\r\n", sleep_intervals);
         sleep_intervals--;
     }
 
+    bool spiffs_ready = false;
     if (doDisplayUpdate) {
-        printf("Time to update display.\r\n");
-        bool spiffs_ready = init_spiffs();
+        BADGE_LOG("Time to update display.\r\n");
+        cancel_token_reset(&renderCancel);
+        spiffs_ready = init_spiffs();
+        trace_memory("spiffs mounted");
         if (spiffs_ready) {
-            xTaskCreatePinnedToCore(render_task, "Render", 32768, NULL, 1, NULL, 1);
+            xTaskCreatePinnedToCore(render_task, "Render", RENDER_TASK_STACK_SIZE, NULL, 1, NULL, 1);
         }
         sleep_intervals = 6;
-        printf("Waiting for display update...\r\n");
+        BADGE_LOG("Waiting for display update...\r\n");
         xEventGroupWaitBits(render_event_group,RENDER_EVENT_UPDATE_COMPLETE ,true,true,portMAX_DELAY);
-        printf("Display refresh completed...\r\n");
-        destroy_spiffs();
+        BADGE_LOG("Display refresh started, panel %s...\r\n",
+            panel_state_name(panel_session_state()));
+        plan_next_frames();
     }
 
-    // Ensure we are burning power for at least 500ms to prevent
-    // IP5306 from going to sleep
-    printf("Keep alive: Burning power...\r\n");
-    // Initialize NVS
-    ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK( ret );
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    tcpip_adapter_init();
-
-    wifi_init_config_t wifi_config = WIFI_INIT_CONFIG_DEFAULT();
-    ret = esp_wifi_init(&wifi_config);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "esp_wifi_init failed.\r\n");
-    }
-    ret = esp_wifi_set_storage(WIFI_STORAGE_RAM);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "esp_wifi_set_storage failed.\r\n");
-    }
-    ret = esp_wifi_set_mode(WIFI_MODE_AP);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "esp_wifi_set_mode failed.\r\n");
-    }
-    wifi_config_t ap_config = {};
-    sprintf((char *)ap_config.ap.ssid, "KIPBADGE");
-    ap_config.ap.channel = 0;
-    ap_config.ap.authmode = WIFI_AUTH_OPEN;
-    ap_config.ap.ssid_hidden = 1;
-    ap_config.ap.max_connection = 1;
-    ap_config.ap.beacon_interval = 100;
- 
-    ret = esp_wifi_set_config(WIFI_IF_AP, &ap_config);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "esp_wifi_set_config failed.\r\n");
+    // Use the keep-alive window to render the planned frames into the cache
+    bool prerendering = false;
+    if (framePlansValid && !framePlansRendered && input_queue_pending(&advanceQueue) == 0) {
+        if (!spiffs_ready) {
+            spiffs_ready = init_spiffs();
+        }
+        if (spiffs_ready) {
+            prerenderDeadline = esp_timer_get_time() + (int64_t)BADGE_PRERENDER_BUDGET_MS * 1000;
+            xTaskCreatePinnedToCore(prerender_task, "Prerender", RENDER_TASK_STACK_SIZE, NULL, 1, NULL, 1);
+            prerendering = true;
+        }
     }
-    ret = esp_wifi_set_ps(WIFI_PS_NONE);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "esp_wifi_set_ps failed.\r\n");
+    if (spiffs_ready && !prerendering) {
+        destroy_spiffs();
     }
-    ret = esp_wifi_start();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "esp_wifi_start failed.\r\n");
+
+    // Draw enough current for long enough to keep the power bank on
+    keepalive_profile_t keepAlive = { BADGE_KEEPALIVE_MS, BADGE_KEEPALIVE_MA };
+    keep_alive_begin(keep_alive_choose(&keepAlive));
+    // A button press cuts the burst short: rendering the next image keeps
+    // the load up anyway
+    for (int waited = 0; waited < keepAlive.minMs && input_queue_pending(&advanceQueue) == 0; waited += 10) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+        trace_poll_console();
     }
-    vTaskDelay(500 / portTICK_PERIOD_MS);
-    ret = esp_wifi_stop();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "esp_wifi_stop failed.\r\n");
+    // The prerender's own work is load enough, so the keep-alive load
+    // stops with its window rather than running on alongside it
+    keep_alive_end();
+    if (prerendering) {
+        // The prerender task only starts work that fits its deadline
+        xEventGroupWaitBits(render_event_group, RENDER_EVENT_PRERENDER_COMPLETE, true, true, portMAX_DELAY);
+        destroy_spiffs();
     }
 
-    ESP_ERROR_CHECK(esp_event_loop_delete_default());
-    printf("Keep alive: Done.\r\n");
-
-    if (badge_advance_pressed) {
-        printf("Advance button pressed during render, going again...\r\n");
-        badge_advance = true;
-        badge_advance_pressed = false;
+    if (input_queue_pending(&advanceQueue) > 0) {
+        BADGE_LOG("Advance button pressed during render, going again...\r\n");
+        advancePresses = input_queue_take(&advanceQueue, esp_timer_get_time(), &advancePressUs);
         goto start;
     }
 
-    ret = esp_pm_lock_release(cpu_freq_lock_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to release keepalive CPU Freqency lock!\r\n");
-    }
-
+    // Back-to-back updates reuse the panel; it only sleeps with the badge
+    panel_session_sleep();
 
-    ret = esp_pm_lock_delete(cpu_freq_lock_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to delete keepalive CPU Freqency lock!\r\n");
-    }
+    const uint64_t sleepUs = 10 * 1000 * 1000;
+    // Let the wake stub take the idle wakes between keep-alive bursts
+    wake_stub_arm(sleepUs, BADGE_KEEPALIVE_WAKES - 1);
 
-    printf("Going to sleep for 10 seconds...\r\n");
-    fflush(stdout);
+    trace_memory("sleep");
+    BADGE_LOG("Awake for %lld ms\r\n", esp_timer_get_time() / 1000);
+    power_policy_flush();
+    trace_cycle_end();
+    BADGE_LOG("Going to sleep for 10 seconds...\r\n");
+    // Whatever is still in the log ring goes out before the RAM does
+    event_log_flush();
 
     ret = esp_sleep_enable_ext0_wakeup((gpio_num_t)BADGE_ADVANCE_BUTTON_PIN, 0);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "esp_sleep_enable_ext0_wakeup failed!\r\n");
     }
-    esp_sleep_enable_timer_wakeup(10 * 1000 * 1000);
+    esp_sleep_enable_timer_wakeup(sleepUs);
     esp_deep_sleep_start();
 
     return 0;
@@ -1,7 +1,12 @@
 #ifndef BADGE_MAIN_H
 #define BADGE_MAIN_H
 
+#include <stdint.h>
+
 extern "C" int app_main();
 
+// Timer wakes left until the next refresh; also counted down by the wake stub
+extern uint8_t sleep_intervals;
+
 #endif
 
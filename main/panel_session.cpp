@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include "event_log.h"
+#include "panel_session.h"
+
+static panel_state_t state = PANEL_OFF;
+// Waveform the registers hold, valid when powered or ready
+static const EPD_LUT *configuredLut = NULL;
+
+panel_state_t panel_session_state(void)
+{
+    return state;
+}
+
+const char *panel_state_name(panel_state_t panelState)
+{
+    switch (panelState) {
+    case PANEL_OFF: return "off";
+    case PANEL_DEEP_SLEEP: return "deep sleep";
+    case PANEL_POWERED: return "powered";
+    case PANEL_READY: return "ready";
+    }
+    return "?";
+}
+
+bool panel_session_busy(void)
+{
+    return state == PANEL_READY && EPD_Busy();
+}
+
+void panel_session_begin(const EPD_LUT *lut)
+{
+    switch (state) {
+    case PANEL_OFF:
+    case PANEL_DEEP_SLEEP:
+        EPD_Reset();
+        EPD_Configure(lut);
+        EPD_PowerOn();
+        break;
+    case PANEL_POWERED:
+        if (lut != configuredLut) {
+            EPD_Configure(lut);
+        }
+        EPD_PowerOn();
+        break;
+    case PANEL_READY:
+        // Still refreshing the last image, perhaps
+        EPD_WaitUntilIdle();
+        if (lut != configuredLut) {
+            EPD_Configure(lut);
+        }
+        break;
+    }
+    if (state == PANEL_READY) {
+        BADGE_LOG("Panel ready, reused\r\n");
+    }
+    configuredLut = lut;
+    state = PANEL_READY;
+}
+
+void panel_session_refresh(void)
+{
+    EPD_StartRefresh();
+}
+
+void panel_session_idle(void)
+{
+    if (state != PANEL_READY) {
+        return;
+    }
+    EPD_WaitUntilIdle();
+    EPD_PowerOff();
+    state = PANEL_POWERED;
+}
+
+void panel_session_sleep(void)
+{
+    if (state == PANEL_OFF || state == PANEL_DEEP_SLEEP) {
+        return;
+    }
+    panel_session_idle();
+    EPD_DeepSleep();
+    state = PANEL_DEEP_SLEEP;
+}
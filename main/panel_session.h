@@ -0,0 +1,40 @@
+#ifndef BADGE_PANEL_SESSION_H
+#define BADGE_PANEL_SESSION_H
+
+#include "EPD_2in9b.h"
+
+// The panel's power state across updates.  An update starts with
+// panel_session_begin(), which only resets, configures or powers up as far
+// as the current state needs, so back-to-back updates reuse a ready panel
+// (and its RAM, letting EPD_Upload skip an unchanged red plane).  A refresh
+// runs on its own: nothing waits on the busy line until the next step that
+// needs the panel, so the caller can get on with other work meanwhile.
+
+typedef enum {
+    PANEL_OFF,          // Not touched since boot
+    PANEL_DEEP_SLEEP,   // Registers and RAM lost; only a reset wakes it
+    PANEL_POWERED,      // Awake and configured, drivers off
+    PANEL_READY,        // Drivers on and configured; may be refreshing
+} panel_state_t;
+
+panel_state_t panel_session_state(void);
+const char *panel_state_name(panel_state_t state);
+
+// True while a refresh or power change holds the busy line.  Only reads
+// the line, so other tasks can poll it to fit work into a refresh.
+bool panel_session_busy(void);
+
+// Get the panel ready to take planes for a waveform (see EPD_Init)
+void panel_session_begin(const EPD_LUT *lut);
+
+// Start a refresh of the planes sent and return straight away
+void panel_session_refresh(void);
+
+// Wait out any refresh, then turn the drivers off but keep registers and
+// RAM, for a pause between updates
+void panel_session_idle(void);
+
+// Wait out any refresh, then deep sleep, before the badge sleeps
+void panel_session_sleep(void);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef BADGE_PLACEMENT_H
+#define BADGE_PLACEMENT_H
+
+// Placement of the render hot paths.  With CONFIG_BADGE_HOT_IRAM the
+// kernel objects (background, layer, frame_codec, gif_decoder) are put in
+// IRAM, their constant tables in DRAM, by linker.lf.  BADGE_HOT_FUNC marks
+// the odd hot function in an otherwise cold file, so the inner loops never
+// stall on a flash cache miss.  The tables the kernels read all live in
+// those objects; none of the cold files has one on a hot path.
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef CONFIG_BADGE_HOT_IRAM
+#include "esp_attr.h"
+#define BADGE_HOT_FUNC IRAM_ATTR
+#else
+#define BADGE_HOT_FUNC
+#endif
+
+#endif
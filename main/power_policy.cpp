@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_pm.h"
+#include "esp_log.h"
+#include "power_policy.h"
+
+static const char *TAG = "power_policy";
+
+// Compute bound stages get the full clock.  Panel upload is DMA of whole
+// bands, so like flash I/O it only needs the APB clock.  Waiting on the
+// panel needs nothing.
+static const power_level_t stagePolicy[TRACE_PHASE_COUNT] = {
+    POWER_MIN,  // boot, over before the policy starts
+    POWER_MAX,  // spiffs
+    POWER_MAX,  // background
+    POWER_MAX,  // foreground
+    POWER_MAX,  // composite
+    POWER_APB,  // cache
+    POWER_MIN,  // panel reset
+    POWER_APB,  // spi upload
+    POWER_MIN,  // busy wait
+    POWER_MAX,  // keep-alive: the load is the point
+    POWER_APB,  // radio keep-alive: the radio is the load
+    POWER_MIN,  // prerender: its stages set their own levels
+    POWER_MIN,  // cpu 80 MHz, accounting only
+    POWER_MIN,  // cpu 40 MHz, accounting only
+};
+
+static esp_pm_lock_handle_t levelLocks[3];
+static int levelHolds[3];
+static power_level_t currentLevel = POWER_MAX;
+static int64_t levelSinceUs;
+static bool started = false;
+static portMUX_TYPE levelMux = portMUX_INITIALIZER_UNLOCKED;
+
+power_level_t power_policy_level(trace_phase_t stage)
+{
+    return stagePolicy[stage];
+}
+
+// Trace the time spent at the current level if it is about to change or
+// the cycle is ending.  Called with levelMux held.
+static void account_level(bool flush)
+{
+    power_level_t level = levelHolds[POWER_MAX] > 0 ? POWER_MAX
+        : levelHolds[POWER_APB] > 0 ? POWER_APB : POWER_MIN;
+    if (level == currentLevel && !flush) {
+        return;
+    }
+    int64_t now = trace_now_us();
+    if (currentLevel == POWER_APB) {
+        trace_add(TRACE_CPU_APB, now - levelSinceUs);
+    } else if (currentLevel == POWER_MIN) {
+        trace_add(TRACE_CPU_MIN, now - levelSinceUs);
+    }
+    currentLevel = level;
+    levelSinceUs = now;
+}
+
+void power_policy_init(void)
+{
+    esp_pm_config_esp32_t config = {};
+    config.max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+    config.min_freq_mhz = 40;
+    // Light sleep would need tickless idle and a GPIO wake for the button
+    config.light_sleep_enable = false;
+    esp_err_t ret = esp_pm_configure(&config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "esp_pm_configure failed (%s)", esp_err_to_name(ret));
+        return;
+    }
+
+    ret = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "Stage CPU max", &levelLocks[POWER_MAX]);
+    if (ret == ESP_OK) {
+        ret = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "Stage APB max", &levelLocks[POWER_APB]);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create stage PM locks (%s)", esp_err_to_name(ret));
+        return;
+    }
+
+    portENTER_CRITICAL(&levelMux);
+    levelSinceUs = trace_now_us();
+    account_level(false);
+    portEXIT_CRITICAL(&levelMux);
+    started = true;
+}
+
+void power_stage_begin(trace_phase_t stage)
+{
+    power_level_t level = stagePolicy[stage];
+    if (!started || level == POWER_MIN) {
+        return;
+    }
+    esp_pm_lock_acquire(levelLocks[level]);
+    portENTER_CRITICAL(&levelMux);
+    levelHolds[level]++;
+    account_level(false);
+    portEXIT_CRITICAL(&levelMux);
+}
+
+void power_stage_end(trace_phase_t stage)
+{
+    power_level_t level = stagePolicy[stage];
+    if (!started || level == POWER_MIN) {
+        return;
+    }
+    portENTER_CRITICAL(&levelMux);
+    levelHolds[level]--;
+    account_level(false);
+    portEXIT_CRITICAL(&levelMux);
+    esp_pm_lock_release(levelLocks[level]);
+}
+
+void power_policy_flush(void)
+{
+    if (!started) {
+        return;
+    }
+    portENTER_CRITICAL(&levelMux);
+    account_level(true);
+    portEXIT_CRITICAL(&levelMux);
+}
@@ -0,0 +1,50 @@
+#ifndef BADGE_POWER_POLICY_H
+#define BADGE_POWER_POLICY_H
+
+#include "trace.h"
+
+// CPU clock per pipeline stage.  Each stage in the trace has a level in
+// the policy table in power_policy.cpp; a stage holds the PM lock for its
+// level while it runs, and with nothing held the clock drops to the XTAL
+// minimum.  Time spent below the maximum is traced so the charge estimate
+// shows what the policy saves.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    POWER_MIN,  // XTAL, 40 MHz
+    POWER_APB,  // CPU and APB at 80 MHz
+    POWER_MAX,  // 240 MHz
+} power_level_t;
+
+// Enable frequency scaling.  Until this is called everything runs at the
+// default maximum.
+void power_policy_init(void);
+
+power_level_t power_policy_level(trace_phase_t stage);
+
+// Hold the stage's level until the matching power_stage_end.  Stages nest
+// and may run on several tasks at once; the highest level held wins.
+void power_stage_begin(trace_phase_t stage);
+void power_stage_end(trace_phase_t stage);
+
+// Trace the time at the current level so far; call before trace_cycle_end
+void power_policy_flush(void);
+
+#ifdef __cplusplus
+}
+
+class power_scope {
+public:
+    explicit power_scope(trace_phase_t stage) : stage(stage) { power_stage_begin(stage); }
+    ~power_scope() { power_stage_end(stage); }
+private:
+    trace_phase_t stage;
+};
+
+#define POWER_SCOPE(stage) power_scope powerScope(stage)
+#endif
+
+#endif
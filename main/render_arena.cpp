@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <string.h>
+#include "event_log.h"
+#include "render_arena.h"
+
+render_arena_t renderArena;
+
+void render_arena_foreground_layer(layer_t *layer)
+{
+    memset(layer, 0, sizeof(layer_t));
+    layer->black = renderArena.foregroundBlack;
+    layer->red = renderArena.foregroundRed;
+    layer->mask = renderArena.foregroundMask;
+    layer->rows = RENDER_ARENA_ROWS;
+    layer->stride = LAYER_ROW_BYTES;
+}
+
+void render_arena_report(void)
+{
+    const unsigned frame = sizeof(renderArena.black) + sizeof(renderArena.red);
+    const unsigned foreground = sizeof(renderArena.foregroundBlack)
+        + sizeof(renderArena.foregroundRed) + sizeof(renderArena.foregroundMask);
+    const unsigned scratch = sizeof(renderArena.packColumn);
+    const unsigned decoder = sizeof(renderArena.decoder);
+    const unsigned frameIndex = sizeof(renderArena.frames);
+    const unsigned stacks = RENDER_TASK_STACK_SIZE + DECODE_TASK_STACK_SIZE;
+
+    BADGE_LOG("Render RAM budget (%i rows per pass):\r\n", RENDER_ARENA_ROWS);
+    BADGE_LOG("  frame planes      %6u bytes\r\n", frame);
+    BADGE_LOG("  foreground layer  %6u bytes\r\n", foreground);
+    BADGE_LOG("  gif decoder       %6u bytes (lzw tables %i, palette %i, row buffer %i)\r\n",
+        decoder, badge_gif_decoder_t::kLzwTableBytes, badge_gif_decoder_t::kPaletteBytes,
+        badge_gif_decoder_t::kRowBufferBytes);
+    BADGE_LOG("  gif frame index   %6u bytes (%i frames)\r\n", frameIndex, FOREGROUND_MAX_FRAMES);
+    BADGE_LOG("  scratch           %6u bytes\r\n", scratch);
+    BADGE_LOG("  arena total       %6u bytes\r\n", (unsigned)sizeof(renderArena));
+    BADGE_LOG("  task stacks       %6u bytes (render %i, decode %i)\r\n",
+        stacks, RENDER_TASK_STACK_SIZE, DECODE_TASK_STACK_SIZE);
+}
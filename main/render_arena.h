@@ -0,0 +1,62 @@
+#ifndef BADGE_RENDER_ARENA_H
+#define BADGE_RENDER_ARENA_H
+
+#include <stdint.h>
+#include "GifDecoder.h"
+#include "badge_config.h"
+#include "layer.h"
+
+// Rows held by the frame and foreground planes: the whole panel, or one band
+#if BADGE_BAND_ROWS > 0
+#define RENDER_ARENA_ROWS BADGE_BAND_ROWS
+#else
+#define RENDER_ARENA_ROWS EPD_HEIGHT
+#endif
+#define RENDER_ARENA_PLANE_BYTES (RENDER_ARENA_ROWS * LAYER_ROW_BYTES)
+
+// With the decoder living in the arena the tasks only need stack for their
+// own locals, stdio and the VFS.
+#define RENDER_TASK_STACK_SIZE 6144
+#define DECODE_TASK_STACK_SIZE 4096
+
+typedef GifDecoder<EPD_HEIGHT, EPD_HEIGHT, 12> badge_gif_decoder_t;
+// Instantiated in gif_decoder.cpp
+extern template class GifDecoder<EPD_HEIGHT, EPD_HEIGHT, 12>;
+
+// Images of an animated GIF that can be reached through the frame index
+#define FOREGROUND_MAX_FRAMES 64
+
+// Everything the render pipeline needs, sized at build time and never freed.
+//
+// Ownership: render_task owns the frame planes; whoever is decoding (the
+// decode task in full-frame mode, render_task in band mode) owns the
+// decoder, the foreground planes and the scratch column until it hands the
+// finished layer over to the compositor.
+typedef struct {
+    // Composited output sent to the panel
+    uint8_t black[RENDER_ARENA_PLANE_BYTES] __attribute__((aligned(4)));
+    uint8_t red[RENDER_ARENA_PLANE_BYTES] __attribute__((aligned(4)));
+
+    // Foreground layer planes
+    uint8_t foregroundBlack[RENDER_ARENA_PLANE_BYTES] __attribute__((aligned(4)));
+    uint8_t foregroundRed[RENDER_ARENA_PLANE_BYTES] __attribute__((aligned(4)));
+    uint8_t foregroundMask[RENDER_ARENA_PLANE_BYTES] __attribute__((aligned(4)));
+
+    // One byte column of each plane, used while transcoding packed assets
+    uint8_t packColumn[3 * EPD_HEIGHT];
+
+    // Reused for every GIF; reset() rather than rebuilt
+    badge_gif_decoder_t decoder;
+    // Frame index of the last animated GIF opened
+    gif_frame_info frames[FOREGROUND_MAX_FRAMES];
+} render_arena_t;
+
+extern render_arena_t renderArena;
+
+// Point a layer at the arena's foreground planes
+void render_arena_foreground_layer(layer_t *layer);
+
+// Print the RAM budget of each render subsystem
+void render_arena_report(void);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef BADGE_RTC_BUDGET_H
+#define BADGE_RTC_BUDGET_H
+
+#include "badge_config.h"
+#include "frame_cache.h"
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+// RTC slow memory, share by share.  Each module checks the state it keeps
+// across deep sleep against its share with RTC_BUDGET_CHECK, and the shares
+// are checked against the segment here, so RTC state that does not fit
+// fails to compile instead of to link.  tools/map_report checks the linked
+// image against the real segment.
+
+#if defined(CONFIG_ESP32_ULP_COPROC_ENABLED) && CONFIG_ESP32_ULP_COPROC_ENABLED
+#define RTC_BUDGET_SEGMENT (BADGE_RTC_SLOW_BYTES - CONFIG_ESP32_ULP_COPROC_RESERVE_MEM)
+#else
+#define RTC_BUDGET_SEGMENT BADGE_RTC_SLOW_BYTES
+#endif
+
+#define RTC_BUDGET_IDF 64              // ESP-IDF's own, e.g. the RTC clock's time keeping
+#define RTC_BUDGET_APP 48              // main.cpp: frame plans and panel state
+#define RTC_BUDGET_WAKE_STUB 48
+#define RTC_BUDGET_BOOT_PROFILE 48
+#define RTC_BUDGET_ASSET_CACHE 32
+#define RTC_BUDGET_TRACE (8 + 80 * BADGE_TRACE_RECORDS)
+#define RTC_BUDGET_FRAME_CACHE (24 + 12 * FRAME_CACHE_MAX_SLOTS)
+
+#define RTC_BUDGET_OTHERS (RTC_BUDGET_IDF + RTC_BUDGET_APP + RTC_BUDGET_WAKE_STUB + RTC_BUDGET_BOOT_PROFILE \
+    + RTC_BUDGET_ASSET_CACHE + RTC_BUDGET_TRACE + RTC_BUDGET_FRAME_CACHE)
+
+// The RTC frame store, its header included: whatever is left, or room for
+// BADGE_RTC_FRAME_BYTES
+#define RTC_BUDGET_FRAME_HEADER 32
+#if BADGE_RTC_FRAME_BYTES < 0
+#define RTC_BUDGET_FRAME ((RTC_BUDGET_SEGMENT - RTC_BUDGET_OTHERS) / 4 * 4)
+#else
+#define RTC_BUDGET_FRAME (RTC_BUDGET_FRAME_HEADER + BADGE_RTC_FRAME_BYTES)
+#endif
+
+static_assert(RTC_BUDGET_FRAME >= RTC_BUDGET_FRAME_HEADER
+    && RTC_BUDGET_OTHERS + RTC_BUDGET_FRAME <= RTC_BUDGET_SEGMENT,
+    "RTC slow memory over budget: lower BADGE_RTC_FRAME_BYTES or BADGE_TRACE_RECORDS");
+
+#define RTC_BUDGET_CHECK(bytes, share) \
+    static_assert((bytes) <= (share), "RTC state over its share, see rtc_budget.h")
+
+#endif
@@ -0,0 +1,122 @@
+#include <string.h>
+#include "rtc_frame.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#endif
+
+#ifndef RTC_DATA_ATTR
+#define RTC_DATA_ATTR
+#endif
+
+#define RTC_FRAME_MAGIC 0x46435452  // "RTCF"
+
+typedef struct {
+    uint32_t magic;
+    frame_key_t key;
+    uint16_t planeBytes[2];
+    uint8_t data[RTC_FRAME_BYTES > 0 ? RTC_FRAME_BYTES : 1];
+} rtc_frame_t;
+
+RTC_DATA_ATTR static rtc_frame_t rtcFrame;
+RTC_BUDGET_CHECK(sizeof(rtcFrame), RTC_BUDGET_FRAME);
+
+typedef struct {
+    frame_encoder_t encoder;
+    uint8_t prevRow[LAYER_ROW_BYTES];
+    uint8_t deltaRow[LAYER_ROW_BYTES];
+    size_t used;
+    size_t planeStart;
+    int plane;
+    bool overflow;
+} rtc_frame_writer_t;
+
+static rtc_frame_writer_t writer;
+
+static void rtc_sink(const uint8_t *data, size_t len, void *context)
+{
+    if (writer.overflow || writer.used + len > RTC_FRAME_BYTES) {
+        writer.overflow = true;
+        return;
+    }
+    memcpy(rtcFrame.data + writer.used, data, len);
+    writer.used += len;
+}
+
+bool rtc_frame_matches(const frame_key_t *key)
+{
+    return RTC_FRAME_ENABLED && rtcFrame.magic == RTC_FRAME_MAGIC
+        && memcmp(&rtcFrame.key, key, sizeof(frame_key_t)) == 0;
+}
+
+void rtc_frame_invalidate(void)
+{
+    rtcFrame.magic = 0;
+}
+
+void rtc_frame_store_begin(const frame_key_t *key)
+{
+    // Invalid until the whole frame is in
+    rtc_frame_invalidate();
+    rtcFrame.key = *key;
+    writer.used = 0;
+    writer.planeStart = 0;
+    writer.plane = 0;
+    writer.overflow = RTC_FRAME_BYTES == 0;
+    memset(writer.prevRow, 0, sizeof(writer.prevRow));
+    frame_encoder_init(&writer.encoder, rtc_sink, NULL);
+}
+
+void rtc_frame_store_plane(const uint8_t *rows, size_t len)
+{
+    for (size_t offset = 0; offset + LAYER_ROW_BYTES <= len && !writer.overflow; offset += LAYER_ROW_BYTES) {
+        frame_delta_encode_row(rows + offset, writer.prevRow, writer.deltaRow, LAYER_ROW_BYTES);
+        frame_encoder_write(&writer.encoder, writer.deltaRow, LAYER_ROW_BYTES);
+    }
+}
+
+void rtc_frame_store_next_plane(void)
+{
+    if (writer.plane >= 2) {
+        return;
+    }
+    frame_encoder_finish(&writer.encoder);
+    rtcFrame.planeBytes[writer.plane++] = writer.used - writer.planeStart;
+    writer.planeStart = writer.used;
+    memset(writer.prevRow, 0, sizeof(writer.prevRow));
+}
+
+bool rtc_frame_store_end(void)
+{
+    rtc_frame_store_next_plane();
+    if (writer.overflow || writer.plane != 2) {
+        return false;
+    }
+    rtcFrame.magic = RTC_FRAME_MAGIC;
+    return true;
+}
+
+bool rtc_frame_open_plane(rtc_frame_reader_t *reader, int plane)
+{
+    if (rtcFrame.magic != RTC_FRAME_MAGIC) {
+        return false;
+    }
+    size_t offset = plane == 0 ? 0 : rtcFrame.planeBytes[0];
+    reader->in = rtcFrame.data + offset;
+    reader->end = reader->in + rtcFrame.planeBytes[plane];
+    memset(reader->prevRow, 0, sizeof(reader->prevRow));
+    frame_decoder_init(&reader->decoder);
+    return true;
+}
+
+bool rtc_frame_read(rtc_frame_reader_t *reader, uint8_t *dest, int rows)
+{
+    for (int row = 0; row < rows; row++) {
+        uint8_t *rowDest = dest + row * LAYER_ROW_BYTES;
+        if (frame_decoder_read(&reader->decoder, &reader->in, reader->end, rowDest, LAYER_ROW_BYTES) != LAYER_ROW_BYTES) {
+            return false;
+        }
+        frame_delta_decode_row(rowDest, reader->prevRow, LAYER_ROW_BYTES);
+    }
+    return true;
+}
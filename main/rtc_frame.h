@@ -0,0 +1,47 @@
+#ifndef BADGE_RTC_FRAME_H
+#define BADGE_RTC_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "badge_config.h"
+#include "frame_cache.h"
+#include "layer.h"
+#include "rtc_budget.h"
+
+// One prepared frame kept in RTC slow memory across deep sleep, so it can
+// be sent to the panel on wake without rendering or reading flash.  Planes
+// are row XOR-delta filtered and then PackBits coded; a frame that does not
+// code into RTC_FRAME_BYTES (see BADGE_RTC_FRAME_BYTES) is simply not kept.
+
+#define RTC_FRAME_BYTES (RTC_BUDGET_FRAME - RTC_BUDGET_FRAME_HEADER)
+
+// The smallest finished frame frame_bench codes, a foreground over the
+// plainest background.  With less room than this a store never keeps a
+// frame, so callers skip the RTC frame (and reading a cached frame back
+// for it) altogether.
+#define RTC_FRAME_MIN_BYTES 2900
+#define RTC_FRAME_ENABLED (RTC_FRAME_BYTES >= RTC_FRAME_MIN_BYTES)
+
+typedef struct {
+    frame_decoder_t decoder;
+    const uint8_t *in;
+    const uint8_t *end;
+    uint8_t prevRow[LAYER_ROW_BYTES];
+} rtc_frame_reader_t;
+
+// Whether the RTC frame holds exactly this frame
+bool rtc_frame_matches(const frame_key_t *key);
+void rtc_frame_invalidate(void);
+
+// Store a frame: black rows, then rtc_frame_store_next_plane(), then red rows.
+// len must be whole rows.  end returns false if the frame did not fit.
+void rtc_frame_store_begin(const frame_key_t *key);
+void rtc_frame_store_plane(const uint8_t *rows, size_t len);
+void rtc_frame_store_next_plane(void);
+bool rtc_frame_store_end(void);
+
+// Stream one plane (0 black, 1 red) back a few rows at a time
+bool rtc_frame_open_plane(rtc_frame_reader_t *reader, int plane);
+bool rtc_frame_read(rtc_frame_reader_t *reader, uint8_t *dest, int rows);
+
+#endif
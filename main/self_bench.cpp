@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "background.h"
+#include "foreground.h"
+#include "layer.h"
+#include "placement.h"
+#include "render_arena.h"
+#include "self_bench.h"
+#include "trace.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#include "xtensa/hal.h"
+#include "EPD_2in9b.h"
+#include "boot_profile.h"
+#include "panel_session.h"
+#else
+extern "C" size_t host_heap_in_use(void);
+#endif
+
+static uint32_t bench_cycles(void)
+{
+#ifdef ESP_PLATFORM
+    return xthal_get_ccount();
+#elif defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static unsigned bench_heap(void)
+{
+#ifdef ESP_PLATFORM
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#else
+    return host_heap_in_use();
+#endif
+}
+
+typedef struct {
+    uint32_t cycles;
+    int64_t us;
+} bench_clock_t;
+
+static void bench_start(bench_clock_t *clock)
+{
+    clock->us = trace_now_us();
+    clock->cycles = bench_cycles();
+}
+
+static void bench_row(const bench_clock_t *clock, const char *stage, const char *item, unsigned bytes)
+{
+    uint32_t cycles = bench_cycles() - clock->cycles;
+    int64_t us = trace_now_us() - clock->us;
+    printf("bench,%s,%s,%u,%u,%u,%u\r\n", stage, item, cycles, (unsigned)us, bytes, bench_heap());
+}
+
+// ---- Panel ----
+// On the host the panel is a sink that only reads the bytes
+
+#ifdef ESP_PLATFORM
+
+static void panel_begin(void)
+{
+    panel_session_begin(NULL);
+}
+
+static void panel_start_plane(int plane)
+{
+    EPD_StartPlane(plane == 0 ? DATA_START_TRANSMISSION_1 : DATA_START_TRANSMISSION_2);
+}
+
+static void panel_send_rows(const uint8_t *rows, int count)
+{
+    EPD_SendPlaneRows(rows, count);
+}
+
+static void panel_end_plane(void)
+{
+    EPD_EndPlane();
+}
+
+// Timed to the end of the refresh, which the session would not wait for
+static void panel_refresh(void)
+{
+    panel_session_refresh();
+    panel_session_sleep();
+}
+
+#else
+
+static volatile uint8_t panelSink;
+
+static void panel_begin(void) {}
+static void panel_start_plane(int plane) {}
+
+static void panel_send_rows(const uint8_t *rows, int count)
+{
+    for (int i = 0; i < count * LAYER_ROW_BYTES; i++) {
+        panelSink = rows[i];
+    }
+}
+
+static void panel_end_plane(void) {}
+static void panel_refresh(void) {}
+
+#endif
+
+// ---- Steps ----
+
+static void bench_backgrounds(void)
+{
+    for (int effect = 0; effect < BACKGROUND_EFFECT_COUNT; effect++) {
+        char item[16];
+        snprintf(item, sizeof(item), "effect%i", effect);
+        bench_clock_t clock;
+        bench_start(&clock);
+        background_apply(effect, SELF_BENCH_SEED);
+        for (int row = 0; row < EPD_HEIGHT; row += RENDER_ARENA_ROWS) {
+            int rows = EPD_HEIGHT - row < RENDER_ARENA_ROWS ? EPD_HEIGHT - row : RENDER_ARENA_ROWS;
+            background_render_rows(renderArena.black, renderArena.red, row, rows);
+        }
+        bench_row(&clock, "background", item, 2 * LAYER_PLANE_BYTES);
+    }
+}
+
+static const char *asset_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static bool load_asset(const char *gifPath)
+{
+#if BADGE_BAND_ROWS > 0
+    // Band mode reads the packed asset a band at a time
+    packed_asset_t asset = {};
+    layer_t band;
+    render_arena_foreground_layer(&band);
+    bool ok = foreground_open_packed(gifPath, 0, &asset);
+    for (int row = 0; ok && row < EPD_HEIGHT; row += RENDER_ARENA_ROWS) {
+        int rows = EPD_HEIGHT - row < RENDER_ARENA_ROWS ? EPD_HEIGHT - row : RENDER_ARENA_ROWS;
+        ok = packed_asset_read_rows(&asset, &band, row, rows);
+    }
+    packed_asset_close(&asset);
+    return ok;
+#else
+    layer_t layer;
+    render_arena_foreground_layer(&layer);
+    return foreground_load(gifPath, 0, &layer, NULL);
+#endif
+}
+
+// Each asset is loaded cold, which decodes and caches it, then warm
+static void bench_assets(const char *const *assets, int assetCount)
+{
+    for (int i = 0; i < assetCount; i++) {
+        struct stat st;
+        unsigned size = stat(assets[i], &st) == 0 ? (unsigned)st.st_size : 0;
+        foreground_cache_invalidate(assets[i]);
+        bench_clock_t clock;
+        bench_start(&clock);
+        bool ok = load_asset(assets[i]);
+        bench_row(&clock, ok ? "foreground" : "foreground-failed", asset_name(assets[i]), size);
+        bench_start(&clock);
+        ok = load_asset(assets[i]);
+        bench_row(&clock, ok ? "foreground-warm" : "foreground-failed", asset_name(assets[i]), size);
+#ifndef ESP_PLATFORM
+        // Leave the host's SPIFFS image as it was
+        foreground_cache_invalidate(assets[i]);
+#endif
+    }
+}
+
+// Upload the effect 0 background a band at a time; only the sends are timed
+static void bench_upload(void)
+{
+    bench_clock_t clock;
+    bench_start(&clock);
+    panel_begin();
+    bench_row(&clock, "panel", "init", 0);
+
+    uint32_t sendCycles = 0;
+    int64_t sendUs = 0;
+    background_apply(0, SELF_BENCH_SEED);
+    for (int plane = 0; plane < 2; plane++) {
+        panel_start_plane(plane);
+        for (int row = 0; row < EPD_HEIGHT; row += RENDER_ARENA_ROWS) {
+            int rows = EPD_HEIGHT - row < RENDER_ARENA_ROWS ? EPD_HEIGHT - row : RENDER_ARENA_ROWS;
+            background_render_rows(renderArena.black, renderArena.red, row, rows);
+            bench_start(&clock);
+            panel_send_rows(plane == 0 ? renderArena.black : renderArena.red, rows);
+            sendCycles += bench_cycles() - clock.cycles;
+            sendUs += trace_now_us() - clock.us;
+        }
+        panel_end_plane();
+    }
+    printf("bench,%s,%s,%u,%u,%u,%u\r\n", "panel", "upload", sendCycles, (unsigned)sendUs,
+        (unsigned)(2 * LAYER_PLANE_BYTES), bench_heap());
+
+    bench_start(&clock);
+    panel_refresh();
+    bench_row(&clock, "panel", "refresh", 0);
+}
+
+// Boot stage averages for the profile this build was made with; the other
+// profile's come from a run of the other build
+static void bench_boot(void)
+{
+#ifdef ESP_PLATFORM
+    printf("bench,config,%s,0,0,0,%u\r\n", boot_profile_name(), bench_heap());
+    for (int stage = 0; stage < BOOT_STAGE_COUNT; stage++) {
+        if (boot_stage_samples((boot_stage_t)stage) > 0) {
+            printf("bench,boot,%s,0,%u,0,%u\r\n", boot_stage_name((boot_stage_t)stage),
+                boot_stage_average_us((boot_stage_t)stage), bench_heap());
+        }
+    }
+#endif
+}
+
+void self_bench_run(const char *const *assets, int assetCount)
+{
+    printf("bench,stage,item,cycles,us,bytes,heap\r\n");
+#if !defined(ESP_PLATFORM)
+    const char *placement = "host";
+#elif defined(CONFIG_BADGE_HOT_IRAM)
+    const char *placement = "hot-iram";
+#else
+    const char *placement = "hot-flash";
+#endif
+    printf("bench,config,%s,0,0,0,%u\r\n", placement, bench_heap());
+    bench_backgrounds();
+    bench_assets(assets, assetCount);
+    bench_upload();
+    bench_boot();
+    printf("bench,done\r\n");
+}
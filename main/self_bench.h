@@ -0,0 +1,18 @@
+#ifndef BADGE_SELF_BENCH_H
+#define BADGE_SELF_BENCH_H
+
+// Self-benchmark, entered by holding the advance button through boot.
+// Renders every background effect, decodes every asset and times a panel
+// upload, all with a fixed seed, and prints one CSV row per step:
+//
+//   bench,<stage>,<item>,<cycles>,<us>,<bytes>,<heap>
+//
+// heap is free bytes on the badge and bytes in use on the host.  The host
+// tool tools/self_bench runs the same steps against a mock panel, so its
+// table lines up with the badge's.
+
+#define SELF_BENCH_SEED 0x5EEDu
+
+void self_bench_run(const char *const *assets, int assetCount);
+
+#endif
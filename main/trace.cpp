@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include "event_log.h"
+#include "render_arena.h"
+#include "rtc_budget.h"
+#include "trace.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#else
+#include <chrono>
+
+// Provided by the allocation hooks in tools/host
+extern "C" size_t host_heap_in_use(void);
+extern "C" size_t host_heap_peak(void);
+#endif
+
+#ifndef RTC_DATA_ATTR
+#define RTC_DATA_ATTR
+#endif
+
+#define TRACE_MAGIC 0x43525442  // "BTRC"
+
+// Assumed supply current while awake at the full CPU clock with nothing
+// extra going on, and what each phase draws on top of that.  Phases that
+// overlap (the decode on core 0 runs alongside the background on core 1)
+// only add their extra; a slower clock draws less.
+#define TRACE_AWAKE_MA 45.0f
+
+typedef struct {
+    const char *name;
+    float extraMa;
+} trace_phase_info_t;
+
+static const trace_phase_info_t phaseInfo[TRACE_PHASE_COUNT] = {
+    { "boot",       0.0f },
+    { "spiffs",     0.0f },
+    { "background", 0.0f },
+    { "foreground", 20.0f },
+    { "composite",  0.0f },
+    { "cache",      15.0f },
+    { "reset",      0.0f },
+    { "spi",        5.0f },
+    { "busy",       8.0f },
+    { "keepalive",  20.0f },
+    { "radio",      95.0f },
+    { "prerender",  0.0f },
+    { "cpu80",      -15.0f },
+    { "cpu40",      -22.0f },
+};
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t awakeUs;
+    uint32_t phaseUs[TRACE_PHASE_COUNT];
+    // Lowest values seen at any memory mark this cycle
+    uint32_t minHeapFree;
+    uint32_t minLargestBlock;
+    uint32_t minStackFree;
+} trace_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cycles;
+    trace_record_t records[BADGE_TRACE_RECORDS];
+} trace_ring_t;
+
+RTC_DATA_ATTR static trace_ring_t traceRing;
+RTC_BUDGET_CHECK(sizeof(traceRing), RTC_BUDGET_TRACE);
+
+static trace_record_t *current = NULL;
+static int64_t cycleStartUs;
+
+int64_t trace_now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void trace_add(trace_phase_t phase, int64_t us)
+{
+    if (current != NULL) {
+        current->phaseUs[phase] += (uint32_t)us;
+    }
+}
+
+#ifdef ESP_PLATFORM
+static void keep_min(uint32_t *min, uint32_t value)
+{
+    if (value < *min) {
+        *min = value;
+    }
+}
+#endif
+
+void trace_memory(const char *stage)
+{
+#ifdef ESP_PLATFORM
+    uint32_t heapFree = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    uint32_t heapMin = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    // In bytes: ESP-IDF stacks are arrays of uint8_t
+    uint32_t stackFree = uxTaskGetStackHighWaterMark(NULL);
+    // The task's name goes with the task, so the event keeps a copy
+    event_log_text_t task;
+    event_log_text(&task, pcTaskGetTaskName(NULL));
+    BADGE_LOG("Memory at %s (%s): heap free %u, min %u, largest block %u, stack headroom %u\r\n",
+        stage, task.chars, heapFree, heapMin, largest, stackFree);
+    if (current != NULL) {
+        keep_min(&current->minHeapFree, heapMin);
+        keep_min(&current->minLargestBlock, largest);
+        keep_min(&current->minStackFree, stackFree);
+    }
+#else
+    BADGE_LOG("Memory at %s: heap in use %u, peak %u\n",
+        stage, (unsigned)host_heap_in_use(), (unsigned)host_heap_peak());
+#endif
+}
+
+void trace_cycle_begin(void)
+{
+    if (traceRing.magic != TRACE_MAGIC) {
+        memset(&traceRing, 0, sizeof(traceRing));
+        traceRing.magic = TRACE_MAGIC;
+    }
+    current = &traceRing.records[traceRing.cycles % BADGE_TRACE_RECORDS];
+    memset(current, 0, sizeof(trace_record_t));
+    current->sequence = traceRing.cycles++;
+    current->minHeapFree = UINT32_MAX;
+    current->minLargestBlock = UINT32_MAX;
+    current->minStackFree = UINT32_MAX;
+    cycleStartUs = trace_now_us();
+}
+
+// Charge drawn by one cycle while awake, in microamp hours
+static float record_charge_uah(const trace_record_t *record)
+{
+    float maUs = TRACE_AWAKE_MA * record->awakeUs;
+    for (int phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+        maUs += phaseInfo[phase].extraMa * record->phaseUs[phase];
+    }
+    return maUs / 3.6e6f;
+}
+
+void trace_cycle_end(void)
+{
+    if (current == NULL) {
+        return;
+    }
+    current->awakeUs = current->phaseUs[TRACE_BOOT] + (uint32_t)(trace_now_us() - cycleStartUs);
+    BADGE_LOG("Trace: cycle %u awake %u ms, about %.1f uAh\r\n",
+        current->sequence, current->awakeUs / 1000, record_charge_uah(current));
+    current = NULL;
+}
+
+void trace_dump(void)
+{
+    uint32_t count = traceRing.cycles < BADGE_TRACE_RECORDS ? traceRing.cycles : BADGE_TRACE_RECORDS;
+    printf("Trace: last %u of %u cycles, times in ms, charge assumes %.0f mA awake plus per phase extra\r\n",
+        count, traceRing.cycles, TRACE_AWAKE_MA);
+    printf("%6s %7s", "cycle", "awake");
+    for (int phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+        printf(" %10s", phaseInfo[phase].name);
+    }
+    printf(" %8s %8s %8s %6s\r\n", "uAh", "heapmin", "largest", "stack");
+
+    for (uint32_t i = traceRing.cycles - count; i < traceRing.cycles; i++) {
+        const trace_record_t *record = &traceRing.records[i % BADGE_TRACE_RECORDS];
+        printf("%6u %7u", record->sequence, record->awakeUs / 1000);
+        for (int phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+            printf(" %10u", record->phaseUs[phase] / 1000);
+        }
+        printf(" %8.1f %8u %8u %6u\r\n", record_charge_uah(record),
+            record->minHeapFree, record->minLargestBlock, record->minStackFree);
+    }
+    render_arena_report();
+}
+
+void trace_poll_console(void)
+{
+#ifdef ESP_PLATFORM
+    // The console is non-blocking until a UART driver is installed
+    int c = fgetc(stdin);
+    clearerr(stdin);
+    if (c == 't' || c == 'T') {
+        trace_dump();
+    }
+#endif
+}
@@ -0,0 +1,69 @@
+#ifndef BADGE_TRACE_H
+#define BADGE_TRACE_H
+
+#include <stdint.h>
+#include "badge_config.h"
+
+// Where the time and memory go on each wake.  Time spent in each phase is
+// summed into one record per wake cycle, along with the lowest heap and
+// stack headroom seen at the memory marks; the last BADGE_TRACE_RECORDS
+// records live in RTC memory, survive deep sleep and can be dumped over the
+// console with an estimate of the charge each cycle drew.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    TRACE_BOOT,         // Wake to app_main
+    TRACE_SPIFFS,       // Mount
+    TRACE_BACKGROUND,   // Procedural background
+    TRACE_FOREGROUND,   // GIF decode, transcode and packed reads (core 0 when full frame)
+    TRACE_COMPOSITE,
+    TRACE_CACHE,        // Frame cache flash I/O
+    TRACE_PANEL_RESET,
+    TRACE_SPI_UPLOAD,
+    TRACE_BUSY_WAIT,    // Waiting on the panel, mostly the refresh
+    TRACE_KEEPALIVE,    // Compute keep-alive load, see keep_alive.h
+    TRACE_RADIO,        // Radio keep-alive load
+    TRACE_PRERENDER,    // Wall time; its work is also in the phases above
+    TRACE_CPU_APB,      // Wall time with the CPU clock at 80 MHz, see power_policy.h
+    TRACE_CPU_MIN,      // ... and at 40 MHz
+    TRACE_PHASE_COUNT
+} trace_phase_t;
+
+int64_t trace_now_us(void);
+void trace_add(trace_phase_t phase, int64_t us);
+
+// Record heap and calling task stack headroom at a pipeline stage
+// boundary.  On the host the heap figures come from the allocation hooks
+// in tools/host and there is no stack figure.  The stage is logged with
+// BADGE_LOG, so it has to be a literal.
+void trace_memory(const char *stage);
+
+// Start and finish the record for this wake
+void trace_cycle_begin(void);
+void trace_cycle_end(void);
+
+// Print every record in the ring with its estimated charge
+void trace_dump(void);
+// Dump if 't' has been typed on the console
+void trace_poll_console(void);
+
+#ifdef __cplusplus
+}
+
+// Adds its own lifetime to a phase
+class trace_scope {
+public:
+    explicit trace_scope(trace_phase_t phase) : phase(phase), start(trace_now_us()) {}
+    ~trace_scope() { trace_add(phase, trace_now_us() - start); }
+private:
+    trace_phase_t phase;
+    int64_t start;
+};
+
+#define TRACE_SCOPE(phase) trace_scope traceScope(phase)
+#endif
+
+#endif
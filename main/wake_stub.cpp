@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include "esp_attr.h"
+#include "esp_clk.h"
+#include "esp_sleep.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/timer_group_reg.h"
+#include "event_log.h"
+#include "main.h"
+#include "rtc_budget.h"
+#include "trace.h"
+#include "wake_stub.h"
+
+// Everything the stub touches has to live in RTC memory
+RTC_DATA_ATTR static uint64_t stubSleepTicks;   // Sleep period in RTC slow clock ticks
+RTC_DATA_ATTR static uint8_t stubIdleWakes;     // Timer wakes the stub may still absorb
+RTC_DATA_ATTR static uint32_t stubWakes;        // Absorbed since the last boot
+RTC_DATA_ATTR static uint64_t stubBusyTicks;    // Time spent awake in the stub
+RTC_DATA_ATTR static uint64_t stubWakeTicks;    // RTC time of the latest wake
+RTC_DATA_ATTR static uint64_t stubTargetTicks;  // Timer target it was due at, 0 if not the timer
+RTC_BUDGET_CHECK(5 * sizeof(uint64_t) + sizeof(stubIdleWakes) + sizeof(stubWakes), RTC_BUDGET_WAKE_STUB);
+
+static inline RTC_IRAM_ATTR uint64_t stub_rtc_ticks()
+{
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
+    }
+    SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
+    uint64_t ticks = READ_PERI_REG(RTC_CNTL_TIME0_REG);
+    ticks |= ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG)) << 32;
+    return ticks;
+}
+
+// Runs from RTC fast memory before the bootloader.  Only ROM code and RTC
+// memory are usable here: no flash, no heap, no printf.
+extern "C" void RTC_IRAM_ATTR esp_wake_deep_sleep(void)
+{
+    uint64_t wakeTicks = stub_rtc_ticks();
+    stubWakeTicks = wakeTicks;
+
+    uint32_t cause = REG_GET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_CAUSE);
+    stubTargetTicks = 0;
+    if (cause & RTC_TIMER_TRIG_EN) {
+        stubTargetTicks = READ_PERI_REG(RTC_CNTL_SLP_TIMER0_REG)
+            | ((uint64_t)(READ_PERI_REG(RTC_CNTL_SLP_TIMER1_REG) & 0xFFFF) << 32);
+    }
+    if (!(cause & RTC_TIMER_TRIG_EN) || stubIdleWakes == 0 || sleep_intervals == 0) {
+        // Button, refresh or keep-alive due: boot normally.  The default
+        // stub's flash delay (CONFIG_ESP32_DEEP_SLEEP_WAKEUP_DELAY) is only
+        // paid by wakes that go on to read flash.
+        esp_default_wake_deep_sleep();
+        return;
+    }
+
+    sleep_intervals--;
+    stubIdleWakes--;
+    stubWakes++;
+
+    // Wake again one period after this wake
+    uint64_t target = wakeTicks + stubSleepTicks;
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER0_REG, (uint32_t)target);
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER1_REG, (uint32_t)(target >> 32));
+
+    REG_WRITE(TIMG_WDTFEED_REG(0), 1);
+    stubBusyTicks += stub_rtc_ticks() - wakeTicks;
+
+    REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t)&esp_wake_deep_sleep);
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    while (true) {
+        // Sleep starts within a few cycles
+    }
+}
+
+void wake_stub_arm(uint64_t sleepUs, uint8_t idleWakes)
+{
+    stubSleepTicks = rtc_time_us_to_slowclk(sleepUs, esp_clk_slowclk_cal_get());
+    stubIdleWakes = idleWakes;
+    stubWakes = 0;
+    stubBusyTicks = 0;
+}
+
+void wake_stub_boot_ticks(uint64_t *wakeTicks, uint64_t *targetTicks)
+{
+    *wakeTicks = stubWakeTicks;
+    *targetTicks = stubTargetTicks;
+}
+
+void wake_stub_report(void)
+{
+    uint32_t cal = esp_clk_slowclk_cal_get();
+    uint64_t bootUs = 0;
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED) {
+        bootUs = rtc_time_slowclk_to_us(rtc_time_get() - stubWakeTicks, cal);
+    }
+    uint64_t busyUs = rtc_time_slowclk_to_us(stubBusyTicks, cal);
+    trace_add(TRACE_BOOT, bootUs);
+    BADGE_LOG("Wake stub: %u idle wakes absorbed (%llu us awake in total), wake to app_main %llu us\r\n",
+        stubWakes, busyUs, bootUs);
+}
@@ -0,0 +1,22 @@
+#ifndef BADGE_WAKE_STUB_H
+#define BADGE_WAKE_STUB_H
+
+#include <stdint.h>
+
+// Deep sleep wake stub.  Idle timer wakes only count down sleep_intervals,
+// so the stub does that straight from RTC memory and goes back to sleep
+// without booting.  The app boots only for a refresh, a button press or a
+// keep-alive burst.
+
+// Call just before esp_deep_sleep_start().  The stub may absorb up to
+// idleWakes timer wakes, each sleepUs long, before the next full boot.
+void wake_stub_arm(uint64_t sleepUs, uint8_t idleWakes);
+
+// RTC slow clock ticks of the wake that booted the app, and of the timer
+// target it was due at (0 if something other than the timer woke it)
+void wake_stub_boot_ticks(uint64_t *wakeTicks, uint64_t *targetTicks);
+
+// Print what the stub did since the last boot and how long waking took
+void wake_stub_report(void);
+
+#endif
@@ -0,0 +1,143 @@
+// Checks the band-buffered render path against the full-frame one: every
+// asset under every effect is flattened a band at a time, the way
+// render_banded() sends it, and has to come out byte for byte the same as
+// the whole frame.  Band heights include ones that leave a short last band,
+// and the packed asset is read both as band mode transcodes it (by column)
+// and as foreground_load() saves it (by row).
+//
+//   make -C tools && tools/band_check [spiffs_image]
+
+#include <stdio.h>
+#include <string.h>
+#include "background.h"
+#include "foreground.h"
+#include "layer.h"
+#include "render_arena.h"
+
+#define SEEDS_PER_EFFECT 2
+
+static const char *assets[] = {
+    "dino.gif", "youtube.gif", "twitter.gif", "namebottom.gif",
+    "mozillamr.gif", "fxrlogo.gif", "github.gif"
+};
+static const int kAssetCount = sizeof(assets) / sizeof(assets[0]);
+
+// 8 and 24 divide the panel's 264 rows; the others leave a short last band
+static const int bandHeights[] = { 1, 7, 8, 24, 50, 100, 263, EPD_HEIGHT };
+static const int kBandHeightCount = sizeof(bandHeights) / sizeof(bandHeights[0]);
+
+static uint8_t fullBlack[LAYER_PLANE_BYTES];
+static uint8_t fullRed[LAYER_PLANE_BYTES];
+static uint8_t bandedPlanes[2][LAYER_PLANE_BYTES];
+
+static uint8_t bandBlack[LAYER_PLANE_BYTES];
+static uint8_t bandRed[LAYER_PLANE_BYTES];
+static uint8_t foregroundBlack[LAYER_PLANE_BYTES];
+static uint8_t foregroundRed[LAYER_PLANE_BYTES];
+static uint8_t foregroundMask[LAYER_PLANE_BYTES];
+
+static int failures = 0;
+static int checks = 0;
+
+static void render_full(layer_t *foreground)
+{
+    compositor_t compositor;
+    layer_t background;
+    compositor_init(&compositor);
+    layer_init_procedural(&background, background_render_rows);
+    compositor_push(&compositor, &background);
+    compositor_push(&compositor, foreground);
+    compositor_flatten(&compositor, fullBlack, fullRed);
+}
+
+// Both planes, each drawn band by band from the top as render_banded does
+static bool render_bands(packed_asset_t *asset, int bandRows)
+{
+    layer_t background;
+    layer_t band = {};
+    band.black = foregroundBlack;
+    band.red = foregroundRed;
+    band.mask = foregroundMask;
+    layer_init_procedural(&background, background_render_rows);
+
+    for (int plane = 0; plane < 2; plane++) {
+        for (int row = 0; row < EPD_HEIGHT; row += bandRows) {
+            int rows = EPD_HEIGHT - row < bandRows ? EPD_HEIGHT - row : bandRows;
+            if (!packed_asset_read_rows(asset, &band, row, rows)) {
+                return false;
+            }
+            compositor_t compositor;
+            compositor_init(&compositor);
+            compositor_push(&compositor, &background);
+            compositor_push(&compositor, &band);
+            compositor_flatten_rows(&compositor, bandBlack, bandRed, row, rows);
+            memcpy(bandedPlanes[plane] + row * LAYER_ROW_BYTES, plane == 0 ? bandBlack : bandRed,
+                rows * LAYER_ROW_BYTES);
+        }
+    }
+    return true;
+}
+
+static void check_asset(const char *path, int frame, const char *layout)
+{
+    layer_t foreground;
+    render_arena_foreground_layer(&foreground);
+    if (!foreground_decode(path, frame, &foreground, NULL)) {
+        printf("FAIL %s frame %i: could not decode\r\n", path, frame);
+        failures++;
+        return;
+    }
+    for (int effect = 0; effect < BACKGROUND_EFFECT_COUNT; effect++) {
+        for (uint32_t seed = 0; seed < SEEDS_PER_EFFECT; seed++) {
+            background_apply(effect, seed);
+            render_full(&foreground);
+            for (int i = 0; i < kBandHeightCount; i++) {
+                packed_asset_t asset = {};
+                bool ok = foreground_open_packed(path, frame, &asset) && render_bands(&asset, bandHeights[i]);
+                packed_asset_close(&asset);
+                checks++;
+                if (!ok || memcmp(bandedPlanes[0], fullBlack, LAYER_PLANE_BYTES) != 0
+                    || memcmp(bandedPlanes[1], fullRed, LAYER_PLANE_BYTES) != 0) {
+                    printf("FAIL %s frame %i (%s), effect %i seed %u, %i-row bands: %s\r\n", path, frame,
+                        layout, effect, seed, bandHeights[i], ok ? "planes differ" : "read failed");
+                    failures++;
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "spiffs_image";
+
+    for (int i = 0; i < kAssetCount; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", dir, assets[i]);
+        // The first and last image, so animations are checked past frame 0
+        int frames = foreground_frame_count(path);
+        int checkedFrames[2] = { 0, frames - 1 };
+        for (int f = 0; f < (frames > 1 ? 2 : 1); f++) {
+            int frame = checkedFrames[f];
+            foreground_cache_invalidate(path);
+            check_asset(path, frame, "packed by column");
+
+            // Replace the asset with the row-major one a full-frame load saves
+            layer_t layer;
+            render_arena_foreground_layer(&layer);
+            foreground_cache_invalidate(path);
+            if (!foreground_load(path, frame, &layer, NULL)) {
+                printf("FAIL %s frame %i: could not load\r\n", path, frame);
+                failures++;
+                continue;
+            }
+            check_asset(path, frame, "saved by row");
+        }
+        // Leave the SPIFFS image as it was
+        foreground_cache_invalidate(path);
+    }
+
+    printf("%i band renders checked\r\n", checks);
+    printf("%s\r\n", failures ? "band check FAILED" : "band check passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+// One background kernel, built once per instruction set by the Makefile:
+// BG_LANES 8 with -mavx2, BG_LANES 4 with -msse4.1.  -ffp-contract=off
+// keeps each multiply and add rounded on its own, as in the firmware's
+// host build, so only the sines differ from it.
+
+#include <math.h>
+#include <string.h>
+#include <immintrin.h>
+#include "bg_kernels.h"
+
+typedef float vf __attribute__((vector_size(BG_LANES * 4)));
+typedef int32_t vi __attribute__((vector_size(BG_LANES * 4)));
+typedef uint32_t vu __attribute__((vector_size(BG_LANES * 4)));
+
+#if BG_LANES == 8
+#define BG_KERNEL bg_render_avx2
+static inline vf vsqrt(vf x) { return (vf)_mm256_sqrt_ps((__m256)x); }
+static inline int vmask(vi m) { return _mm256_movemask_ps((__m256)m); }
+#elif BG_LANES == 4
+#define BG_KERNEL bg_render_sse41
+static inline vf vsqrt(vf x) { return (vf)_mm_sqrt_ps((__m128)x); }
+static inline int vmask(vi m) { return _mm_movemask_ps((__m128)m); }
+#else
+#error "BG_LANES must be 4 or 8"
+#endif
+
+static inline vi to_int(vf x) { return __builtin_convertvector(x, vi); }
+static inline vf to_float(vi x) { return __builtin_convertvector(x, vf); }
+
+static inline vf vfloor(vf x)
+{
+    vf t = to_float(to_int(x));
+    return t > x ? t - 1.0f : t;
+}
+
+static inline vf vabs(vf x)
+{
+    return (vf)((vi)x & 0x7FFFFFFF);
+}
+
+// a % m for non-negative a and m > 1, both well inside float's integers.
+// a / m only rounds to a whole number when it is one.
+static inline vi vmod(vi a, float m)
+{
+    vi q = to_int(to_float(a) / m);
+    return a - q * (int32_t)m;
+}
+
+// C's truncating % 3, negative values included
+static inline vi vmod3(vi a)
+{
+    vi q = to_int(to_float(a) / 3.0f);
+    return a - q * 3;
+}
+
+// Cephes sinf: reduce by pi/4 in three parts, then the sine or cosine
+// polynomial by octant
+static inline vf vsin(vf x)
+{
+    vi negative = x < 0.0f;
+    vf ax = vabs(x);
+    vi j = to_int(ax * 1.27323954473516f);
+    j = (j + 1) & ~1;
+    vf y = to_float(j);
+    vi useCos = (j & 2) != 0;
+    negative ^= (j & 4) != 0;
+
+    ax = ((ax - y * 0.78515625f) - y * 2.4187564849853515625e-4f) - y * 3.77489497744594108e-8f;
+    vf z = ax * ax;
+    vf cosPoly = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z
+        - 0.5f * z + 1.0f;
+    vf sinPoly = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * ax + ax;
+    vf r = useCos ? cosPoly : sinPoly;
+    return negative ? -r : r;
+}
+
+static inline vu mix32(vu h)
+{
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return h;
+}
+
+// Lane 0 lands in bit 0 of a movemask, but the leftmost pixel is the high
+// bit of a plane byte
+static uint8_t reversed[256];
+
+__attribute__((constructor)) static void init_reversed()
+{
+    for (int i = 0; i < 256; i++) {
+        uint8_t r = 0;
+        for (int bit = 0; bit < 8; bit++) {
+            r |= ((i >> bit) & 1) << (7 - bit);
+        }
+        reversed[i] = r;
+    }
+}
+
+void BG_KERNEL(const bg_params_t *params, uint8_t *black, uint8_t *red)
+{
+    const float *seed = params->seed;
+    const float scale = (float)EPD_HEIGHT;
+    const int sliceWidth = (int)(64.0f * seed[31]) + 2;
+    const float sliceWidthF = (float)sliceWidth;
+    const float cx = seed[30] * (float)EPD_WIDTH;
+    const float cy = seed[29] * (float)EPD_HEIGHT;
+    float p[10];
+    for (int i = 0; i < 10; i++) {
+        p[i] = seed[i] - 0.5f;
+    }
+    const float phase14 = seed[14] * 10.0f;
+    const float phase15 = seed[15] * 10.0f;
+    const float phase16 = seed[16] * 10.0f;
+    const float phase17 = seed[17] * 10.0f;
+
+    vi lane;
+    for (int i = 0; i < BG_LANES; i++) {
+        lane[i] = i;
+    }
+
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        const float oy = (float)y / scale;
+        const float rowShift = params->rowShift[y];
+        const vu rowHash = (vu){} + (params->ditherSeed ^ ((uint32_t)y * 0x85EBCA77u));
+        const vf dy = (vf){} + fabsf((float)y - cy);
+
+        for (int x0 = 0; x0 < EPD_WIDTH; x0 += 8) {
+            int blackBits = 0;
+            int redBits = 0;
+            for (int part = 0; part < 8; part += BG_LANES) {
+                vi xi = lane + (x0 + part);
+                vf xf = to_float(xi);
+                vf colShift;
+                memcpy(&colShift, params->colShift + x0 + part, sizeof(colShift));
+
+                vf tx = xf / scale + rowShift;
+                vf ty = oy + colShift;
+                vf height = vsin(tx * 20.0f * p[0] + ty * 20.0f * p[1] + phase14)
+                    * vsin(tx * 20.0f * p[2] + ty * 20.0f * p[3] + phase15) * p[9]
+                    + vsin(tx / scale * 20.0f * p[4] + ty / scale * 20.0f * p[5] + phase16)
+                    * vsin(tx * 20.0f * p[6] + ty * 20.0f * p[7] + phase17) * p[8];
+                vf c = (height + 0.5f) * 10.0f * seed[18] + 1.0f;
+
+                vi d = to_int(vfloor(c));
+                vf frac = c - to_float(d);
+                vi up;
+                if (params->effect == 0) {
+                    vu hash = mix32(rowHash ^ ((vu)xi * 0x9E3779B1u));
+                    up = to_int(frac * 255.0f) > (vi)(hash & 255u);
+                } else if (params->effect == 1) {
+                    up = to_int(frac * sliceWidthF) > vmod(xi + y, sliceWidthF);
+                } else {
+                    vf dx = vabs(xf - cx);
+                    vf dist = vsqrt(dx * dx + dy * dy);
+                    up = frac * sliceWidthF > to_float(vmod(to_int(dist), sliceWidthF));
+                }
+                d = vmod3(d - up);
+
+                vi color = d + 1;
+                blackBits |= vmask((color & 1) != 0) << part;
+                redBits |= vmask((color & 2) != 0) << part;
+            }
+            *black++ = reversed[blackBits];
+            *red++ = reversed[redBits];
+        }
+    }
+}
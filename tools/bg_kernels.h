@@ -0,0 +1,34 @@
+#ifndef BADGE_BG_KERNELS_H
+#define BADGE_BG_KERNELS_H
+
+#include <stdint.h>
+#include "EPD_2in9b.h"
+
+// Vector versions of the firmware's background kernels (background.cpp)
+// for tools/bg_pack.  The plasma sines that depend only on the row or only
+// on the column are worked out once per frame with the same sinf the
+// firmware uses; the four per pixel use a Cephes-style polynomial, so a
+// pixel sitting right on a dither threshold can come out differently from
+// the firmware kernel.  bg_pack counts those against the scalar reference.
+
+typedef struct {
+    uint8_t effect;
+    uint32_t frameSeed;
+    float seed[32];
+    uint32_t ditherSeed;
+    float rowShift[EPD_HEIGHT];   // Added to tx on each row
+    float colShift[EPD_WIDTH];    // Added to ty in each column
+} bg_params_t;
+
+// Expand the seed the way background_apply() does
+void bg_params_init(bg_params_t *params, uint8_t effect, uint32_t frameSeed);
+
+// Render a whole frame into packed black and red planes
+typedef void (*bg_kernel_t)(const bg_params_t *params, uint8_t *black, uint8_t *red);
+
+#if defined(__x86_64__) || defined(__i386__)
+void bg_render_avx2(const bg_params_t *params, uint8_t *black, uint8_t *red);
+void bg_render_sse41(const bg_params_t *params, uint8_t *black, uint8_t *red);
+#endif
+
+#endif
@@ -0,0 +1,542 @@
+// Pre-renders backgrounds into a pack the badge streams from its "bgpack"
+// partition (see background_pack.h).  Every effect is rendered for seeds
+// 0 to n-1 on all cores with the widest vector kernel the CPU has,
+// identical frames are stored once, the pack is filled up to the partition
+// size, and every frame in it is checked against the firmware's scalar
+// kernel.  By default n is what a sample of frames says fills the pack.
+//
+//   make -C tools && tools/bg_pack [-n seeds] [-j threads] [-k avx2|sse4.1|scalar] [-b bytes]
+//
+// Writes bgpack.bin in the current directory and reads it back through the
+// firmware's reader.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "background.h"
+#include "background_pack.h"
+#include "bg_kernels.h"
+#include "frame_codec.h"
+#include "layer.h"
+
+#define PLANE_CODED_MAX FRAME_CODEC_MAX_ENCODED(LAYER_PLANE_BYTES)
+#define BENCH_FRAMES 24
+// Seeds rendered to estimate the coded frame size, and the margin on top of
+// the seeds that estimate says fill the pack, in percent
+#define SAMPLE_SEEDS 8
+#define SEED_MARGIN 25
+// A vector frame may differ from the scalar one in this many pixels, on a
+// dither threshold its polynomial sines land on the other side of; more
+// means a kernel bug
+#define CHECK_TOLERANCE 1
+
+typedef struct {
+    const char *name;
+    bg_kernel_t render;
+    bool (*supported)(void);
+} kernel_info_t;
+
+typedef struct {
+    std::vector<uint8_t> coded;   // Both plane sizes, then both planes
+    uint64_t hash;
+} frame_t;
+
+typedef struct {
+    int checked;
+    int differing;
+    long pixels;
+    int worst;
+} check_stats_t;
+
+// ---- Kernels ----
+
+static uint32_t mix32(uint32_t h)
+{
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return h;
+}
+
+void bg_params_init(bg_params_t *params, uint8_t effect, uint32_t frameSeed)
+{
+    params->effect = effect;
+    params->frameSeed = frameSeed;
+    for (int i = 0; i < 32; i++) {
+        params->seed[i] = (float)(mix32(frameSeed * 0x9E3779B1u + i) % 65536) / 65536.0f;
+    }
+    params->ditherSeed = mix32(frameSeed ^ 0x85EBCA77u);
+
+    const float *seed = params->seed;
+    const float scale = (float)EPD_HEIGHT;
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        float oy = (float)y / scale;
+        params->rowShift[y] = sinf(oy * (seed[10] - 0.5f) * 5.0f + seed[12]) * seed[19];
+    }
+    for (int x = 0; x < EPD_WIDTH; x++) {
+        float ox = (float)x / scale;
+        params->colShift[x] = sinf(ox * (seed[11] - 0.5f) * 5.0f + seed[13]) * seed[20];
+    }
+}
+
+// background.cpp keeps its state in globals, so one frame at a time
+static std::mutex referenceLock;
+
+static void render_scalar(const bg_params_t *params, uint8_t *black, uint8_t *red)
+{
+    std::lock_guard<std::mutex> hold(referenceLock);
+    background_apply(params->effect, params->frameSeed);
+    background_render_rows(black, red, 0, EPD_HEIGHT);
+}
+
+static bool always(void)
+{
+    return true;
+}
+
+#ifdef BG_PACK_SIMD
+static bool has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+static bool has_sse41(void)
+{
+    return __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+// Widest first
+static const kernel_info_t kernels[] = {
+#ifdef BG_PACK_SIMD
+    { "avx2",   bg_render_avx2,  has_avx2 },
+    { "sse4.1", bg_render_sse41, has_sse41 },
+#endif
+    { "scalar", render_scalar,   always },
+};
+static const int kKernelCount = sizeof(kernels) / sizeof(kernels[0]);
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ---- Frames ----
+
+static uint64_t hash_bytes(const std::vector<uint8_t> &data)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (uint8_t byte : data) {
+        h = (h ^ byte) * 1099511628211ull;
+    }
+    return h;
+}
+
+// Row delta and PackBits, as background_pack.cpp reads them back
+static void encode_frame(const uint8_t *black, const uint8_t *red, frame_t *frame)
+{
+    uint8_t filtered[LAYER_PLANE_BYTES];
+    uint8_t coded[2][PLANE_CODED_MAX];
+    uint32_t sizes[2];
+    const uint8_t *planes[2] = { black, red };
+    for (int plane = 0; plane < 2; plane++) {
+        uint8_t prev[LAYER_ROW_BYTES] = {};
+        for (int row = 0; row < EPD_HEIGHT; row++) {
+            frame_delta_encode_row(planes[plane] + row * LAYER_ROW_BYTES, prev,
+                filtered + row * LAYER_ROW_BYTES, LAYER_ROW_BYTES);
+        }
+        sizes[plane] = frame_encode(filtered, LAYER_PLANE_BYTES, coded[plane], PLANE_CODED_MAX);
+    }
+    frame->coded.resize(sizeof(sizes) + sizes[0] + sizes[1]);
+    memcpy(frame->coded.data(), sizes, sizeof(sizes));
+    memcpy(frame->coded.data() + sizeof(sizes), coded[0], sizes[0]);
+    memcpy(frame->coded.data() + sizeof(sizes) + sizes[0], coded[1], sizes[1]);
+    frame->hash = hash_bytes(frame->coded);
+}
+
+static bool decode_frame(const frame_t *frame, uint8_t *black, uint8_t *red)
+{
+    uint32_t sizes[2];
+    memcpy(sizes, frame->coded.data(), sizeof(sizes));
+    const uint8_t *in = frame->coded.data() + sizeof(sizes);
+    uint8_t *planes[2] = { black, red };
+    for (int plane = 0; plane < 2; plane++) {
+        if (!frame_decode(in, sizes[plane], planes[plane], LAYER_PLANE_BYTES)) {
+            return false;
+        }
+        uint8_t prev[LAYER_ROW_BYTES] = {};
+        for (int row = 0; row < EPD_HEIGHT; row++) {
+            frame_delta_decode_row(planes[plane] + row * LAYER_ROW_BYTES, prev, LAYER_ROW_BYTES);
+        }
+        in += sizes[plane];
+    }
+    return true;
+}
+
+// Pixels whose colour differs between two frames
+static int differing_pixels(const uint8_t *blackA, const uint8_t *redA, const uint8_t *blackB, const uint8_t *redB)
+{
+    int pixels = 0;
+    for (int i = 0; i < LAYER_PLANE_BYTES; i++) {
+        pixels += __builtin_popcount((blackA[i] ^ blackB[i]) | (redA[i] ^ redB[i]));
+    }
+    return pixels;
+}
+
+static void frame_style(int index, uint8_t *effect, uint32_t *seed)
+{
+    // Seed-major, so a pack cut short still has every effect
+    *effect = index % BACKGROUND_EFFECT_COUNT;
+    *seed = index / BACKGROUND_EFFECT_COUNT;
+}
+
+// ---- Rendering ----
+
+typedef struct {
+    const kernel_info_t *kernel;
+    int frameCount;
+    std::vector<frame_t> *frames;
+    std::atomic<int> next;
+} render_job_t;
+
+static void render_worker(render_job_t *job)
+{
+    uint8_t black[LAYER_PLANE_BYTES];
+    uint8_t red[LAYER_PLANE_BYTES];
+    bg_params_t params;
+    for (int index = job->next++; index < job->frameCount; index = job->next++) {
+        uint8_t effect;
+        uint32_t seed;
+        frame_style(index, &effect, &seed);
+        bg_params_init(&params, effect, seed);
+        job->kernel->render(&params, black, red);
+        encode_frame(black, red, &(*job->frames)[index]);
+    }
+}
+
+// Seeds whose frames, at the average coded size of a sample, fill the pack
+static int seeds_for_budget(const kernel_info_t *kernel, size_t budget)
+{
+    uint8_t black[LAYER_PLANE_BYTES];
+    uint8_t red[LAYER_PLANE_BYTES];
+    bg_params_t params;
+    frame_t frame;
+    size_t bytes = 0;
+    const int sampleFrames = SAMPLE_SEEDS * BACKGROUND_EFFECT_COUNT;
+    for (int index = 0; index < sampleFrames; index++) {
+        uint8_t effect;
+        uint32_t seed;
+        frame_style(index, &effect, &seed);
+        bg_params_init(&params, effect, seed);
+        kernel->render(&params, black, red);
+        encode_frame(black, red, &frame);
+        bytes += sizeof(background_pack_entry_t) + frame.coded.size();
+    }
+    size_t fit = (budget - sizeof(background_pack_header_t)) / (bytes / sampleFrames);
+    return (int)(fit * (100 + SEED_MARGIN) / 100 / BACKGROUND_EFFECT_COUNT) + 1;
+}
+
+static void bench_kernels(void)
+{
+    printf("Kernels, one thread, %i frames each:\n", BENCH_FRAMES);
+    uint8_t black[LAYER_PLANE_BYTES];
+    uint8_t red[LAYER_PLANE_BYTES];
+    bg_params_t params;
+    double scalarFps = 0;
+    for (int k = kKernelCount - 1; k >= 0; k--) {
+        if (!kernels[k].supported()) {
+            printf("  %-8s not supported by this CPU\n", kernels[k].name);
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCH_FRAMES; i++) {
+            uint8_t effect;
+            uint32_t seed;
+            frame_style(i, &effect, &seed);
+            bg_params_init(&params, effect, seed);
+            kernels[k].render(&params, black, red);
+        }
+        double fps = BENCH_FRAMES / seconds_since(start);
+        if (kernels[k].render == render_scalar) {
+            scalarFps = fps;
+        }
+        printf("  %-8s %8.1f frames/s  %5.1fx scalar\n", kernels[k].name, fps, scalarFps > 0 ? fps / scalarFps : 0);
+    }
+    printf("\n");
+}
+
+// ---- Packing ----
+
+typedef struct {
+    int frame;    // Index into the rendered frames
+    int unique;   // Index of the stored frame it uses
+} pack_entry_t;
+
+typedef struct {
+    std::vector<pack_entry_t> entries;
+    std::vector<int> uniques;   // Rendered frame index of each stored frame
+    size_t bytes;
+    int dropped;
+} pack_plan_t;
+
+// Keep frames in order until the pack is full, storing repeats once
+static void plan_pack(const std::vector<frame_t> &frames, size_t budget, pack_plan_t *plan)
+{
+    std::multimap<uint64_t, int> seen;
+    plan->bytes = sizeof(background_pack_header_t);
+    plan->dropped = 0;
+    for (int index = 0; index < (int)frames.size(); index++) {
+        const frame_t &frame = frames[index];
+        int unique = -1;
+        auto range = seen.equal_range(frame.hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (frames[plan->uniques[it->second]].coded == frame.coded) {
+                unique = it->second;
+                break;
+            }
+        }
+        size_t cost = sizeof(background_pack_entry_t) + (unique < 0 ? frame.coded.size() : 0);
+        if (plan->bytes + cost > budget) {
+            plan->dropped++;
+            continue;
+        }
+        plan->bytes += cost;
+        if (unique < 0) {
+            unique = plan->uniques.size();
+            plan->uniques.push_back(index);
+            seen.insert(std::make_pair(frame.hash, unique));
+        }
+        plan->entries.push_back({ index, unique });
+    }
+    // Sorted by effect, then seed, for the reader's binary search
+    std::sort(plan->entries.begin(), plan->entries.end(), [](const pack_entry_t &a, const pack_entry_t &b) {
+        uint8_t effectA, effectB;
+        uint32_t seedA, seedB;
+        frame_style(a.frame, &effectA, &seedA);
+        frame_style(b.frame, &effectB, &seedB);
+        return effectA != effectB ? effectA < effectB : seedA < seedB;
+    });
+}
+
+static bool write_pack(const std::vector<frame_t> &frames, const pack_plan_t *plan)
+{
+    background_pack_header_t header = {};
+    header.magic = BACKGROUND_PACK_MAGIC;
+    header.renderVersion = BACKGROUND_RENDER_VERSION;
+    header.entryCount = plan->entries.size();
+    header.frameCount = plan->uniques.size();
+    header.packBytes = plan->bytes;
+
+    std::vector<uint32_t> offsets;
+    uint32_t offset = sizeof(header) + plan->entries.size() * sizeof(background_pack_entry_t);
+    for (int index : plan->uniques) {
+        offsets.push_back(offset);
+        offset += frames[index].coded.size();
+    }
+
+    FILE *out = fopen(BACKGROUND_PACK_HOST_PATH, "wb");
+    if (out == NULL) {
+        perror(BACKGROUND_PACK_HOST_PATH);
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (const pack_entry_t &planned : plan->entries) {
+        background_pack_entry_t entry = {};
+        frame_style(planned.frame, &entry.effect, &entry.seed);
+        entry.frameOffset = offsets[planned.unique];
+        ok = ok && fwrite(&entry, sizeof(entry), 1, out) == 1;
+    }
+    for (int index : plan->uniques) {
+        ok = ok && fwrite(frames[index].coded.data(), frames[index].coded.size(), 1, out) == 1;
+    }
+    return fclose(out) == 0 && ok;
+}
+
+// Read every background back the way band mode does, each band twice
+static bool verify_pack(const std::vector<frame_t> &frames, const pack_plan_t *plan)
+{
+    const int bandRows = 24;
+    static uint8_t black[LAYER_PLANE_BYTES];
+    static uint8_t red[LAYER_PLANE_BYTES];
+    static uint8_t readBlack[LAYER_PLANE_BYTES];
+    static uint8_t readRed[LAYER_PLANE_BYTES];
+    if (!background_pack_init() || background_pack_count() != (int)plan->entries.size()) {
+        printf("The firmware reader did not accept the pack\n");
+        return false;
+    }
+    for (int i = 0; i < background_pack_count(); i++) {
+        uint8_t effect;
+        uint32_t seed;
+        if (!background_pack_entry(i, &effect, &seed) || !background_pack_apply(effect, seed)) {
+            printf("Entry %i is missing from the pack\n", i);
+            return false;
+        }
+        decode_frame(&frames[plan->entries[i].frame], black, red);
+        for (int pass = 0; pass < 2; pass++) {
+            for (int row = 0; row < EPD_HEIGHT; row += bandRows) {
+                int rows = std::min(bandRows, EPD_HEIGHT - row);
+                if (!background_pack_render_rows(readBlack + row * LAYER_ROW_BYTES,
+                        readRed + row * LAYER_ROW_BYTES, row, rows)) {
+                    printf("Effect %u seed %u did not read back\n", effect, seed);
+                    return false;
+                }
+            }
+            if (memcmp(black, readBlack, LAYER_PLANE_BYTES) != 0 || memcmp(red, readRed, LAYER_PLANE_BYTES) != 0) {
+                printf("Effect %u seed %u read back wrong\n", effect, seed);
+                return false;
+            }
+        }
+    }
+    return !background_pack_apply(0, 0xFFFFFFFF);
+}
+
+// Compare every background in the pack with the firmware's scalar kernel
+static void check_pack(const std::vector<frame_t> &frames, const pack_plan_t *plan, check_stats_t *stats)
+{
+    static uint8_t black[LAYER_PLANE_BYTES];
+    static uint8_t red[LAYER_PLANE_BYTES];
+    static uint8_t checkBlack[LAYER_PLANE_BYTES];
+    static uint8_t checkRed[LAYER_PLANE_BYTES];
+    bg_params_t params;
+    *stats = {};
+    for (const pack_entry_t &entry : plan->entries) {
+        uint8_t effect;
+        uint32_t seed;
+        frame_style(entry.frame, &effect, &seed);
+        bg_params_init(&params, effect, seed);
+        render_scalar(&params, checkBlack, checkRed);
+        int pixels = EPD_WIDTH * EPD_HEIGHT;
+        if (decode_frame(&frames[entry.frame], black, red)) {
+            pixels = differing_pixels(black, red, checkBlack, checkRed);
+        }
+        stats->checked++;
+        stats->differing += pixels > 0;
+        stats->pixels += pixels;
+        stats->worst = std::max(stats->worst, pixels);
+    }
+}
+
+// ---- Main ----
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n seeds] [-j threads] [-k avx2|sse4.1|scalar] [-b bytes]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int seeds = 0;
+    int threads = std::thread::hardware_concurrency();
+    size_t budget = BACKGROUND_PACK_HOST_SIZE;
+    const kernel_info_t *kernel = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-') {
+            usage(argv[0]);
+        }
+        const char *value = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'n': seeds = atoi(value); break;
+        case 'j': threads = atoi(value); break;
+        case 'b': budget = strtoul(value, NULL, 0); break;
+        case 'k':
+            for (int k = 0; k < kKernelCount; k++) {
+                if (strcmp(kernels[k].name, value) == 0) {
+                    kernel = &kernels[k];
+                }
+            }
+            if (kernel == NULL || !kernel->supported()) {
+                fprintf(stderr, "Kernel %s is not available\n", value);
+                return 2;
+            }
+            break;
+        default: usage(argv[0]);
+        }
+    }
+    if (kernel == NULL) {
+        for (int k = 0; k < kKernelCount && kernel == NULL; k++) {
+            if (kernels[k].supported()) {
+                kernel = &kernels[k];
+            }
+        }
+    }
+    if (seeds < 0 || budget <= sizeof(background_pack_header_t)) {
+        usage(argv[0]);
+    }
+    // The scalar kernel is the firmware's, which only renders one at a time
+    if (threads < 1 || kernel->render == render_scalar) {
+        threads = 1;
+    }
+
+    bench_kernels();
+    if (seeds == 0) {
+        seeds = seeds_for_budget(kernel, budget);
+    }
+
+    int frameCount = seeds * BACKGROUND_EFFECT_COUNT;
+    std::vector<frame_t> frames(frameCount);
+    render_job_t job;
+    job.kernel = kernel;
+    job.frameCount = frameCount;
+    job.frames = &frames;
+    job.next = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back(render_worker, &job);
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    double elapsed = seconds_since(start);
+    printf("Rendered %i backgrounds (%i seeds x %i effects) with %s on %i threads in %.2f s:\n"
+        "  %.1f frames/s, %.1f frames/s per core\n",
+        frameCount, seeds, BACKGROUND_EFFECT_COUNT, kernel->name, threads, elapsed,
+        frameCount / elapsed, frameCount / elapsed / threads);
+
+    pack_plan_t plan;
+    plan_pack(frames, budget, &plan);
+    size_t frameBytes = plan.bytes - sizeof(background_pack_header_t) - plan.entries.size() * sizeof(background_pack_entry_t);
+    printf("Pack: %u of %i backgrounds in %u of %u bytes, %u distinct frames of %u bytes on average",
+        (unsigned)plan.entries.size(), frameCount, (unsigned)plan.bytes, (unsigned)budget,
+        (unsigned)plan.uniques.size(), plan.uniques.empty() ? 0 : (unsigned)(frameBytes / plan.uniques.size()));
+    printf(", %u repeats, %i left out for space\n", (unsigned)(plan.entries.size() - plan.uniques.size()), plan.dropped);
+    if (plan.dropped == 0) {
+        printf("  the pack has room for more; pass a larger -n\n");
+    }
+
+    bool ok = true;
+    if (kernel->render != render_scalar) {
+        check_stats_t stats;
+        check_pack(frames, &plan, &stats);
+        printf("Checked all %i against the scalar kernel: %i identical, %i differ in %.1f pixels on average, at most %i of %i\n",
+            stats.checked, stats.checked - stats.differing, stats.differing,
+            stats.differing ? (double)stats.pixels / stats.differing : 0.0, stats.worst, EPD_WIDTH * EPD_HEIGHT);
+        if (stats.worst > CHECK_TOLERANCE) {
+            printf("  more than the %i pixel%s a threshold can account for\n", CHECK_TOLERANCE, CHECK_TOLERANCE == 1 ? "" : "s");
+            ok = false;
+        }
+    }
+
+    if (!write_pack(frames, &plan)) {
+        return 1;
+    }
+    if (!verify_pack(frames, &plan)) {
+        return 1;
+    }
+    printf("Wrote %s, read back %u backgrounds through the firmware reader\n",
+        BACKGROUND_PACK_HOST_PATH, (unsigned)plan.entries.size());
+    return ok ? 0 : 1;
+}
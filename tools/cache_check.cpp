@@ -0,0 +1,175 @@
+// Checks the frame cache on its host backend (a file standing in for the
+// partition): frames come back as stored, a key that differs in any field
+// misses, eviction takes the least recently used slot, empty slots go to
+// the one erased the fewest times, and frame_cache_init() can run for
+// every render without opening the file again.
+//
+//   make -C tools && tools/cache_check [scratch dir]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "frame_cache.h"
+#include "layer.h"
+
+static uint8_t black[LAYER_PLANE_BYTES];
+static uint8_t red[LAYER_PLANE_BYTES];
+static uint8_t readBack[LAYER_PLANE_BYTES];
+static int failures = 0;
+
+static void check(bool ok, const char *name, const char *detail)
+{
+    printf("%-4s %s%s%s\r\n", ok ? "ok" : "FAIL", name, ok ? "" : ": ", ok ? "" : detail);
+    if (!ok) {
+        failures++;
+    }
+}
+
+static void make_key(frame_key_t *key, uint32_t seed)
+{
+    memset(key, 0, sizeof(frame_key_t));
+    key->effect = seed % BACKGROUND_EFFECT_COUNT;
+    key->fileIndex = seed % 7;
+    key->version = FRAME_CACHE_KEY_VERSION;
+    key->seed = seed;
+    key->assetSize = 1000 + seed;
+    key->assetTime = 5000;
+}
+
+// Runs of bytes, so the planes code to something like a real frame
+static void make_planes(uint32_t seed)
+{
+    uint32_t x = seed * 2654435761u + 1;
+    for (int i = 0; i < LAYER_PLANE_BYTES; i++) {
+        if (i % 37 == 0) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+        black[i] = x & 0xFF;
+        red[i] = (x >> 8) & 0x0F;
+    }
+}
+
+static bool store(uint32_t seed)
+{
+    frame_key_t key;
+    make_key(&key, seed);
+    make_planes(seed);
+    if (!frame_cache_store_begin(&key)) {
+        return false;
+    }
+    frame_cache_store_plane(black, LAYER_PLANE_BYTES);
+    frame_cache_store_next_plane();
+    frame_cache_store_plane(red, LAYER_PLANE_BYTES);
+    return frame_cache_store_end();
+}
+
+static int find(uint32_t seed)
+{
+    frame_key_t key;
+    make_key(&key, seed);
+    return frame_cache_find(&key);
+}
+
+// Both planes of a slot match what store(seed) put in
+static bool planes_match(int slot, uint32_t seed)
+{
+    make_planes(seed);
+    const uint8_t *planes[2] = { black, red };
+    for (int plane = 0; plane < 2; plane++) {
+        frame_cache_reader_t reader;
+        if (!frame_cache_open_plane(&reader, slot, plane) || !frame_cache_read(&reader, readBack, LAYER_PLANE_BYTES)
+            || memcmp(readBack, planes[plane], LAYER_PLANE_BYTES) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    // The cache file is FRAME_CACHE_HOST_PATH in the working directory
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s/cache_check.XXXXXX", argc > 1 ? argv[1] : "/tmp");
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        printf("Can't make a scratch directory in %s\r\n", argc > 1 ? argv[1] : "/tmp");
+        return 1;
+    }
+    char detail[128] = "";
+
+    check(frame_cache_init(), "init", "no cache file");
+    int slots = frame_cache_slot_count();
+    snprintf(detail, sizeof(detail), "%i slots", slots);
+    check(slots > 2, "slots in the partition", detail);
+
+    // A store that never finishes leaves its slot erased but empty; the
+    // next store goes to another empty slot, the one erased the fewest times
+    frame_key_t abandoned;
+    make_key(&abandoned, 1000);
+    frame_cache_store_begin(&abandoned);
+    frame_cache_store_plane(black, LAYER_PLANE_BYTES);
+    check(store(1) && find(1000) < 0, "abandoned store reads as empty", "it was found");
+    int slot = find(1);
+    snprintf(detail, sizeof(detail), "stored in slot %i", slot);
+    check(slot > 0, "empty slots: fewest erases first", detail);
+    check(slot >= 0 && planes_match(slot, 1), "stored frame reads back", "planes differ");
+
+    // Every field of the key counts
+    frame_key_t key;
+    const char *fields[] = { "effect", "file", "version", "seed", "asset size", "asset time", "frame" };
+    bool ok = true;
+    const char *missed = "";
+    for (int field = 0; field < 7 && ok; field++) {
+        make_key(&key, 1);
+        switch (field) {
+        case 0: key.effect++; break;
+        case 1: key.fileIndex++; break;
+        case 2: key.version++; break;
+        case 3: key.seed++; break;
+        case 4: key.assetSize++; break;
+        case 5: key.assetTime++; break;
+        case 6: key.frame++; break;
+        }
+        missed = fields[field];
+        ok = frame_cache_find(&key) < 0 && frame_cache_peek(&key) < 0;
+    }
+    snprintf(detail, sizeof(detail), "a different %s still found the frame", missed);
+    check(ok, "changed key misses", detail);
+
+    // Fill every slot, use the oldest frame again, and store one more: the
+    // frame stored second is the least recently used and goes
+    ok = true;
+    for (uint32_t seed = 2; seed <= (uint32_t)slots && ok; seed++) {
+        ok = store(seed);
+    }
+    check(ok, "fill the cache", "a store failed");
+    find(1);
+    check(store(slots + 1), "store into a full cache", "store failed");
+    bool evicted = find(2) < 0;
+    bool kept = find(1) >= 0 && find(3) >= 0 && find(slots + 1) >= 0;
+    snprintf(detail, sizeof(detail), "frame 2 %s, others %s", evicted ? "evicted" : "kept",
+        kept ? "kept" : "lost");
+    check(evicted && kept, "least recently used evicted", detail);
+    slot = find(slots + 1);
+    check(slot >= 0 && planes_match(slot, slots + 1), "frame in the evicted slot reads back", "planes differ");
+
+    // Every render and prerender calls frame_cache_init(); with few file
+    // descriptors to go round, one leaked per call soon runs out
+    struct rlimit files = { 64, 64 };
+    setrlimit(RLIMIT_NOFILE, &files);
+    ok = true;
+    for (int i = 0; i < 256 && ok; i++) {
+        ok = frame_cache_init();
+    }
+    check(ok && find(1) >= 0, "init for every render keeps the file", "init failed");
+
+    remove(FRAME_CACHE_HOST_PATH);
+    if (chdir("/") == 0) {
+        rmdir(dir);
+    }
+    printf("%s\r\n", failures ? "cache check FAILED" : "cache check passed");
+    return failures ? 1 : 0;
+}
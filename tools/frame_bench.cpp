@@ -0,0 +1,162 @@
+// Host benchmark for the frame codec: how well do the current assets and
+// effects compress, and how many frames would fit the RTC frame budget?
+//
+//   make -C tools && tools/frame_bench [spiffs_image]
+
+#include <stdio.h>
+#include <string.h>
+#include "background.h"
+#include "foreground.h"
+#include "frame_codec.h"
+#include "render_arena.h"
+#include "rtc_frame.h"
+#include "trace.h"
+
+#define SEEDS_PER_EFFECT 8
+
+static const char *assets[] = {
+    "dino.gif", "youtube.gif", "twitter.gif", "namebottom.gif",
+    "mozillamr.gif", "fxrlogo.gif", "github.gif"
+};
+static const int kAssetCount = sizeof(assets) / sizeof(assets[0]);
+
+static uint8_t black[LAYER_PLANE_BYTES];
+static uint8_t red[LAYER_PLANE_BYTES];
+static uint8_t filtered[LAYER_PLANE_BYTES];
+static uint8_t coded[FRAME_CODEC_MAX_ENCODED(LAYER_PLANE_BYTES)];
+static uint8_t check[LAYER_PLANE_BYTES];
+
+typedef struct {
+    size_t raw;
+    size_t delta;
+    size_t minDelta;
+    size_t maxDelta;
+    int frames;
+    int fits;
+} bench_row_t;
+
+static size_t coded_size(const uint8_t *plane, bool delta)
+{
+    if (delta) {
+        uint8_t prev[LAYER_ROW_BYTES] = {};
+        for (int row = 0; row < EPD_HEIGHT; row++) {
+            frame_delta_encode_row(plane + row * LAYER_ROW_BYTES, prev,
+                filtered + row * LAYER_ROW_BYTES, LAYER_ROW_BYTES);
+        }
+        plane = filtered;
+    }
+    return frame_encode(plane, LAYER_PLANE_BYTES, coded, sizeof(coded));
+}
+
+// Code the frame into the RTC frame store and make sure it comes back intact
+static bool rtc_round_trip(int frameIndex)
+{
+    frame_key_t key = {};
+    key.seed = frameIndex;
+    rtc_frame_store_begin(&key);
+    rtc_frame_store_plane(black, LAYER_PLANE_BYTES);
+    rtc_frame_store_next_plane();
+    rtc_frame_store_plane(red, LAYER_PLANE_BYTES);
+    if (!rtc_frame_store_end()) {
+        return false;
+    }
+    const uint8_t *planes[2] = { black, red };
+    for (int plane = 0; plane < 2; plane++) {
+        rtc_frame_reader_t reader;
+        if (!rtc_frame_open_plane(&reader, plane) || !rtc_frame_read(&reader, check, EPD_HEIGHT)
+            || memcmp(check, planes[plane], LAYER_PLANE_BYTES) != 0) {
+            printf("RTC frame %i plane %i did not round trip\n", frameIndex, plane);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void add_frame(bench_row_t *row, int frameIndex)
+{
+    size_t raw = coded_size(black, false) + coded_size(red, false);
+    size_t delta = coded_size(black, true) + coded_size(red, true);
+    row->raw += raw;
+    row->delta += delta;
+    if (row->frames == 0 || delta < row->minDelta) {
+        row->minDelta = delta;
+    }
+    if (delta > row->maxDelta) {
+        row->maxDelta = delta;
+    }
+    row->frames++;
+    row->fits += rtc_round_trip(frameIndex);
+}
+
+static void print_row(const char *name, const bench_row_t *row)
+{
+    printf("%-16s %6u %7u %6.1f%% %6u %6u %5i/%-3i\n", name,
+        (unsigned)(row->raw / row->frames), (unsigned)(row->delta / row->frames),
+        100.0 * row->delta / (row->frames * 2.0 * LAYER_PLANE_BYTES),
+        (unsigned)row->minDelta, (unsigned)row->maxDelta, row->fits, row->frames);
+}
+
+static bool load_asset(const char *dir, int index, layer_t *layer)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, assets[index]);
+    render_arena_foreground_layer(layer);
+    if (!foreground_decode(path, 0, layer, NULL)) {
+        printf("Could not decode %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "spiffs_image";
+    int frameIndex = 0;
+
+    printf("Frame %u bytes (2 planes), RTC frame budget %u bytes, sizes in bytes\n\n",
+        (unsigned)(2 * LAYER_PLANE_BYTES), (unsigned)RTC_FRAME_BYTES);
+    printf("%-16s %6s %7s %7s %6s %6s %9s\n", "", "raw", "delta", "ratio", "min", "max", "fit");
+
+    // Foreground alone, over a white panel
+    for (int asset = 0; asset < kAssetCount; asset++) {
+        layer_t layer;
+        if (!load_asset(dir, asset, &layer)) {
+            return 1;
+        }
+        bench_row_t row = {};
+        memset(black, 0xFF, sizeof(black));
+        memset(red, 0xFF, sizeof(red));
+        layer_composite(black, red, &layer);
+        add_frame(&row, frameIndex++);
+        print_row(assets[asset], &row);
+    }
+    printf("\n");
+    trace_memory("foreground decode");
+    printf("\n");
+
+    // Finished frames: every effect under every asset
+    bench_row_t total = {};
+    for (int effect = 0; effect < BACKGROUND_EFFECT_COUNT; effect++) {
+        bench_row_t row = {};
+        for (int asset = 0; asset < kAssetCount; asset++) {
+            layer_t layer;
+            if (!load_asset(dir, asset, &layer)) {
+                return 1;
+            }
+            for (uint32_t seed = 0; seed < SEEDS_PER_EFFECT; seed++) {
+                background_apply(effect, seed);
+                background_render_rows(black, red, 0, EPD_HEIGHT);
+                layer_composite(black, red, &layer);
+                add_frame(&row, frameIndex);
+                add_frame(&total, frameIndex++);
+            }
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "effect %i", effect);
+        print_row(name, &row);
+    }
+    print_row("all frames", &total);
+    printf("\n");
+    trace_memory("finished frames");
+    return 0;
+}
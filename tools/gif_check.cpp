@@ -0,0 +1,467 @@
+// Checks the GIF decoder and the asset cache against GIFs made on the spot
+// (see gif_writer.h), drawn into a plain canvas model alongside: random
+// access into animations with every disposal method, the snapshots the
+// asset cache keeps on the way to a frame, a GIF replaced by one of the
+// same size, whose frame index and packed assets have to be rebuilt rather
+// than reused, and artwork wider than the decoder's row buffer, interlaced,
+// shrunk to the panel and cropped.
+//
+//   make -C tools && tools/gif_check [scratch dir]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include "badge_config.h"
+#include "foreground.h"
+#include "gif_writer.h"
+#include "render_arena.h"
+
+#define CANVAS_WIDTH EPD_HEIGHT    // The GIF is landscape
+#define CANVAS_HEIGHT EPD_WIDTH
+#define MAX_IMAGES 24
+#define TRANSPARENT -1
+
+typedef struct {
+    int x, y, width, height;
+    int disposal;
+    bool interlaced;
+    uint8_t *pixels;
+} image_t;
+
+// The part of the logical screen drawn and the size it is shrunk to fit, as
+// setCrop() and setFitSize() take them (0 for the whole screen, no scaling)
+typedef struct {
+    int x, y, width, height;
+    int fitWidth, fitHeight;
+} output_t;
+
+// What foreground_decode() asks for: the whole GIF, shrunk to the panel
+static const output_t panelOutput = { 0, 0, 0, 0, CANVAS_WIDTH, CANVAS_HEIGHT };
+
+// An animation and what it shows after each image, at output size
+typedef struct {
+    int width, height;
+    int count;
+    image_t images[MAX_IMAGES];
+    int8_t shown[MAX_IMAGES][CANVAS_HEIGHT][CANVAS_WIDTH];
+} animation_t;
+
+static animation_t animation;
+static int failures = 0;
+
+static void check(bool ok, const char *name, const char *detail)
+{
+    printf("%-4s %s%s%s\r\n", ok ? "ok" : "FAIL", name, ok ? "" : ": ", ok ? "" : detail);
+    if (!ok) {
+        failures++;
+    }
+}
+
+static void start_animation(animation_t *anim, int width, int height)
+{
+    for (int i = 0; i < anim->count; i++) {
+        free(anim->images[i].pixels);
+    }
+    memset(anim, 0, sizeof(*anim));
+    anim->width = width;
+    anim->height = height;
+}
+
+static image_t *add_image(animation_t *anim, int x, int y, int width, int height, int disposal, int seed)
+{
+    image_t *image = &anim->images[anim->count++];
+    image->x = x;
+    image->y = y;
+    image->width = width;
+    image->height = height;
+    image->disposal = disposal;
+    image->pixels = (uint8_t *)malloc(width * height);
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            image->pixels[row * width + col] = ((col + seed) / 3 + (row + 2 * seed) / 5) % 4;
+        }
+    }
+    return image;
+}
+
+// The screen pixel an output pixel shows, per axis: the output is the crop
+// shrunk (never enlarged) by the larger of its two ratios to the fit size,
+// rounded up to 1/65536, and each output pixel samples the middle of the
+// span it covers.  Returns -1 past the end of the crop.
+static int output_sample(int output, uint32_t step, int cropOffset, int cropSize)
+{
+    int sample = ((uint32_t)output * step + step / 2) >> 16;
+    return sample < cropSize ? cropOffset + sample : -1;
+}
+
+static uint32_t output_step(const output_t *out, int cropWidth, int cropHeight)
+{
+    uint32_t step = 1 << 16;
+    if (out->fitWidth > 0 && out->fitHeight > 0) {
+        uint32_t stepX = (((uint32_t)cropWidth << 16) + out->fitWidth - 1) / out->fitWidth;
+        uint32_t stepY = (((uint32_t)cropHeight << 16) + out->fitHeight - 1) / out->fitHeight;
+        step = stepX > step ? stepX : step;
+        step = stepY > step ? stepY : step;
+    }
+    return step;
+}
+
+// Play the animation on a screen-sized canvas that starts transparent, and
+// after each image sample what the output shows
+static void model_animation(animation_t *anim, const output_t *out)
+{
+    size_t canvasBytes = anim->width * anim->height;
+    int8_t *canvas = (int8_t *)malloc(canvasBytes);
+    int8_t *saved = (int8_t *)malloc(canvasBytes);
+    memset(canvas, TRANSPARENT, canvasBytes);
+    bool cropped = out->width > 0 && out->height > 0;
+    int cropX = cropped ? out->x : 0;
+    int cropY = cropped ? out->y : 0;
+    int cropWidth = cropped ? out->width : anim->width;
+    int cropHeight = cropped ? out->height : anim->height;
+    uint32_t step = output_step(out, cropWidth, cropHeight);
+    for (int i = 0; i < anim->count; i++) {
+        const image_t *image = &anim->images[i];
+        memcpy(saved, canvas, canvasBytes);
+        for (int row = 0; row < image->height; row++) {
+            for (int col = 0; col < image->width; col++) {
+                uint8_t pixel = image->pixels[row * image->width + col];
+                if (pixel != GIF_GREEN) {
+                    canvas[(image->y + row) * anim->width + image->x + col] = pixel;
+                }
+            }
+        }
+        for (int y = 0; y < CANVAS_HEIGHT; y++) {
+            int sy = output_sample(y, step, cropY, cropHeight);
+            for (int x = 0; x < CANVAS_WIDTH; x++) {
+                int sx = output_sample(x, step, cropX, cropWidth);
+                anim->shown[i][y][x] = sx < 0 || sy < 0 ? TRANSPARENT : canvas[sy * anim->width + sx];
+            }
+        }
+        if (image->disposal == 2) {
+            for (int row = 0; row < image->height; row++) {
+                memset(&canvas[(image->y + row) * anim->width + image->x], TRANSPARENT, image->width);
+            }
+        } else if (image->disposal == 3) {
+            memcpy(canvas, saved, canvasBytes);
+        }
+    }
+    free(canvas);
+    free(saved);
+}
+
+static bool write_animation(const animation_t *anim, const char *path, const char *comment, int commentAfter)
+{
+    gif_writer_t gif;
+    if (!gif_begin(&gif, path, anim->width, anim->height)) {
+        return false;
+    }
+    for (int i = 0; i < anim->count; i++) {
+        if (i == commentAfter) {
+            gif_comment(&gif, comment);
+        }
+        const image_t *image = &anim->images[i];
+        gif_image(&gif, image->x, image->y, image->width, image->height, image->pixels,
+            image->disposal, GIF_GREEN, image->interlaced);
+    }
+    return gif_end(&gif);
+}
+
+// Compare a full-panel layer with a canvas, pixel by pixel, as
+// gif_pixel_to_panel() maps them: transparent pixels have a clear mask,
+// white sets both planes, black only red and red only black
+static bool layer_matches(const layer_t *layer, const int8_t canvas[CANVAS_HEIGHT][CANVAS_WIDTH], char *detail,
+    size_t len)
+{
+    for (int y = 0; y < CANVAS_HEIGHT; y++) {
+        for (int x = 0; x < CANVAS_WIDTH; x++) {
+            int row = EPD_HEIGHT - x - 1;
+            size_t offset = row * LAYER_ROW_BYTES + y / 8;
+            uint8_t bit = 0x80 >> (y % 8);
+            bool opaque = (layer->mask[offset] & bit) != 0;
+            bool black = (layer->black[offset] & bit) != 0;
+            bool red = (layer->red[offset] & bit) != 0;
+            int pixel = canvas[y][x];
+            bool ok = pixel == TRANSPARENT ? !opaque
+                : opaque && black == (pixel != GIF_BLACK) && red == (pixel != GIF_RED);
+            if (!ok) {
+                snprintf(detail, len, "pixel (%i, %i) should be %i", x, y, pixel);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Every image, in a scrambled order, decoded straight and through the asset
+// cache twice (cold, then warm)
+static void check_animation(const animation_t *anim, const char *path, const char *name)
+{
+    layer_t layer;
+    render_arena_foreground_layer(&layer);
+    char detail[128] = "";
+    char checkName[128];
+
+    snprintf(detail, sizeof(detail), "%i images", foreground_frame_count(path));
+    snprintf(checkName, sizeof(checkName), "%s: frame count", name);
+    check(foreground_frame_count(path) == anim->count, checkName, detail);
+
+    bool ok = true;
+    int frame = 0;
+    for (int i = 0; i < anim->count && ok; i++) {
+        frame = (i * 7 + 3) % anim->count;
+        snprintf(detail, sizeof(detail), "could not decode");
+        ok = foreground_decode(path, frame, &layer, NULL)
+            && layer_matches(&layer, anim->shown[frame], detail, sizeof(detail));
+        for (int pass = 0; pass < 2 && ok; pass++) {
+            ok = foreground_load(path, frame, &layer, NULL)
+                && layer_matches(&layer, anim->shown[frame], detail, sizeof(detail));
+        }
+    }
+    snprintf(checkName, sizeof(checkName), "%s: every frame, in any order (frame %i)", name, frame);
+    check(ok, checkName, detail);
+}
+
+// Loading the last frame cold leaves a packed asset for it and a snapshot
+// every BADGE_ASSET_SNAPSHOT_FRAMES images that keeps itself on the canvas;
+// frames without an asset of their own then resume from those
+static void check_snapshots(const animation_t *anim, const char *path)
+{
+    layer_t layer;
+    render_arena_foreground_layer(&layer);
+    char detail[128] = "could not load";
+    int last = anim->count - 1;
+    foreground_cache_invalidate(path);
+    bool ok = foreground_load(path, last, &layer, NULL)
+        && layer_matches(&layer, anim->shown[last], detail, sizeof(detail));
+    check(ok, "snapshots: last frame, cold", detail);
+
+    ok = true;
+    for (int i = 0; i < anim->count && ok; i++) {
+        char packPath[64];
+        foreground_pack_path(path, i, packPath, sizeof(packPath));
+        struct stat st;
+        bool packed = stat(packPath, &st) == 0;
+        bool expected = i == last || (i % BADGE_ASSET_SNAPSHOT_FRAMES == 0 && anim->images[i].disposal <= 1);
+        snprintf(detail, sizeof(detail), "image %i %s", i, packed ? "packed" : "not packed");
+        ok = packed == expected;
+    }
+    check(ok, "snapshots: packed images", detail);
+
+    // Each frame after a snapshot, rebuilt from it
+    ok = true;
+    int frame = 0;
+    for (frame = 1; frame < anim->count && ok; frame++) {
+        char packPath[64];
+        foreground_pack_path(path, frame, packPath, sizeof(packPath));
+        if (frame % BADGE_ASSET_SNAPSHOT_FRAMES == 0) {
+            continue;
+        }
+        remove(packPath);
+        snprintf(detail, sizeof(detail), "could not load");
+        ok = foreground_load(path, frame, &layer, NULL)
+            && layer_matches(&layer, anim->shown[frame], detail, sizeof(detail));
+    }
+    char checkName[64];
+    snprintf(checkName, sizeof(checkName), "snapshots: frames resumed from them (frame %i)", frame - 1);
+    check(ok, checkName, detail);
+    foreground_cache_invalidate(path);
+}
+
+// A decoder of its own for crops, which foreground_decode() never asks
+// for, drawing palette indices into a plain output grid
+static badge_gif_decoder_t cropDecoder;
+static FILE *cropFile;
+static int8_t cropOutput[CANVAS_HEIGHT][CANVAS_WIDTH];
+static int cropStrays;
+
+static bool cropSeekCallback(unsigned long position)
+{
+    return fseek(cropFile, position, SEEK_SET) == 0;
+}
+
+static unsigned long cropPositionCallback(void)
+{
+    return ftell(cropFile);
+}
+
+static int cropReadCallback(void)
+{
+    return fgetc(cropFile);
+}
+
+static int cropReadBlockCallback(void *buffer, int numberOfBytes)
+{
+    return fread(buffer, numberOfBytes, 1, cropFile) == 1 ? 0 : -1;
+}
+
+static void cropDrawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green, uint8_t blue)
+{
+    if (x < 0 || x >= CANVAS_WIDTH || y < 0 || y >= CANVAS_HEIGHT) {
+        cropStrays++;
+        return;
+    }
+    cropOutput[y][x] = red && green ? GIF_WHITE : red ? GIF_RED : green ? GIF_GREEN : GIF_BLACK;
+}
+
+static void cropDisposeRectCallback(int16_t x, int16_t y, int16_t width, int16_t height)
+{
+    if (x < 0 || y < 0 || x + width > CANVAS_WIDTH || y + height > CANVAS_HEIGHT) {
+        cropStrays++;
+        return;
+    }
+    for (int row = y; row < y + height; row++) {
+        memset(&cropOutput[row][x], TRANSPARENT, width);
+    }
+}
+
+static bool output_matches(const int8_t expected[CANVAS_HEIGHT][CANVAS_WIDTH], char *detail, size_t len)
+{
+    for (int y = 0; y < CANVAS_HEIGHT; y++) {
+        for (int x = 0; x < CANVAS_WIDTH; x++) {
+            if (cropOutput[y][x] != expected[y][x]) {
+                snprintf(detail, len, "output (%i, %i) is %i, should be %i", x, y, cropOutput[y][x],
+                    expected[y][x]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Every image of the animation through decodeFrameAt(), cropped and shrunk
+static void check_crop(animation_t *anim, const char *path, const output_t *out, const char *name)
+{
+    static gif_frame_info frames[MAX_IMAGES];
+    char detail[128] = "could not open";
+    model_animation(anim, out);
+    cropFile = fopen(path, "rb");
+    bool ok = cropFile != NULL;
+    if (ok) {
+        cropDecoder.reset();
+        cropDecoder.setDrawPixelCallback(cropDrawPixelCallback);
+        cropDecoder.setDisposeRectCallback(cropDisposeRectCallback);
+        cropDecoder.setFileSeekCallback(cropSeekCallback);
+        cropDecoder.setFilePositionCallback(cropPositionCallback);
+        cropDecoder.setFileReadCallback(cropReadCallback);
+        cropDecoder.setFileReadBlockCallback(cropReadBlockCallback);
+        cropDecoder.setCrop(out->x, out->y, out->width, out->height);
+        cropDecoder.setFitSize(out->fitWidth, out->fitHeight);
+        snprintf(detail, sizeof(detail), "could not index");
+        ok = cropDecoder.startDecoding() == 0 && cropDecoder.scanFrames(frames, MAX_IMAGES) == anim->count;
+    }
+    int frame = 0;
+    for (frame = 0; frame < anim->count && ok; frame++) {
+        memset(cropOutput, TRANSPARENT, sizeof(cropOutput));
+        cropStrays = 0;
+        snprintf(detail, sizeof(detail), "could not decode");
+        ok = cropDecoder.decodeFrameAt(frames, frame) == 0
+            && output_matches(anim->shown[frame], detail, sizeof(detail));
+        if (ok && cropStrays > 0) {
+            snprintf(detail, sizeof(detail), "%i callbacks outside the output", cropStrays);
+            ok = false;
+        }
+    }
+    if (cropFile != NULL) {
+        fclose(cropFile);
+    }
+    char checkName[128];
+    snprintf(checkName, sizeof(checkName), "%s (frame %i)", name, frame - 1);
+    check(ok, checkName, detail);
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    char path[256];
+    char indexPath[256];
+    snprintf(path, sizeof(path), "%s/gif_check.gif", dir);
+    snprintf(indexPath, sizeof(indexPath), "%s/gif_check.gix", dir);
+
+    // A full first image, then deltas with each disposal method
+    animation_t *anim = &animation;
+    start_animation(anim, CANVAS_WIDTH, CANVAS_HEIGHT);
+    add_image(anim, 0, 0, CANVAS_WIDTH, CANVAS_HEIGHT, 1, 0);
+    for (int i = 1; i < 20; i++) {
+        int disposal = i == 4 ? 2 : i == 7 || i == 17 ? 3 : 1;
+        add_image(anim, 10 + i * 17 % 200, 5 + i * 11 % 140, 30, 20, disposal, i);
+    }
+    model_animation(anim, &panelOutput);
+    foreground_cache_invalidate(path);
+    check(write_animation(anim, path, "badge", 1), "write animation", path);
+    check_animation(anim, path, "animation");
+    check(file_size(indexPath) > 0, "animation saves its index", indexPath);
+    check_snapshots(anim, path);
+
+    // Same size and layout, but different images and the comment moved,
+    // so the images before it sit at other offsets
+    long oldSize = file_size(path);
+    for (int i = 1; i < anim->count; i++) {
+        image_t *image = &anim->images[i];
+        image->x = CANVAS_WIDTH - image->width - image->x;
+        for (int p = 0; p < image->width * image->height; p++) {
+            image->pixels[p] = (image->pixels[p] + 1) % 4;
+        }
+    }
+    model_animation(anim, &panelOutput);
+    check(write_animation(anim, path, "badge", 6), "rewrite animation", path);
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%li bytes, was %li", file_size(path), oldSize);
+    check(file_size(path) == oldSize, "replacement has the same size", detail);
+    // A reflash or copy gives it a new time
+    struct utimbuf times = { 1000000, 1000000 };
+    utime(path, &times);
+    check_animation(anim, path, "same-size replacement");
+
+    foreground_cache_invalidate(path);
+
+    // Wider than the decoder's row buffer (maxGifWidth, the panel's 264
+    // rows) and shrunk to the panel by about 2.3, with interlaced images,
+    // images whose disposal rects land between output pixels, and ones
+    // smaller than the scale step
+    start_animation(anim, 600, 300);
+    add_image(anim, 0, 0, 600, 300, 1, 0)->interlaced = true;
+    add_image(anim, 50, 30, 120, 90, 2, 1);
+    add_image(anim, 300, 101, 250, 150, 1, 2)->interlaced = true;
+    add_image(anim, 21, 200, 400, 90, 3, 3);
+    add_image(anim, 10, 9, 580, 43, 1, 4)->interlaced = true;
+    add_image(anim, 401, 7, 3, 3, 2, 5);
+    add_image(anim, 403, 5, 2, 7, 1, 6);
+    add_image(anim, 137, 150, 1, 1, 2, 7)->interlaced = true;
+    add_image(anim, 590, 290, 10, 10, 1, 8);
+    model_animation(anim, &panelOutput);
+    check(write_animation(anim, path, "badge", 3), "write oversized animation", path);
+    check_animation(anim, path, "oversized animation");
+    foreground_cache_invalidate(path);
+
+    // The same file through crops: shrunk, 1:1, and the whole screen to a
+    // quarter of the panel
+    static const output_t shrunkCrop = { 100, 40, 300, 200, CANVAS_WIDTH, CANVAS_HEIGHT };
+    static const output_t plainCrop = { 250, 60, CANVAS_WIDTH, CANVAS_HEIGHT, 0, 0 };
+    static const output_t quarter = { 0, 0, 0, 0, CANVAS_WIDTH / 2, CANVAS_HEIGHT / 2 };
+    check_crop(anim, path, &shrunkCrop, "crop, shrunk to fit");
+    check_crop(anim, path, &plainCrop, "crop, not scaled");
+    check_crop(anim, path, &quarter, "whole screen, shrunk to a quarter");
+
+    // A single image is scanned again rather than given an index file
+    start_animation(anim, CANVAS_WIDTH, CANVAS_HEIGHT);
+    add_image(anim, 0, 0, CANVAS_WIDTH, CANVAS_HEIGHT, 1, 0);
+    model_animation(anim, &panelOutput);
+    check(write_animation(anim, path, "badge", 1), "write single image", path);
+    check_animation(anim, path, "single image");
+    check(file_size(indexPath) < 0, "single image saves no index", indexPath);
+    foreground_cache_invalidate(path);
+
+    start_animation(anim, 0, 0);
+    remove(path);
+    printf("%s\r\n", failures ? "gif check FAILED" : "gif check passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+#include <string.h>
+#include "gif_writer.h"
+
+// Code size 8: the clear code is 256, and codes stay 9 bits wide as long
+// as a clear comes before the table reaches 512 entries
+#define MIN_CODE_SIZE 8
+#define CLEAR_CODE 256
+#define END_CODE 257
+#define CODES_PER_CLEAR 250
+
+typedef struct {
+    FILE *file;
+    uint8_t block[255];
+    int blockLen;
+    uint32_t bits;
+    int bitCount;
+} code_writer_t;
+
+static void put_word(FILE *file, int value)
+{
+    fputc(value & 0xFF, file);
+    fputc((value >> 8) & 0xFF, file);
+}
+
+static void flush_block(code_writer_t *writer)
+{
+    if (writer->blockLen > 0) {
+        fputc(writer->blockLen, writer->file);
+        fwrite(writer->block, writer->blockLen, 1, writer->file);
+        writer->blockLen = 0;
+    }
+}
+
+static void put_code(code_writer_t *writer, int code)
+{
+    writer->bits |= (uint32_t)code << writer->bitCount;
+    writer->bitCount += MIN_CODE_SIZE + 1;
+    while (writer->bitCount >= 8) {
+        writer->block[writer->blockLen++] = writer->bits & 0xFF;
+        writer->bits >>= 8;
+        writer->bitCount -= 8;
+        if (writer->blockLen == (int)sizeof(writer->block)) {
+            flush_block(writer);
+        }
+    }
+}
+
+bool gif_begin(gif_writer_t *gif, const char *path, int width, int height)
+{
+    gif->file = fopen(path, "wb");
+    if (gif->file == NULL) {
+        return false;
+    }
+    gif->width = width;
+    gif->height = height;
+    fwrite("GIF89a", 6, 1, gif->file);
+    put_word(gif->file, width);
+    put_word(gif->file, height);
+    fputc(0x80 | 0x01, gif->file);    // Global palette of 4 colors
+    fputc(0, gif->file);
+    fputc(0, gif->file);
+    static const uint8_t palette[4][3] = {
+        { 255, 255, 255 }, { 0, 0, 0 }, { 255, 0, 0 }, { 0, 255, 0 }
+    };
+    fwrite(palette, sizeof(palette), 1, gif->file);
+    return true;
+}
+
+bool gif_image(gif_writer_t *gif, int x, int y, int width, int height, const uint8_t *pixels,
+    int disposal, int transparent, bool interlaced)
+{
+    FILE *file = gif->file;
+    // Graphic control extension
+    fputc(0x21, file);
+    fputc(0xF9, file);
+    fputc(4, file);
+    fputc((disposal << 2) | (transparent >= 0 ? 1 : 0), file);
+    put_word(file, 10);
+    fputc(transparent >= 0 ? transparent : 0, file);
+    fputc(0, file);
+
+    fputc(0x2C, file);
+    put_word(file, x);
+    put_word(file, y);
+    put_word(file, width);
+    put_word(file, height);
+    fputc(interlaced ? 0x40 : 0, file);
+    fputc(MIN_CODE_SIZE, file);
+
+    code_writer_t writer = {};
+    writer.file = file;
+    static const int passStart[4] = { 0, 4, 2, 1 };
+    static const int passStep[4] = { 8, 8, 4, 2 };
+    int codes = 0;
+    for (int pass = 0; pass < (interlaced ? 4 : 1); pass++) {
+        int start = interlaced ? passStart[pass] : 0;
+        int step = interlaced ? passStep[pass] : 1;
+        for (int row = start; row < height; row += step) {
+            for (int col = 0; col < width; col++) {
+                if (codes % CODES_PER_CLEAR == 0) {
+                    put_code(&writer, CLEAR_CODE);
+                }
+                put_code(&writer, pixels[row * width + col]);
+                codes++;
+            }
+        }
+    }
+    put_code(&writer, END_CODE);
+    if (writer.bitCount > 0) {
+        writer.block[writer.blockLen++] = writer.bits & 0xFF;
+    }
+    flush_block(&writer);
+    fputc(0, file);
+    return !ferror(file);
+}
+
+bool gif_comment(gif_writer_t *gif, const char *text)
+{
+    size_t len = strlen(text);
+    fputc(0x21, gif->file);
+    fputc(0xFE, gif->file);
+    fputc((int)len, gif->file);
+    fwrite(text, len, 1, gif->file);
+    fputc(0, gif->file);
+    return !ferror(gif->file);
+}
+
+bool gif_end(gif_writer_t *gif)
+{
+    fputc(0x3B, gif->file);
+    bool ok = !ferror(gif->file);
+    fclose(gif->file);
+    gif->file = NULL;
+    return ok;
+}
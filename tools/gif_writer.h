@@ -0,0 +1,30 @@
+#ifndef BADGE_GIF_WRITER_H
+#define BADGE_GIF_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Minimal GIF89a writer for the host checks, so they can make animations,
+// oversized and interlaced images the bundled assets don't cover.  Image
+// data is LZW coded without compression (a clear code every few hundred
+// pixels), so a file's size depends only on its layout, not its pixels.
+
+typedef struct {
+    FILE *file;
+    int width;
+    int height;
+} gif_writer_t;
+
+// A 4-color global palette: white, black, red, and green, which the badge
+// treats as transparent
+enum { GIF_WHITE, GIF_BLACK, GIF_RED, GIF_GREEN };
+
+bool gif_begin(gif_writer_t *gif, const char *path, int width, int height);
+// One image of width x height palette indices at (x, y).  transparent is a
+// palette index or -1; disposal is the GIF disposal method (0-3).
+bool gif_image(gif_writer_t *gif, int x, int y, int width, int height, const uint8_t *pixels,
+    int disposal, int transparent, bool interlaced);
+bool gif_comment(gif_writer_t *gif, const char *text);
+bool gif_end(gif_writer_t *gif);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef BADGE_HOST_GPIO_H
+#define BADGE_HOST_GPIO_H
+
+// Host stand-in for the ESP-IDF GPIO driver, so the panel headers can be
+// included by the tools in this directory
+
+#include <stdint.h>
+
+typedef int gpio_num_t;
+
+int gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+int gpio_get_level(gpio_num_t gpio_num);
+
+#endif
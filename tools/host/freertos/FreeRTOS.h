@@ -0,0 +1,12 @@
+#ifndef BADGE_HOST_FREERTOS_H
+#define BADGE_HOST_FREERTOS_H
+
+// Host stand-in for FreeRTOS; ticks are 10 ms, as on the badge
+// (CONFIG_FREERTOS_HZ 100)
+
+#include <stdint.h>
+
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(ms) ((ms) / portTICK_PERIOD_MS)
+
+#endif
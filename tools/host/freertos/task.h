@@ -0,0 +1,16 @@
+#ifndef BADGE_HOST_TASK_H
+#define BADGE_HOST_TASK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void vTaskDelay(uint32_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+// Allocation hooks for the host tools: wrap the C library allocator to
+// track bytes in use and the peak, standing in for the ESP-IDF heap stats
+// that trace_memory() reports on the badge.
+
+#include <stddef.h>
+#include <malloc.h>
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+static size_t heapInUse = 0;
+static size_t heapPeak = 0;
+
+static void *track(void *ptr)
+{
+    if (ptr != NULL) {
+        heapInUse += malloc_usable_size(ptr);
+        if (heapInUse > heapPeak) {
+            heapPeak = heapInUse;
+        }
+    }
+    return ptr;
+}
+
+static void untrack(void *ptr)
+{
+    if (ptr != NULL) {
+        heapInUse -= malloc_usable_size(ptr);
+    }
+}
+
+void *malloc(size_t size)
+{
+    return track(__libc_malloc(size));
+}
+
+void *calloc(size_t count, size_t size)
+{
+    return track(__libc_calloc(count, size));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    untrack(ptr);
+    void *result = __libc_realloc(ptr, size);
+    if (result == NULL && size != 0) {
+        // The old block is still allocated
+        track(ptr);
+        return NULL;
+    }
+    return track(result);
+}
+
+void free(void *ptr)
+{
+    untrack(ptr);
+    __libc_free(ptr);
+}
+
+size_t host_heap_in_use(void)
+{
+    return heapInUse;
+}
+
+size_t host_heap_peak(void)
+{
+    return heapPeak;
+}
+
+}
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <string.h>
+#include "EPD_2in9b.h"
+#include "panel_emulator.h"
+
+// Modelled timings
+#define FRAME_MS        20      // 50 Hz frame rate
+#define POWER_ON_MS     80
+#define POWER_OFF_MS    20
+#define RESET_PULSE_MS  10      // Shortest reset pulse the driver relies on
+#define RESET_MS        5
+#define RESET_BUSY_MS   2       // From reset release until busy goes low
+#define OTP_REFRESH_MS  15000   // Tri-color waveform
+
+static panel_stats_t stats;
+static int64_t nowMs;
+static int64_t busyFromMs;
+static int64_t busyUntilMs;
+
+static int levels[40];
+static int resetLow;
+static int64_t resetLowMs;
+static int asleep;
+static int powered;
+
+// Command being received and its parameters so far.  A command is only
+// complete when the next one starts, as its parameters may come in more
+// than one transfer.
+static int command = -1;
+static uint8_t params[64];
+static int paramCount;
+
+// Registers
+static int panelSetting = -1;
+static int resolutionOk;
+static int lutLoaded[5];
+static uint8_t vcomLut[44];
+
+// Display RAM: old/black data and new/red data, valid once filled
+static uint8_t ram[2][EPD_PLANE_BYTES];
+static long ramFill[2];
+static int ramValid[2];
+
+static uint8_t screen[EPD_HEIGHT][EPD_WIDTH];
+
+static void fail(const char *what)
+{
+    printf("panel: %s\r\n", what);
+    stats.errors++;
+}
+
+// Parameters each command takes, -1 for image data
+static int expected_params(int cmd)
+{
+    switch (cmd) {
+    case BOOSTER_SOFT_START: return 3;
+    case PANEL_SETTING: return 1;
+    case VCOM_AND_DATA_INTERVAL_SETTING: return 1;
+    case TCON_RESOLUTION: return 4;
+    case VCM_DC_SETTING_REGISTER: return 1;
+    case DEEP_SLEEP: return 1;
+    case LUT_VCOM: return 44;
+    case LUT_WW: case LUT_BW: case LUT_WB: case LUT_BB: return 42;
+    case DATA_START_TRANSMISSION_1: case DATA_START_TRANSMISSION_2: return -1;
+    default: return 0;
+    }
+}
+
+static bool lut_mode(void)
+{
+    return panelSetting >= 0 && (panelSetting & 0x20);
+}
+
+static void refresh(void)
+{
+    if (!powered) {
+        fail("refresh with the panel powered off");
+        return;
+    }
+    if (panelSetting < 0 || !resolutionOk) {
+        fail("refresh before panel setting and resolution");
+        return;
+    }
+    bool mono = lut_mode();
+    if (mono && !(lutLoaded[0] && lutLoaded[1] && lutLoaded[2] && lutLoaded[3] && lutLoaded[4])) {
+        fail("refresh from LUT registers that are not all loaded");
+        return;
+    }
+    if (!ramValid[1] || (!mono && !ramValid[0])) {
+        fail("refresh from an incomplete image");
+        return;
+    }
+
+    bool redLeft = false;
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        for (int x = 0; x < EPD_WIDTH; x++) {
+            int offset = y * (EPD_WIDTH / 8) + x / 8;
+            uint8_t bit = 0x80 >> (x % 8);
+            bool white = (ram[mono ? 1 : 0][offset] & bit) != 0;
+            if (mono) {
+                // Red pigment is not driven
+                if (screen[y][x] == PANEL_RED) {
+                    redLeft = true;
+                    continue;
+                }
+            } else if (!(ram[1][offset] & bit)) {
+                screen[y][x] = PANEL_RED;
+                continue;
+            }
+            screen[y][x] = white ? PANEL_WHITE : PANEL_BLACK;
+        }
+    }
+    if (redLeft) {
+        fail("black and white refresh left red on the screen");
+    }
+
+    long ms = OTP_REFRESH_MS;
+    if (mono) {
+        // Frame counts times repeats of each VCOM group
+        ms = 0;
+        for (int group = 0; group < 7; group++) {
+            const uint8_t *g = vcomLut + group * 6;
+            ms += (long)(g[1] + g[2] + g[3] + g[4]) * g[5] * FRAME_MS;
+        }
+    }
+    busyUntilMs = nowMs + ms;
+    stats.refreshes++;
+}
+
+// The command and its parameters are complete
+static void finish_command(void)
+{
+    if (command < 0) {
+        return;
+    }
+    int expected = expected_params(command);
+    if (expected >= 0 && paramCount != expected) {
+        char what[80];
+        snprintf(what, sizeof(what), "command 0x%02x took %i parameters, not %i",
+            command, paramCount, expected);
+        fail(what);
+    }
+    switch (command) {
+    case PANEL_SETTING:
+        panelSetting = params[0];
+        break;
+    case TCON_RESOLUTION:
+        resolutionOk = params[0] == (EPD_WIDTH >> 8) && params[1] == (EPD_WIDTH & 0xff)
+            && params[2] == (EPD_HEIGHT >> 8) && params[3] == (EPD_HEIGHT & 0xff);
+        if (!resolutionOk) {
+            fail("resolution is not 176x264");
+        }
+        break;
+    case LUT_VCOM:
+        memcpy(vcomLut, params, sizeof(vcomLut));
+        // Fall through
+    case LUT_WW: case LUT_BW: case LUT_WB: case LUT_BB:
+        lutLoaded[command - LUT_VCOM] = paramCount == expected;
+        break;
+    case DATA_START_TRANSMISSION_1:
+    case DATA_START_TRANSMISSION_2: {
+        int plane = command == DATA_START_TRANSMISSION_1 ? 0 : 1;
+        // A partial plane is fine as long as it is never shown
+        ramValid[plane] = ramFill[plane] == EPD_PLANE_BYTES;
+        break;
+    }
+    case DEEP_SLEEP:
+        if (params[0] != 0xA5) {
+            fail("deep sleep without its check code");
+        }
+        asleep = 1;
+        powered = 0;
+        // The RAM is not kept
+        ramValid[0] = ramValid[1] = 0;
+        break;
+    }
+    command = -1;
+}
+
+static void start_command(int cmd)
+{
+    finish_command();
+    if (asleep) {
+        fail("command while in deep sleep");
+    }
+    if (nowMs < busyUntilMs) {
+        fail("command while busy");
+    }
+    command = cmd;
+    paramCount = 0;
+    switch (cmd) {
+    case POWER_ON:
+        powered = 1;
+        busyUntilMs = nowMs + POWER_ON_MS;
+        break;
+    case POWER_OFF:
+        if (!powered) {
+            fail("power off while off");
+        }
+        powered = 0;
+        busyUntilMs = nowMs + POWER_OFF_MS;
+        break;
+    case DATA_START_TRANSMISSION_1:
+    case DATA_START_TRANSMISSION_2:
+        ramFill[cmd == DATA_START_TRANSMISSION_1 ? 0 : 1] = 0;
+        break;
+    case DISPLAY_REFRESH:
+        refresh();
+        break;
+    }
+}
+
+static void data(uint8_t value)
+{
+    if (command < 0) {
+        fail("data without a command");
+        return;
+    }
+    if (command == DATA_START_TRANSMISSION_1 || command == DATA_START_TRANSMISSION_2) {
+        int plane = command == DATA_START_TRANSMISSION_1 ? 0 : 1;
+        if (ramFill[plane] >= EPD_PLANE_BYTES) {
+            fail("more image data than the panel holds");
+            return;
+        }
+        ram[plane][ramFill[plane]++] = value;
+        stats.planeBytes++;
+        return;
+    }
+    if (paramCount < (int)sizeof(params)) {
+        params[paramCount] = value;
+    }
+    paramCount++;
+}
+
+static void reset(void)
+{
+    finish_command();
+    asleep = 0;
+    powered = 0;
+    panelSetting = -1;
+    resolutionOk = 0;
+    memset(lutLoaded, 0, sizeof(lutLoaded));
+    // The controller is busy until it has restarted, but only pulls the
+    // line low a little after reset is released
+    busyFromMs = nowMs + RESET_BUSY_MS;
+    busyUntilMs = nowMs + RESET_MS;
+    stats.resets++;
+}
+
+extern "C" int gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num == EPD_RST_PIN) {
+        if (!level) {
+            resetLow = 1;
+            resetLowMs = nowMs;
+        } else if (resetLow) {
+            resetLow = 0;
+            if (nowMs - resetLowMs < RESET_PULSE_MS) {
+                fail("reset pulse too short");
+            }
+            reset();
+        }
+    }
+    levels[gpio_num] = level;
+    return 0;
+}
+
+extern "C" int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (gpio_num == EPD_BUSY_PIN) {
+        // Low while busy
+        return nowMs < busyFromMs || nowMs >= busyUntilMs;
+    }
+    return levels[gpio_num];
+}
+
+// A delay of n ticks ends at the nth tick boundary, and the first can come
+// straight away, so the shortest it can be is modelled: n - 1 ticks and a
+// millisecond
+extern "C" void vTaskDelay(uint32_t ticks)
+{
+    int64_t ms = ticks > 0 ? (int64_t)(ticks - 1) * portTICK_PERIOD_MS + 1 : 0;
+    if (nowMs < busyUntilMs) {
+        int64_t busy = busyUntilMs - nowMs;
+        stats.busyMs += busy < ms ? busy : ms;
+    }
+    nowMs += ms;
+    stats.elapsedMs += ms;
+}
+
+// Each transfer is sent as soon as it is queued, in DEV_SPI_MAX_TRANSFER
+// pieces like the real queue
+extern "C" void DEV_SPI_Queue(const UBYTE *bytes, UDOUBLE len, UBYTE dc)
+{
+    if (len == 0) {
+        fail("empty SPI transfer");
+        return;
+    }
+    stats.spiBytes += len;
+    stats.transfers += (len + DEV_SPI_MAX_TRANSFER - 1) / DEV_SPI_MAX_TRANSFER;
+    for (UDOUBLE i = 0; i < len; i++) {
+        if (dc) {
+            data(bytes[i]);
+        } else {
+            start_command(bytes[i]);
+        }
+    }
+}
+
+extern "C" void DEV_SPI_Flush(void)
+{
+}
+
+void panel_emu_reset_stats(void)
+{
+    finish_command();
+    memset(&stats, 0, sizeof(stats));
+}
+
+const panel_stats_t *panel_emu_stats(void)
+{
+    return &stats;
+}
+
+int panel_emu_pixel(int x, int y)
+{
+    return screen[y][x];
+}
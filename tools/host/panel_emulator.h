@@ -0,0 +1,36 @@
+#ifndef BADGE_HOST_PANEL_EMULATOR_H
+#define BADGE_HOST_PANEL_EMULATOR_H
+
+// Host stand-in for the panel.  It provides the GPIO, SPI and delay calls
+// that EPD_2in9b.c makes, decodes the byte stream into controller commands
+// and checks them against what the controller needs: parameter counts,
+// reset and power sequencing, complete planes and loaded LUTs before a
+// refresh.  A refresh updates an emulated screen, and busy time is modelled
+// so refresh costs can be compared.
+
+#include <stdint.h>
+
+enum {
+    PANEL_WHITE,
+    PANEL_BLACK,
+    PANEL_RED,
+};
+
+typedef struct {
+    long spiBytes;        // Everything sent, commands included
+    long transfers;       // SPI transactions, each with a chip select
+    long planeBytes;      // Image data
+    int refreshes;
+    long busyMs;          // Modelled time with the busy line held
+    long elapsedMs;       // Modelled time in delays and waits
+    int resets;
+    int errors;           // Broken rules, each also printed
+} panel_stats_t;
+
+void panel_emu_reset_stats(void);
+const panel_stats_t *panel_emu_stats(void);
+
+// Color shown at panel column x (0..175) of row y (0..263)
+int panel_emu_pixel(int x, int y);
+
+#endif
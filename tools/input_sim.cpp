@@ -0,0 +1,176 @@
+// Host simulation of the advance button handling: feeds synthetic press
+// sequences, contact bounce included, through the firmware's input queue
+// and a model of the app_main loop, and counts panel refreshes against the
+// old one-press-per-cycle loop.
+//
+//   make -C tools && tools/input_sim
+
+#include <stdio.h>
+#include <stdint.h>
+#include "input_queue.h"
+
+#define IMAGE_COUNT 7
+
+// Stage durations of one display update, in milliseconds
+#define RENDER_MS 1500      // Render and upload, cancellable
+#define REFRESH_MS 15000    // Tri-color refresh, runs to completion
+#define KEEPALIVE_MS 500    // Cut short by a press
+
+#define MAX_EDGES 256
+
+typedef struct {
+    int64_t us;
+    int level;
+} edge_t;
+
+typedef struct {
+    const char *name;
+    int presses;
+    int intervalMs;
+    int holdMs;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "single press",      1,     0, 120 },
+    { "5 presses, 200ms",  5,   200, 120 },
+    { "10 presses, 150ms", 10,  150,  60 },
+    { "5 presses, 3s",     5,  3000, 120 },
+    { "5 presses, 20s",    5, 20000, 120 },
+    { "3 long holds",      3,  1000, 700 },
+};
+
+static edge_t edges[MAX_EDGES];
+static int edgeCount;
+
+static void add_edge(int64_t us, int level)
+{
+    if (edgeCount < MAX_EDGES) {
+        edges[edgeCount].us = us;
+        edges[edgeCount].level = level;
+        edgeCount++;
+    }
+}
+
+// Every press and release bounces twice within a couple of milliseconds
+static void build_edges(const scenario_t *scenario)
+{
+    edgeCount = 0;
+    for (int i = 0; i < scenario->presses; i++) {
+        int64_t down = (int64_t)i * scenario->intervalMs * 1000;
+        int64_t up = down + (int64_t)scenario->holdMs * 1000;
+        add_edge(down, 0);
+        add_edge(down + 1000, 1);
+        add_edge(down + 2000, 0);
+        add_edge(up, 1);
+        add_edge(up + 1000, 0);
+        add_edge(up + 2000, 1);
+    }
+}
+
+typedef struct {
+    input_queue_t queue;
+    int nextEdge;
+    int64_t now;
+    int refreshes;
+} sim_t;
+
+// Advance to `until`, feeding edges to the queue.  A cancellable stage
+// stops at the first accepted press; returns false if it did.
+static bool run_stage(sim_t *sim, int64_t durationMs, bool cancellable)
+{
+    int64_t until = sim->now + durationMs * 1000;
+    while (sim->nextEdge < edgeCount && edges[sim->nextEdge].us <= until) {
+        const edge_t *edge = &edges[sim->nextEdge++];
+        bool press = input_queue_edge(&sim->queue, edge->us, edge->level);
+        if (press && cancellable) {
+            sim->now = edge->us;
+            return false;
+        }
+    }
+    sim->now = until;
+    return true;
+}
+
+// The current loop: fold pending presses into one jump, cancel on press
+static int simulate_coalescing(sim_t *sim)
+{
+    int image = 0;
+    input_queue_init(&sim->queue);
+    sim->nextEdge = 0;
+    sim->now = 0;
+    sim->refreshes = 0;
+    while (sim->nextEdge < edgeCount || input_queue_pending(&sim->queue) > 0) {
+        if (input_queue_pending(&sim->queue) == 0) {
+            // Asleep until the next edge wakes the badge
+            sim->now = edges[sim->nextEdge].us;
+            run_stage(sim, 0, false);
+            continue;
+        }
+        image = (image + input_queue_take(&sim->queue, sim->now, NULL)) % IMAGE_COUNT;
+        if (!run_stage(sim, RENDER_MS, true)) {
+            continue;
+        }
+        run_stage(sim, REFRESH_MS, false);
+        sim->refreshes++;
+        run_stage(sim, KEEPALIVE_MS, true);
+    }
+    return image;
+}
+
+// The loop before the input queue: every falling edge sets one flag, and
+// each pass advances a single image and runs to completion
+static int simulate_legacy(sim_t *sim)
+{
+    int image = 0;
+    int nextEdge = 0;
+    int64_t now = 0;
+    bool pressed = false;
+    sim->refreshes = 0;
+    while (nextEdge < edgeCount || pressed) {
+        if (!pressed) {
+            now = edges[nextEdge].us;
+        }
+        while (nextEdge < edgeCount && edges[nextEdge].us <= now) {
+            pressed |= edges[nextEdge++].level == 0;
+        }
+        if (!pressed) {
+            continue;
+        }
+        pressed = false;
+        image = (image + 1) % IMAGE_COUNT;
+        now += (RENDER_MS + REFRESH_MS + KEEPALIVE_MS) * 1000;
+        sim->refreshes++;
+        while (nextEdge < edgeCount && edges[nextEdge].us <= now) {
+            pressed |= edges[nextEdge++].level == 0;
+        }
+    }
+    return image;
+}
+
+int main(void)
+{
+    int failures = 0;
+    printf("Render %i ms, refresh %i ms, keep-alive %i ms, debounce %i ms\n\n",
+        RENDER_MS, REFRESH_MS, KEEPALIVE_MS, BADGE_DEBOUNCE_MS);
+    printf("%-20s %7s %5s %8s | %15s | %15s\n", "", "presses", "edges", "accepted",
+        "legacy refr/img", "queued refr/img");
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        const scenario_t *scenario = &scenarios[i];
+        build_edges(scenario);
+        int target = scenario->presses % IMAGE_COUNT;
+
+        sim_t legacy;
+        int legacyImage = simulate_legacy(&legacy);
+        sim_t queued;
+        int queuedImage = simulate_coalescing(&queued);
+
+        bool ok = queuedImage == target && queued.queue.presses == (uint32_t)scenario->presses;
+        failures += !ok;
+        printf("%-20s %7i %5u %8u | %9i / %-3i | %9i / %-3i %s\n", scenario->name,
+            scenario->presses, queued.queue.edges, queued.queue.presses,
+            legacy.refreshes, legacyImage, queued.refreshes, queuedImage,
+            ok ? "ok" : "WRONG IMAGE OR PRESS COUNT");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+// Where the firmware ended up: IRAM, DRAM, RTC and flash use per output
+// section, and per object of the main component, read from the linker map.
+// Run after a build to check what linker.lf placed and what it cost.  Fails
+// if the state kept across deep sleep outgrows the map's rtc_slow_seg, which
+// main/rtc_budget.h only estimates.
+//
+//   make -C tools && tools/map_report build/hello-world.map
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Output sections worth reporting, by the memory they land in
+struct region_t {
+    const char *section;
+    const char *region;
+};
+
+static const region_t regions[] = {
+    { ".iram0.vectors", "iram" },
+    { ".iram0.text",    "iram" },
+    { ".dram0.data",    "dram" },
+    { ".dram0.bss",     "dram" },
+    { ".rtc.text",      "rtc fast" },
+    { ".rtc.data",      "rtc slow" },
+    { ".rtc.bss",       "rtc slow" },
+    { ".rtc_noinit",    "rtc slow" },
+    { ".flash.rodata",  "flash" },
+    { ".flash.text",    "flash" },
+};
+static const int kRegionCount = sizeof(regions) / sizeof(regions[0]);
+static const char *kArchive = "libmain.a(";
+
+static int region_index(const std::string &section)
+{
+    for (int i = 0; i < kRegionCount; i++) {
+        if (section == regions[i].section) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// "0x400d1234  0x54 path/libmain.a(background.cpp.obj)" -> size and file
+static bool parse_placement(const char *text, unsigned long *size, std::string *file)
+{
+    unsigned long address;
+    char rest[512] = "";
+    if (sscanf(text, " 0x%lx 0x%lx %511[^\n]", &address, size, rest) < 2) {
+        return false;
+    }
+    *file = rest;
+    return true;
+}
+
+// "path/libmain.a(background.cpp.obj)" -> "background"
+static bool main_object(const std::string &file, std::string *object)
+{
+    size_t start = file.find(kArchive);
+    if (start == std::string::npos) {
+        return false;
+    }
+    start += strlen(kArchive);
+    size_t end = file.find('.', start);
+    *object = file.substr(start, end - start);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <firmware.map>\n", argv[0]);
+        return 2;
+    }
+    FILE *map = fopen(argv[1], "r");
+    if (map == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    unsigned long sectionSize[kRegionCount] = {};
+    std::map<std::string, std::vector<unsigned long> > objects;
+    unsigned long rtcSlowSegment = 0;
+    int current = -1;
+    bool inMap = false;
+    std::string pendingName;
+    char line[1024];
+    while (fgets(line, sizeof(line), map) != NULL) {
+        if (!inMap) {
+            // "rtc_slow_seg  0x50000000  0x00001000  rw" in the memory configuration
+            char name[64];
+            unsigned long origin, length;
+            if (sscanf(line, "%63s 0x%lx 0x%lx", name, &origin, &length) == 3
+                && strcmp(name, "rtc_slow_seg") == 0) {
+                rtcSlowSegment = length;
+            }
+            inMap = strncmp(line, "Linker script and memory map", 28) == 0;
+            continue;
+        }
+        if (line[0] == '.') {
+            // Output section, with its address and size on this line or the next
+            char name[256];
+            unsigned long address, size;
+            int fields = sscanf(line, "%255s 0x%lx 0x%lx", name, &address, &size);
+            current = region_index(name);
+            if (current >= 0 && fields < 3 && fgets(line, sizeof(line), map) != NULL
+                && sscanf(line, " 0x%lx 0x%lx", &address, &size) == 2) {
+                fields = 3;
+            }
+            if (current >= 0 && fields == 3) {
+                sectionSize[current] = size;
+            }
+            continue;
+        }
+        if (current < 0 || line[0] != ' ' || line[1] == ' ' || line[1] == '*') {
+            continue;
+        }
+        // Input section, long names put the placement on the next line
+        char name[512];
+        if (sscanf(line, " %511s", name) != 1) {
+            continue;
+        }
+        const char *placement = line + 1 + strlen(name);
+        unsigned long size;
+        std::string file;
+        if (!parse_placement(placement, &size, &file)) {
+            if (fgets(line, sizeof(line), map) == NULL || !parse_placement(line, &size, &file)) {
+                continue;
+            }
+        }
+        std::string object;
+        if (size > 0 && main_object(file, &object)) {
+            std::vector<unsigned long> &sizes = objects[object];
+            sizes.resize(kRegionCount);
+            sizes[current] += size;
+        }
+    }
+    fclose(map);
+
+    printf("%-16s %-9s %8s\n", "section", "memory", "bytes");
+    for (int i = 0; i < kRegionCount; i++) {
+        printf("%-16s %-9s %8lu\n", regions[i].section, regions[i].region, sectionSize[i]);
+    }
+
+    // Main component objects, bytes per memory
+    const char *columns[] = { "iram", "dram", "rtc fast", "rtc slow", "flash" };
+    const int kColumnCount = sizeof(columns) / sizeof(columns[0]);
+    printf("\n%-16s", "main object");
+    for (int c = 0; c < kColumnCount; c++) {
+        printf(" %9s", columns[c]);
+    }
+    printf("\n");
+    for (std::map<std::string, std::vector<unsigned long> >::const_iterator it = objects.begin();
+        it != objects.end(); ++it) {
+        printf("%-16s", it->first.c_str());
+        for (int c = 0; c < kColumnCount; c++) {
+            unsigned long bytes = 0;
+            for (int i = 0; i < kRegionCount; i++) {
+                if (strcmp(regions[i].region, columns[c]) == 0) {
+                    bytes += it->second[i];
+                }
+            }
+            printf(" %9lu", bytes);
+        }
+        printf("\n");
+    }
+
+    unsigned long rtcSlow = 0;
+    for (int i = 0; i < kRegionCount; i++) {
+        if (strcmp(regions[i].region, "rtc slow") == 0) {
+            rtcSlow += sectionSize[i];
+        }
+    }
+    if (rtcSlowSegment == 0) {
+        printf("\nrtc slow: %lu bytes, no rtc_slow_seg in the map\n", rtcSlow);
+        return 0;
+    }
+    printf("\nrtc slow: %lu of %lu bytes in rtc_slow_seg\n", rtcSlow, rtcSlowSegment);
+    if (rtcSlow > rtcSlowSegment) {
+        printf("RTC slow memory over budget, see main/rtc_budget.h\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,225 @@
+// Runs the panel driver against the host panel emulator: the command
+// stream has to satisfy the controller and leave the expected picture,
+// and the red-plane skip and fast black and white waveform have to send
+// and cost what they claim.  Traffic has to go out in a handful of
+// transfers, and panel sessions have to reuse a ready panel without
+// breaking the controller's sequencing.
+//
+//   make -C tools && tools/panel_check
+
+#include <stdio.h>
+#include <string.h>
+#include "EPD_2in9b.h"
+#include "panel_emulator.h"
+#include "panel_session.h"
+
+#define ROW_BYTES (EPD_WIDTH / 8)
+
+static uint8_t black[EPD_PLANE_BYTES];
+static uint8_t red[EPD_PLANE_BYTES];
+static uint8_t noRed[EPD_PLANE_BYTES];
+static int failures = 0;
+
+static void check(bool ok, const char *name, const char *detail)
+{
+    printf("%-4s %s%s%s\r\n", ok ? "ok" : "FAIL", name, ok ? "" : ": ", ok ? "" : detail);
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Diagonal stripes of black, with a red block in the middle if wanted
+static void make_frame(int phase, bool withRed)
+{
+    memset(black, 0xFF, sizeof(black));
+    memset(red, 0xFF, sizeof(red));
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        for (int x = 0; x < EPD_WIDTH; x++) {
+            uint8_t bit = 0x80 >> (x % 8);
+            if (((x + y + phase) / 12) % 2) {
+                black[y * ROW_BYTES + x / 8] &= ~bit;
+            }
+            if (withRed && x >= 40 && x < 136 && y >= 80 && y < 184) {
+                red[y * ROW_BYTES + x / 8] &= ~bit;
+            }
+        }
+    }
+}
+
+static bool screen_matches(bool mono)
+{
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        for (int x = 0; x < EPD_WIDTH; x++) {
+            int offset = y * ROW_BYTES + x / 8;
+            uint8_t bit = 0x80 >> (x % 8);
+            int want = (black[offset] & bit) ? PANEL_WHITE : PANEL_BLACK;
+            if (!mono && !(red[offset] & bit)) {
+                want = PANEL_RED;
+            }
+            if (panel_emu_pixel(x, y) != want) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Upload the way band mode and stored frames do, a few rows at a time
+static void stream_frame(void)
+{
+    const UBYTE planeCommands[2] = { DATA_START_TRANSMISSION_1, DATA_START_TRANSMISSION_2 };
+    const uint8_t *planes[2] = { black, red };
+    for (int plane = 0; plane < 2; plane++) {
+        if (!EPD_StartPlane(planeCommands[plane])) {
+            continue;
+        }
+        for (int row = 0; row < EPD_HEIGHT; row += 24) {
+            int rows = EPD_HEIGHT - row < 24 ? EPD_HEIGHT - row : 24;
+            EPD_SendPlaneRows(planes[plane] + row * ROW_BYTES, rows);
+        }
+        EPD_EndPlane();
+    }
+    EPD_Refresh();
+}
+
+int main()
+{
+    const panel_stats_t *stats = panel_emu_stats();
+    char detail[128];
+    memset(noRed, 0xFF, sizeof(noRed));
+
+    // Full tri-color update, as every wake does it
+    make_frame(0, true);
+    panel_emu_reset_stats();
+    EPD_Init(NULL);
+    EPD_Display(black, red);
+    EPD_Sleep();
+    long colorMs = stats->busyMs;
+    snprintf(detail, sizeof(detail), "%i errors, %ld plane bytes", stats->errors, stats->planeBytes);
+    check(stats->errors == 0 && stats->planeBytes == 2 * EPD_PLANE_BYTES && screen_matches(false),
+        "tri-color frame", detail);
+    // Commands go out as scripts and planes as whole bands, so the update
+    // is a few dozen transfers rather than one per byte
+    snprintf(detail, sizeof(detail), "%ld transfers for %ld bytes", stats->transfers, stats->spiBytes);
+    check(stats->transfers < 32, "batched transfers", detail);
+
+    // The same red plane again before the panel sleeps is not resent
+    make_frame(5, true);
+    panel_emu_reset_stats();
+    EPD_Init(NULL);
+    EPD_Display(black, red);
+    make_frame(9, true);
+    EPD_Display(black, red);
+    EPD_Sleep();
+    snprintf(detail, sizeof(detail), "%i errors, %ld plane bytes", stats->errors, stats->planeBytes);
+    check(stats->errors == 0 && stats->planeBytes == 3 * EPD_PLANE_BYTES && screen_matches(false),
+        "unchanged red plane skipped", detail);
+
+    // Deep sleep loses the panel RAM, so it has to be sent again
+    panel_emu_reset_stats();
+    EPD_Init(NULL);
+    EPD_Display(black, red);
+    EPD_Sleep();
+    snprintf(detail, sizeof(detail), "%i errors, %ld plane bytes", stats->errors, stats->planeBytes);
+    check(stats->errors == 0 && stats->planeBytes == 2 * EPD_PLANE_BYTES,
+        "red plane resent after deep sleep", detail);
+
+    // Clear to white so the next frames start without red
+    panel_emu_reset_stats();
+    EPD_Init(NULL);
+    EPD_Clear();
+    EPD_Refresh();
+    EPD_Sleep();
+    memset(black, 0xFF, sizeof(black));
+    memset(red, 0xFF, sizeof(red));
+    check(stats->errors == 0 && screen_matches(false), "clear", "screen not white");
+
+    // Streamed tri-color upload of a frame without red
+    make_frame(3, false);
+    check(EPD_PlaneBlank(red, EPD_HEIGHT) && !EPD_PlaneBlank(black, EPD_HEIGHT),
+        "red-free frame detected", "EPD_PlaneBlank disagrees");
+    panel_emu_reset_stats();
+    EPD_Init(NULL);
+    stream_frame();
+    EPD_Sleep();
+    check(stats->errors == 0 && screen_matches(false), "streamed frame", "picture differs");
+
+    // Fast black and white: one plane, a fraction of the refresh time
+    make_frame(7, false);
+    panel_emu_reset_stats();
+    EPD_Init(&EPD_LUT_FAST_MONO);
+    stream_frame();
+    EPD_Sleep();
+    long fastMs = stats->busyMs;
+    snprintf(detail, sizeof(detail), "%i errors, %ld plane bytes, %ld ms against %ld ms",
+        stats->errors, stats->planeBytes, fastMs, colorMs);
+    check(stats->errors == 0 && stats->planeBytes == EPD_PLANE_BYTES && screen_matches(true)
+        && fastMs * 10 < colorMs, "fast black and white", detail);
+    printf("     refresh %ld ms tri-color, %ld ms fast\r\n", colorMs, fastMs);
+
+    // Two cold updates, as every update used to be
+    make_frame(1, true);
+    panel_emu_reset_stats();
+    for (int i = 0; i < 2; i++) {
+        EPD_Init(NULL);
+        EPD_Display(black, red);
+        EPD_Sleep();
+    }
+    long coldMs = stats->elapsedMs;
+
+    // The same two in one session: one reset, the second waits on the
+    // first refresh and does not resend the red plane
+    panel_emu_reset_stats();
+    for (int i = 0; i < 2; i++) {
+        panel_session_begin(NULL);
+        EPD_Upload(black, red);
+        panel_session_refresh();
+    }
+    bool readyBetween = panel_session_state() == PANEL_READY;
+    panel_session_sleep();
+    snprintf(detail, sizeof(detail), "%i errors, %i resets, %ld plane bytes, %ld ms against %ld ms",
+        stats->errors, stats->resets, stats->planeBytes, stats->elapsedMs, coldMs);
+    check(stats->errors == 0 && stats->resets == 1 && stats->planeBytes == 3 * EPD_PLANE_BYTES
+        && readyBetween && panel_session_state() == PANEL_DEEP_SLEEP && screen_matches(false)
+        && stats->elapsedMs < coldMs, "session reuses a ready panel", detail);
+
+    // Powered down between updates the panel keeps its registers and RAM,
+    // and a change of waveform is only a reconfigure
+    panel_emu_reset_stats();
+    make_frame(2, false);
+    panel_session_begin(NULL);
+    EPD_Upload(black, red);
+    panel_session_refresh();
+    panel_session_idle();
+    bool powered = panel_session_state() == PANEL_POWERED;
+    make_frame(4, false);
+    panel_session_begin(&EPD_LUT_FAST_MONO);
+    stream_frame();
+    panel_session_sleep();
+    snprintf(detail, sizeof(detail), "%i errors, %i resets", stats->errors, stats->resets);
+    check(stats->errors == 0 && stats->resets == 1 && powered && screen_matches(true),
+        "session powers down and switches waveform", detail);
+
+    // The emulator has to catch the misuses the driver's callers avoid
+    make_frame(0, true);
+    EPD_Init(NULL);
+    EPD_Display(black, red);
+    EPD_Sleep();
+    panel_emu_reset_stats();
+    EPD_Init(&EPD_LUT_FAST_MONO);
+    EPD_Display(black, noRed);
+    EPD_Sleep();
+    check(stats->errors > 0, "fast refresh over red is caught", "no error reported");
+
+    panel_emu_reset_stats();
+    EPD_Init(NULL);
+    EPD_StartPlane(DATA_START_TRANSMISSION_1);
+    EPD_SendPlaneRows(black, EPD_HEIGHT / 2);
+    EPD_EndPlane();
+    EPD_Refresh();
+    EPD_Sleep();
+    check(stats->errors > 0, "refresh of a partial upload is caught", "no error reported");
+
+    printf("%s\r\n", failures ? "panel check FAILED" : "panel check passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,26 @@
+// Host mock of the badge self-benchmark: the same steps and table as
+// holding the advance button at boot, with the panel replaced by a sink.
+//
+//   make -C tools && tools/self_bench [spiffs_image]
+
+#include <stdio.h>
+#include "self_bench.h"
+
+static const char *assets[] = {
+    "dino.gif", "youtube.gif", "twitter.gif", "namebottom.gif",
+    "mozillamr.gif", "fxrlogo.gif", "github.gif"
+};
+static const int kAssetCount = sizeof(assets) / sizeof(assets[0]);
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "spiffs_image";
+    static char paths[kAssetCount][256];
+    const char *pathList[kAssetCount];
+    for (int i = 0; i < kAssetCount; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%s", dir, assets[i]);
+        pathList[i] = paths[i];
+    }
+    self_bench_run(pathList, kAssetCount);
+    return 0;
+}